@@ -22,7 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "d3d_model.h"
 #include "d3d_quake.h"
 
-bool SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace);
+bool SV_HullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace);
 
 cvar_t	chase_back ("chase_back", "100", CVAR_ARCHIVE);
 cvar_t	chase_up ("chase_up", "16", CVAR_ARCHIVE);
@@ -49,7 +49,7 @@ void TraceLine (vec3_t start, vec3_t end, vec3_t impact)
 	trace_t	trace;
 
 	memset (&trace, 0, sizeof (trace));
-	SV_RecursiveHullCheck (cl.worldmodel->brushhdr->hulls, 0, 0, 1, start, end, &trace);
+	SV_HullCheck (cl.worldmodel->brushhdr->hulls, 0, 0, 1, start, end, &trace);
 
 	VectorCopy2 (impact, trace.endpos);
 }
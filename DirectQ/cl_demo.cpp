@@ -368,6 +368,9 @@ void CL_Record_f (void)
 
 	cls.demorecording = true;
 
+	// updates against frames from before the demo started can't be played back
+	CL_RestartDeltaFrames ();
+
 	// initialize the demo file if we're already connected
 	if (c < 3 && cls.state == ca_connected)
 	{
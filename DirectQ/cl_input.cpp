@@ -516,6 +516,13 @@ void CL_SendMove (usercmd_t *cmd)
 	// clear the impulse (if any)
 	in_impulse = 0;
 
+	// tell the server the last delta frame we got so that it can send against it
+	if (cl_deltaactive)
+	{
+		MSG_WriteByte (buf, clc_deltaack);
+		MSG_WriteLong (buf, cl_deltaack);
+	}
+
 	// deliver the message (unless we're playing a demo in which case there is no server to deliver to)
 	if (cls.demoplayback) return;
 
@@ -93,7 +93,7 @@ void CL_ClearState (void)
 	if (!sv.active) Host_ClearMemory ();
 
 	SAFE_DELETE (ClientZone);
-	ClientZone = new CQuakeZone ();
+	ClientZone = new CQuakeZone (mem_client);
 
 	// wipe the entire cl structure
 	CL_ClearCLStruct ();
@@ -252,6 +252,13 @@ void CL_SignonReply (void)
 	switch (cls.signon)
 	{
 	case 1:
+		// servers that don't do delta frames will just ignore this
+		if (cl.Protocol == PROTOCOL_VERSION_RMQ && cl_wantdeltaframes.value)
+		{
+			MSG_WriteByte (&cls.message, clc_stringcmd);
+			MSG_WriteString (&cls.message, "deltaframes");
+		}
+
 		MSG_WriteByte (&cls.message, clc_stringcmd);
 		MSG_WriteString (&cls.message, "prespawn");
 		break;
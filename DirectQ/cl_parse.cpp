@@ -82,7 +82,8 @@ char *svc_strings[] =
 	"?", // 48
 	"?", // 49
 	"svc_skyboxsize", // [coord] size
-	"svc_fog" // [byte] enable <optional past this point, only included if enable is true> [float] density [byte] red [byte] green [byte] blue
+	"svc_fog", // [byte] enable <optional past this point, only included if enable is true> [float] density [byte] red [byte] green [byte] blue
+	"svc_deltaframe" // [long] frame [long] frame the updates are against
 };
 
 //=============================================================================
@@ -456,7 +457,7 @@ void CL_ParseServerInfo (void)
 	// we can't rely on the map heap being good here as it may not exist on the first demo run
 	// so we create a new heap for storing anything used in it.  is this correct?  surely it calls mod_forname?
 	SAFE_DELETE (PrecacheHeap);
-	PrecacheHeap = new CQuakeZone ();
+	PrecacheHeap = new CQuakeZone (mem_client);
 
 	model_precache = (char **) PrecacheHeap->Alloc (MAX_MODELS * sizeof (char *));
 	sound_precache = (char **) PrecacheHeap->Alloc (MAX_SOUNDS * sizeof (char *));
@@ -483,6 +484,9 @@ void CL_ParseServerInfo (void)
 	// wipe the client_state_t struct
 	CL_ClearState ();
 
+	// and the delta frames from any previous server
+	CL_ClearDeltaFrames ();
+
 	// parse protocol version number
 	i = MSG_ReadLong ();
 
@@ -673,6 +677,9 @@ void CL_ParseServerInfo (void)
 		UpdateTitlebarText (cls.demoname);
 	else UpdateTitlebarText (mapname);
 
+	// a local server will already have named the map for memory telemetry
+	if (!sv.active) Heap_SetMapName (mapname);
+
 	// clean up zone allocations
 	Zone_Compact ();
 
@@ -725,6 +732,127 @@ void CL_ClearInterpolation (entity_t *ent, int clearflags)
 }
 
 
+/*
+==================
+delta frames
+
+when we ask for them (RMQ servers only) the server sends entity updates against the last frame we told it we
+got instead of against the baselines.  we keep what we got in the last DELTA_BACKUP frames so that we can rebuild
+them.  servers that don't know about them just ignore the request and we never send an ack.
+==================
+*/
+cvar_t cl_wantdeltaframes ("cl_deltaframes", "1", CVAR_ARCHIVE);
+
+int cl_deltaack = 0;
+bool cl_deltaactive = false;					// the server is sending us delta frames
+
+static deltaframe_t cl_deltaframes[DELTA_BACKUP];
+static deltaframe_t *cl_deltaframe = NULL;		// the frame in the message being parsed
+static deltaframe_t *cl_deltabase = NULL;		// and what it's against
+static int *cl_deltaslots = NULL;				// where each entity is in cl_deltabase
+static int *cl_deltastamps = NULL;				// which base sequence the slot is for
+static bool cl_deltarestart = false;			// waiting for a frame against the baselines
+static bool cl_deltadropping = false;			// the frame in this message is against one we don't have
+
+void CL_ClearDeltaFrames (void)
+{
+	for (int i = 0; i < DELTA_BACKUP; i++)
+	{
+		cl_deltaframes[i].sequence = 0;
+		cl_deltaframes[i].numents = 0;
+	}
+
+	cl_deltaframe = cl_deltabase = NULL;
+	cl_deltaack = 0;
+	cl_deltaactive = false;
+	cl_deltarestart = false;
+	cl_deltadropping = false;
+}
+
+
+void CL_RestartDeltaFrames (void)
+{
+	// keep acking nothing until the server sends a frame against the baselines
+	cl_deltaack = 0;
+	cl_deltarestart = true;
+}
+
+
+void CL_ParseDeltaFrame (void)
+{
+	int sequence = MSG_ReadLong ();
+	int base = MSG_ReadLong ();
+
+	// from now on the server wants to hear which ones we got
+	cl_deltaactive = true;
+
+	if (!cl_deltaslots)
+	{
+		cl_deltaslots = (int *) Zone_Alloc (MAX_EDICTS * sizeof (int));
+		cl_deltastamps = (int *) Zone_Alloc (MAX_EDICTS * sizeof (int));
+	}
+
+	cl_deltaframe = &cl_deltaframes[sequence & DELTA_MASK];
+	cl_deltabase = NULL;
+
+	if (base > 0)
+	{
+		deltaframe_t *basefr = &cl_deltaframes[base & DELTA_MASK];
+
+		if (basefr->sequence != base || basefr == cl_deltaframe)
+		{
+			// we don't have it (a demo that started recording in the middle) so the updates can't be rebuilt.
+			// they're read past like a lost packet and the server is asked for a frame against the baselines.
+			Con_DPrintf ("CL_ParseDeltaFrame : frame %i is against %i which we don't have\n", sequence, base);
+			cl_deltaframe->sequence = 0;
+			cl_deltaframe->numents = 0;
+			cl_deltaframe = NULL;
+			cl_deltadropping = true;
+			CL_RestartDeltaFrames ();
+			return;
+		}
+
+		for (int i = 0; i < basefr->numents; i++)
+		{
+			cl_deltaslots[basefr->ednums[i]] = i;
+			cl_deltastamps[basefr->ednums[i]] = base;
+		}
+
+		cl_deltabase = basefr;
+	}
+
+	cl_deltaframe->sequence = sequence;
+	cl_deltaframe->numents = 0;
+
+	// this is what the server will send against next
+	if (cl_deltarestart && base > 0) return;
+
+	cl_deltaack = sequence;
+	cl_deltarestart = false;
+}
+
+
+static void CL_SkipDeltaUpdate (int bits)
+{
+	// delta frames are only on the RMQ protocol so this is the fitz layout
+	if (bits & U_MODEL) MSG_ReadByte ();
+	if (bits & U_FRAME) MSG_ReadByte ();
+	if (bits & U_COLORMAP) MSG_ReadByte ();
+	if (bits & U_SKIN) MSG_ReadByte ();
+	if (bits & U_EFFECTS) MSG_ReadByte ();
+	if (bits & U_ORIGIN1) MSG_ReadCoord (cl.Protocol, cl.PrototcolFlags);
+	if (bits & U_ANGLES1) MSG_ReadAngle (cl.Protocol, cl.PrototcolFlags);
+	if (bits & U_ORIGIN2) MSG_ReadCoord (cl.Protocol, cl.PrototcolFlags);
+	if (bits & U_ANGLES2) MSG_ReadAngle (cl.Protocol, cl.PrototcolFlags);
+	if (bits & U_ORIGIN3) MSG_ReadCoord (cl.Protocol, cl.PrototcolFlags);
+	if (bits & U_ANGLES3) MSG_ReadAngle (cl.Protocol, cl.PrototcolFlags);
+	if (bits & U_ALPHA) MSG_ReadByte ();
+	if (bits & U_FRAME2) MSG_ReadByte ();
+	if (bits & U_MODEL2) MSG_ReadByte ();
+	if (bits & U_LERPFINISH) MSG_ReadByte ();
+}
+
+
 void CL_ParseUpdate (int bits)
 {
 	int			i;
@@ -758,10 +886,30 @@ void CL_ParseUpdate (int bits)
 		num = MSG_ReadShort ();
 	else num = MSG_ReadByte ();
 
+	// an update in a delta frame we can't rebuild is read past and the entity stays where it was, the
+	// same as if the packet had been lost (it's still marked as present so that it doesn't blink out)
+	if (cl_deltadropping)
+	{
+		CL_SkipDeltaUpdate (bits);
+		CL_EntityNum (num)->msgtime = cl.mtime[0];
+		return;
+	}
+
 	// this is used for both getting an existing entity and creating a new one
 	// eeewww.
 	ent = CL_EntityNum (num);
 
+	// what isn't sent is the same as the baseline, or as the frame the server sent this against with delta frames
+	entity_state_t *from = &ent->baseline;
+
+	if (cl_deltabase && cl_deltastamps[num] == cl_deltabase->sequence)
+	{
+		int slot = cl_deltaslots[num];
+
+		if (slot < cl_deltabase->numents && cl_deltabase->ednums[slot] == num)
+			from = &cl_deltabase->states[slot];
+	}
+
 	if (ent->msgtime != cl.mtime[1])
 	{
 		// entity was not present on the previous frame
@@ -785,17 +933,19 @@ void CL_ParseUpdate (int bits)
 
 		if (modnum >= MAX_MODELS) Host_Error ("CL_ParseModel: bad modnum");
 	}
-	else modnum = ent->baseline.modelindex;
+	else modnum = from->modelindex;
 
 	// moved before model change check as a change in model could make the baseline frame invalid
 	// (e.g. if the ent was originally spawned on a frame other than 0)
 	if (bits & U_FRAME)
 		ent->frame = MSG_ReadByte ();
-	else ent->frame = ent->baseline.frame;
+	else ent->frame = from->frame;
 
 	if (bits & U_COLORMAP)
 		i = MSG_ReadByte ();
-	else i = ent->baseline.colormap;
+	else i = from->colormap;
+
+	int colormap = i;
 
 	if (!i)
 	{
@@ -819,7 +969,7 @@ void CL_ParseUpdate (int bits)
 
 	if (bits & U_SKIN)
 		skin = MSG_ReadByte ();
-	else skin = ent->baseline.skin;
+	else skin = from->skin;
 
 	if (skin != ent->skinnum)
 	{
@@ -829,7 +979,7 @@ void CL_ParseUpdate (int bits)
 
 	if (bits & U_EFFECTS)
 		ent->effects = MSG_ReadByte ();
-	else ent->effects = ent->baseline.effects;
+	else ent->effects = from->effects;
 
 	// shift the known values for interpolation
 	VectorCopy2 (ent->msg_origins[1], ent->msg_origins[0]);
@@ -837,27 +987,27 @@ void CL_ParseUpdate (int bits)
 
 	if (bits & U_ORIGIN1)
 		ent->msg_origins[0][0] = MSG_ReadCoord (cl.Protocol, cl.PrototcolFlags);
-	else ent->msg_origins[0][0] = ent->baseline.origin[0];
+	else ent->msg_origins[0][0] = from->origin[0];
 
 	if (bits & U_ANGLES1)
 		ent->msg_angles[0][0] = MSG_ReadAngle (cl.Protocol, cl.PrototcolFlags);
-	else ent->msg_angles[0][0] = ent->baseline.angles[0];
+	else ent->msg_angles[0][0] = from->angles[0];
 
 	if (bits & U_ORIGIN2)
 		ent->msg_origins[0][1] = MSG_ReadCoord (cl.Protocol, cl.PrototcolFlags);
-	else ent->msg_origins[0][1] = ent->baseline.origin[1];
+	else ent->msg_origins[0][1] = from->origin[1];
 
 	if (bits & U_ANGLES2)
 		ent->msg_angles[0][1] = MSG_ReadAngle (cl.Protocol, cl.PrototcolFlags);
-	else ent->msg_angles[0][1] = ent->baseline.angles[1];
+	else ent->msg_angles[0][1] = from->angles[1];
 
 	if (bits & U_ORIGIN3)
 		ent->msg_origins[0][2] = MSG_ReadCoord (cl.Protocol, cl.PrototcolFlags);
-	else ent->msg_origins[0][2] = ent->baseline.origin[2];
+	else ent->msg_origins[0][2] = from->origin[2];
 
 	if (bits & U_ANGLES3)
 		ent->msg_angles[0][2] = MSG_ReadAngle (cl.Protocol, cl.PrototcolFlags);
-	else ent->msg_angles[0][2] = ent->baseline.angles[2];
+	else ent->msg_angles[0][2] = from->angles[2];
 
 	// default lerp interval which we can assume for most entities
 	ent->lerpinterval = 0.1f;
@@ -866,7 +1016,7 @@ void CL_ParseUpdate (int bits)
 	{
 		if (bits & U_ALPHA)
 			ent->alphaval = MSG_ReadByte ();
-		else ent->alphaval = ent->baseline.alpha;
+		else ent->alphaval = from->alpha;
 
 		if (bits & U_FRAME2) ent->frame = (ent->frame & 0x00FF) | (MSG_ReadByte () << 8);
 		if (bits & U_MODEL2) modnum = (modnum & 0x00FF) | (MSG_ReadByte () << 8);
@@ -919,6 +1069,24 @@ void CL_ParseUpdate (int bits)
 	// this was moved down for protocol fitz messaqe ordering because the model num could be changed by extend bits
 	model = cl.model_precache[modnum];
 
+	if (cl_deltaframe)
+	{
+		// keep what we got so that later updates can be against it
+		entity_state_t state;
+
+		VectorCopy (ent->msg_origins[0], state.origin);
+		VectorCopy (ent->msg_angles[0], state.angles);
+
+		state.modelindex = modnum;
+		state.frame = ent->frame;
+		state.colormap = colormap;
+		state.skin = skin;
+		state.effects = ent->effects;
+		state.alpha = ent->alphaval;
+
+		Delta_AddState (cl_deltaframe, num, &state);
+	}
+
 	if (model != ent->model)
 	{
 		// test - check for entity model changes at runtime, as it fucks up interpolation.
@@ -940,9 +1108,12 @@ void CL_ParseUpdate (int bits)
 		// lastpose and currpose are critical as they might be pointing to invalid frames in the new model!!!
 		CL_ClearInterpolation (ent, CLEAR_POSES);
 
-		// reset frame and skin too...!
-		if (!(bits & U_FRAME)) ent->frame = 0;
-		if (!(bits & U_SKIN)) ent->skinnum = 0;
+		// reset frame and skin too...!  (not with a delta frame because those are what the server really has)
+		if (from == &ent->baseline)
+		{
+			if (!(bits & U_FRAME)) ent->frame = 0;
+			if (!(bits & U_SKIN)) ent->skinnum = 0;
+		}
 	}
 
 	if (forcelink)
@@ -1215,6 +1386,10 @@ void CL_ParseServerMessage (void)
 	// parse the message
 	MSG_BeginReading ();
 
+	// delta frames don't carry over from one message to the next
+	cl_deltaframe = cl_deltabase = NULL;
+	cl_deltadropping = false;
+
 	static int lastcmd = 0;
 
 	while (1)
@@ -1544,6 +1719,10 @@ void CL_ParseServerMessage (void)
 		}
 		break;
 
+		case svc_deltaframe:
+			CL_ParseDeltaFrame ();
+			break;
+
 		case svc_skyboxsize:
 			// irrelevant in directQ
 			MSG_ReadCoord (cl.Protocol, cl.PrototcolFlags);
@@ -167,6 +167,12 @@ typedef struct
 
 extern client_static_t	cls;
 
+// delta frames
+extern int cl_deltaack;
+extern bool cl_deltaactive;
+void CL_ClearDeltaFrames (void);
+void CL_RestartDeltaFrames (void);
+
 // the client_state_t structure is wiped completely at every
 // server signon
 typedef struct client_state_s
@@ -270,6 +276,7 @@ typedef struct client_state_s
 // cvars
 extern	cvar_t	cl_name;
 extern	cvar_t	cl_color;
+extern	cvar_t	cl_wantdeltaframes;
 
 extern	cvar_t	cl_upspeed;
 extern	cvar_t	cl_forwardspeed;
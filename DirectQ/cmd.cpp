@@ -1309,7 +1309,7 @@ int Cmd_CheckParm (char *parm)
 
 cmd_t::cmd_t (char *cmdname, xcommand_t cmdcmd)
 {
-	this->name = (char *) Zone_Alloc (strlen (cmdname) + 1);
+	this->name = (char *) Zone_Alloc (strlen (cmdname) + 1, false);
 
 	strcpy (this->name, cmdname);
 
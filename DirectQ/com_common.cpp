@@ -67,6 +67,32 @@ void COM_HashData (byte *hash, const void *data, int size)
 }
 
 
+// cheap string hash for lookup tables (FNV-1a); nocase must match the comparison the table uses
+unsigned int COM_HashString (const char *str, bool nocase)
+{
+	unsigned int hash = 2166136261u;
+
+	if (nocase)
+	{
+		for (; *str; str++)
+		{
+			int c = *str;
+
+			if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+
+			hash = (hash ^ (unsigned char) c) * 16777619u;
+		}
+	}
+	else
+	{
+		for (; *str; str++)
+			hash = (hash ^ (unsigned char) *str) * 16777619u;
+	}
+
+	return hash;
+}
+
+
 #define NUM_SAFE_ARGVS  7
 
 static char     *largv[MAX_NUM_ARGVS + NUM_SAFE_ARGVS + 1];
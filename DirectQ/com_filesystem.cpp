@@ -445,7 +445,7 @@ void COM_DecompressFile (char *filename, byte **decompressbuf, int *decompressle
 
 			if (err == UNZ_OK)
 			{
-				buf = (byte *) MainZone->Alloc (file_info.uncompressed_size);
+				buf = (byte *) MainZone->Alloc (file_info.uncompressed_size, false);
 
 				int bytesread = unzReadCurrentFile (uf, buf, file_info.uncompressed_size);
 
@@ -481,9 +481,10 @@ HANDLE COM_UnzipPK3FileToTemp (pk3_t *pk3, char *filename)
 {
 	// (note - using scratchbuf is potentially unsafe here as it may be used for other stuff
 	// further up the call stack (map list enumeration was using it which caused crashes))
-	// it is expected that the caller will manage hunk usage here
+	// the transient arena is safe to nest and gives the memory back on every return path
 	const int maxbytestoread = 65536;
-	byte *unztemp = (byte *) MainHunk->Alloc (maxbytestoread);
+	CScratchMark scratch;
+	byte *unztemp = (byte *) scratch.Alloc (maxbytestoread);
 
 	// initial scan ensures the file is present before opening the zip (perf)
 	for (int i = 0; i < pk3->numfiles; i++)
@@ -723,9 +724,7 @@ int COM_FOpenFile (char *filename, void *hf)
 		}
 		else if (search->pk3)
 		{
-			int hunkmark = MainHunk->GetLowMark ();
 			HANDLE pk3handle = COM_UnzipPK3FileToTemp (search->pk3, filename);
-			MainHunk->FreeToLowMark (hunkmark);
 
 			if (pk3handle != INVALID_HANDLE_VALUE)
 			{
@@ -816,8 +815,8 @@ static byte *COM_LoadFile (char *path, class CQuakeHunk *spacebuf, class CQuakeZ
 	if (spacebuf)
 		buf = (byte *) spacebuf->Alloc (len + 1);
 	else if (heapbuf)
-		buf = (byte *) heapbuf->Alloc (len + 1);
-	else buf = (byte *) Zone_Alloc (len + 1);
+		buf = (byte *) heapbuf->Alloc (len + 1, false);
+	else buf = (byte *) Zone_Alloc (len + 1, false);
 
 	if (!buf)
 	{
@@ -526,7 +526,7 @@ void COM_LoadGame (char *gamename)
 		COM_UnloadAllStuff ();
 	}
 
-	if (!GameZone) GameZone = new CQuakeZone ();
+	if (!GameZone) GameZone = new CQuakeZone (mem_game);
 
 	char basedir[MAX_PATH];
 
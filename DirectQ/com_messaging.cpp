@@ -499,6 +499,53 @@ void SZ_Print (sizebuf_t *buf, char *data)
 }
 
 
+/*
+==============
+Delta_AddState
+
+records an entity state in a delta frame; the server does this for what it sent and the client for what it got
+==============
+*/
+void Delta_AddState (deltaframe_t *frame, int ednum, entity_state_t *state)
+{
+	if (frame->numents == frame->maxents)
+	{
+		int newmax = frame->maxents ? frame->maxents * 2 : 256;
+		int *ednums = (int *) Zone_Alloc (newmax * sizeof (int), false);
+		entity_state_t *states = (entity_state_t *) Zone_Alloc (newmax * sizeof (entity_state_t), false);
+
+		if (frame->maxents)
+		{
+			memcpy (ednums, frame->ednums, frame->numents * sizeof (int));
+			memcpy (states, frame->states, frame->numents * sizeof (entity_state_t));
+
+			Zone_Free (frame->ednums);
+			Zone_Free (frame->states);
+		}
+
+		frame->ednums = ednums;
+		frame->states = states;
+		frame->maxents = newmax;
+	}
+
+	frame->ednums[frame->numents] = ednum;
+	memcpy (&frame->states[frame->numents], state, sizeof (entity_state_t));
+	frame->numents++;
+}
+
+
+void Delta_FreeFrames (deltaframe_t *frames)
+{
+	for (int i = 0; i < DELTA_BACKUP; i++)
+	{
+		if (frames[i].ednums) Zone_Free (frames[i].ednums);
+		if (frames[i].states) Zone_Free (frames[i].states);
+
+		memset (&frames[i], 0, sizeof (deltaframe_t));
+	}
+}
+
+
 //============================================================================
 
 
@@ -174,6 +174,7 @@ void COM_ExecQuakeRC (void);
 extern bool		standard_quake, rogue, hipnotic, quoth, nehahra;
 
 void COM_HashData (byte *hash, const void *data, int size);
+unsigned int COM_HashString (const char *str, bool nocase = false);
 #define COM_CheckHash(h1, h2) !(memcmp ((h1), (h2), 16))
 
 void COM_SortStringList (char **stringlist, bool ascending);
@@ -236,7 +236,7 @@ void Cvar_Set (cvar_t *var, char *value)
 	if (strcmp (var->string, value))
 	{
 		Zone_Free (var->string);
-		var->string = (char *) Zone_Alloc (strlen (value) + 1);
+		var->string = (char *) Zone_Alloc (strlen (value) + 1, false);
 		strcpy (var->string, value);
 		var->value = atof (var->string);
 
@@ -269,7 +269,7 @@ void Cvar_Set (cvar_t *var, float value)
 		_snprintf (valbuf, 32, "%g", var->value);
 
 		Zone_Free (var->string);
-		var->string = (char *) Zone_Alloc (strlen (valbuf) + 1);
+		var->string = (char *) Zone_Alloc (strlen (valbuf) + 1, false);
 
 		strcpy (var->string, valbuf);
 
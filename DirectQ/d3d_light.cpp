@@ -1004,7 +1004,11 @@ void D3DLight_BuildLightmap (msurface_t *surf)
 	if (!lm->Texture) return;
 
 	int size = surf->smax * surf->tmax * 3;
-	int *blocklights = (int *) scratchbuf;
+
+	// dynamic light and style updates can come in from anywhere so don't assume that scratchbuf is free
+	CScratchMark scratch;
+	int *blocklightbase = (int *) scratch.Alloc (size * sizeof (int));
+	int *blocklights = blocklightbase;
 	byte *lightmap = NULL;
 	bool updated = false;
 
@@ -1034,7 +1038,7 @@ void D3DLight_BuildLightmap (msurface_t *surf)
 				int scale = D3DLightGlobals.StyleValue[surf->styles[maps]] * 22;
 
 				// must reset this each time it's used so that it will be valid for next time
-				blocklights = (int *) scratchbuf;
+				blocklights = blocklightbase;
 
 				// avoid an additional pass over blocklights by initializing it on the first map
 				if (maps == 0 && scale > 0)
@@ -1088,7 +1092,7 @@ void D3DLight_BuildLightmap (msurface_t *surf)
 		if (surf->dlightframe == d3d_RenderDef.dlightframecount)
 		{
 			// add all the dynamic lights (don't add if r_fullbright or no lightdata...)
-			if (D3DLight_AddDynamics (surf, (unsigned *) scratchbuf, updated))
+			if (D3DLight_AddDynamics (surf, (unsigned *) blocklightbase, updated))
 			{
 				// and dirty the properties to force an update next frame in order to clear the light
 				surf->LightProperties = ~LIGHTMAP::LightProperty;
@@ -1139,7 +1143,7 @@ void D3DLight_BuildLightmap (msurface_t *surf)
 		// convert lighting from RGB to greyscale using a bigger scale to preserve precision
 		int white[3] = {306, 601, 117};
 
-		blocklights = (int *) scratchbuf;
+		blocklights = blocklightbase;
 
 		for (int i = 0; i < size; i += 3, blocklights += 3)
 		{
@@ -1151,7 +1155,7 @@ void D3DLight_BuildLightmap (msurface_t *surf)
 	// get actual pointer to the lightdata for this surf
 	dest += (surf->LightRect.top * stride) + surf->LightRect.left;
 
-	blocklights = (int *) scratchbuf;
+	blocklights = blocklightbase;
 
 	// this will all go away with 1.9.0 because we'll be using a 64-bit texture
 	if (r_overbright.integer && r_hdrlight.integer)
@@ -418,7 +418,7 @@ void ClearAllStates (void);;
 void R_NewMap (void)
 {
 	SAFE_DELETE (RenderZone);
-	RenderZone = new CQuakeZone ();
+	RenderZone = new CQuakeZone (mem_render);
 
 	// set up the pvs arrays (these will already have been done by the server if it's active
 	if (!sv.active) Mod_InitForMap (cl.worldmodel);
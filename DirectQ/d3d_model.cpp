@@ -332,7 +332,7 @@ void Mod_ClearAll (void)
 	int		i;
 
 	SAFE_DELETE (ModelZone);
-	ModelZone = new CQuakeZone ();
+	ModelZone = new CQuakeZone (mem_model);
 
 	// NULL the structs
 	for (i = 0; i < MAX_MOD_KNOWN; i++)
@@ -18,6 +18,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "quakedef.h"
+#include <intrin.h>
+
+#pragma intrinsic (_ReturnAddress)
+#pragma intrinsic (_BitScanReverse)
 
 byte *scratchbuf = NULL;
 
@@ -25,6 +29,146 @@ int TotalSize = 0;
 int TotalPeak = 0;
 int TotalReserved = 0;
 
+// allocation tracing for heap_replay
+bool HeapTrace = false;
+void Heap_TraceEvent (CQuakeZone *zone, void *ptr, int size, bool zeromem = true);
+
+
+/*
+========================================================================================================================
+
+		TELEMETRY
+
+	Every zone and hunk carries a tag saying which subsystem it belongs to, and usage is accumulated per tag so
+	that it survives the zones being recreated on each map.  Allocations are bucketed by power-of-two size, and
+	if memstats_callsites is set the return address of each allocation is also counted so that we can see which
+	piece of code is responsible for a spike.
+
+========================================================================================================================
+*/
+
+#define MEM_NUMBUCKETS		16		// 16 bytes to 256k+
+#define MEM_MAXCALLSITES	1024	// must be a power of 2
+#define MEM_MAXMAPS			16
+
+typedef struct memstats_s
+{
+	int current;
+	int peak;
+	int mappeak;
+	int allocs;
+	int frees;
+	int buckets[MEM_NUMBUCKETS];
+} memstats_t;
+
+typedef struct memcallsite_s
+{
+	void *caller;
+	memtag_t tag;
+	int allocs;
+	int bytes;
+} memcallsite_t;
+
+typedef struct memmap_s
+{
+	char name[64];
+	int peak[MAX_MEMTAGS];
+} memmap_t;
+
+static char *MemTagNames[MAX_MEMTAGS] = {"MainZone", "MainHunk", "Game", "Server", "Client", "Renderer", "Models", "Cache", "Sound", "Other"};
+
+// these are all POD so they're valid before any constructors run
+static memstats_t MemStats[MAX_MEMTAGS];
+static memcallsite_t MemCallSites[MEM_MAXCALLSITES];
+static int MemNumCallSites = 0;
+static memmap_t MemMaps[MEM_MAXMAPS];
+static int MemNumMaps = 0;
+static char MemMapName[64] = {0};
+
+cvar_t memstats_callsites ("memstats_callsites", 0.0f);
+
+
+static void Heap_StatAlloc (memtag_t tag, int size, void *caller)
+{
+	memstats_t *ms = &MemStats[tag];
+	unsigned long bucket = 0;
+
+	ms->current += size;
+	ms->allocs++;
+
+	if (ms->current > ms->peak) ms->peak = ms->current;
+	if (ms->current > ms->mappeak) ms->mappeak = ms->current;
+
+	// bucket 0 is up to 16 bytes, each one after that doubles
+	if (size > 16) _BitScanReverse (&bucket, (unsigned long) (size - 1));
+
+	if (bucket > 3) bucket -= 3; else bucket = 0;
+	if (bucket >= MEM_NUMBUCKETS) bucket = MEM_NUMBUCKETS - 1;
+
+	ms->buckets[bucket]++;
+
+	if (!caller || !memstats_callsites.integer) return;
+
+	// open addressing on the return address; once full new sites just go uncounted
+	for (int i = (((size_t) caller) >> 2) & (MEM_MAXCALLSITES - 1), j = 0; j < MEM_MAXCALLSITES; i = (i + 1) & (MEM_MAXCALLSITES - 1), j++)
+	{
+		memcallsite_t *cs = &MemCallSites[i];
+
+		if (!cs->caller)
+		{
+			cs->caller = caller;
+			cs->tag = tag;
+			MemNumCallSites++;
+		}
+		else if (cs->caller != caller || cs->tag != tag)
+			continue;
+
+		cs->allocs++;
+		cs->bytes += size;
+		return;
+	}
+}
+
+
+static void Heap_StatFree (memtag_t tag, int size)
+{
+	MemStats[tag].current -= size;
+	MemStats[tag].frees++;
+}
+
+
+void Heap_BeginMap (void)
+{
+	// store out the peaks from the map that's ending
+	if (MemMapName[0])
+	{
+		// shuffle down if full so that we keep the most recent
+		if (MemNumMaps == MEM_MAXMAPS)
+		{
+			memmove (&MemMaps[0], &MemMaps[1], sizeof (memmap_t) * (MEM_MAXMAPS - 1));
+			MemNumMaps--;
+		}
+
+		memmap_t *mm = &MemMaps[MemNumMaps++];
+
+		strcpy (mm->name, MemMapName);
+
+		for (int i = 0; i < MAX_MEMTAGS; i++)
+			mm->peak[i] = MemStats[i].mappeak;
+	}
+
+	MemMapName[0] = 0;
+
+	for (int i = 0; i < MAX_MEMTAGS; i++)
+		MemStats[i].mappeak = MemStats[i].current;
+}
+
+
+void Heap_SetMapName (char *mapname)
+{
+	Q_strncpy (MemMapName, mapname, 63);
+}
+
 /*
 ========================================================================================================================
 
@@ -34,33 +178,115 @@ int TotalReserved = 0;
 */
 
 #define HEAP_MAGIC 0x35012560
+#define HEAP_FREEMAGIC 0x0badf00d
+
+/*
+the zone sits on a size-class slab allocator; small blocks are carved from 64k slabs taken from the zone's own
+heap and recycled through per-class free lists, so the common case is a pointer pop with no calls into the OS
+at all.  anything bigger than the largest class goes straight to HeapAlloc as before.  because the slabs come
+from the zone's heap a Discard still releases everything in one HeapDestroy.
+*/
+static const int ZoneSlabSizes[ZONE_NUMCLASSES] =
+{
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+// maps (blocksize + 15) >> 4 to a size class; built on first use as zones can be created from static constructors
+static byte ZoneSlabClass[(ZONE_MAXSLABBLOCK >> 4) + 1];
+static bool ZoneSlabClassInit = false;
+
+// a free block reuses the header space for the magic and the link, so the smallest class must hold both
+typedef struct zoneblock_s
+{
+	int magic;
+	int size;
+	struct zoneblock_s *next;
+} zoneblock_t;
+
+
+static void Zone_InitSlabClasses (void)
+{
+	if (ZoneSlabClassInit) return;
+
+	for (int i = 0, c = 0; i <= (ZONE_MAXSLABBLOCK >> 4); i++)
+	{
+		while (ZoneSlabSizes[c] < (i << 4)) c++;
+		ZoneSlabClass[i] = c;
+	}
+
+	ZoneSlabClassInit = true;
+}
 
 
-CQuakeZone::CQuakeZone (void)
+CQuakeZone::CQuakeZone (memtag_t tag)
 {
 	// prevent this->EnsureHeap from exploding
 	this->hHeap = NULL;
+	this->Tag = tag;
 
 	// create it
 	this->EnsureHeap ();
 }
 
 
-void *CQuakeZone::Alloc (int size)
+void *CQuakeZone::AllocSlab (int blocksize)
+{
+	int cls = ZoneSlabClass[(blocksize + 15) >> 4];
+	zoneblock_t *block = (zoneblock_t *) this->FreeBlocks[cls];
+
+	// reuse a previously freed block if we have one
+	if (block)
+	{
+		assert (block->magic == HEAP_FREEMAGIC);
+		this->FreeBlocks[cls] = block->next;
+		return block;
+	}
+
+	int classsize = ZoneSlabSizes[cls];
+
+	// carve a new slab for this class if the current one is used up; the tail of the old one is just left
+	if (this->SlabPtr[cls] + classsize > this->SlabEnd[cls])
+	{
+		byte *slab = (byte *) HeapAlloc (this->hHeap, 0, ZONE_SLABSIZE);
+
+		if (!slab) Sys_Error ("CQuakeZone::AllocSlab - HeapAlloc failed on %i bytes", ZONE_SLABSIZE);
+
+		this->SlabPtr[cls] = slab;
+		this->SlabEnd[cls] = slab + ZONE_SLABSIZE;
+	}
+
+	block = (zoneblock_t *) this->SlabPtr[cls];
+	this->SlabPtr[cls] += classsize;
+
+	return block;
+}
+
+
+void *CQuakeZone::Alloc (int size, bool zeromem)
+{
+	return this->AllocFrom (size, zeromem, _ReturnAddress ());
+}
+
+
+void *CQuakeZone::AllocFrom (int size, bool zeromem, void *caller)
 {
 	this->EnsureHeap ();
 	assert (size > 0);
 
-	int *buf = (int *) HeapAlloc (this->hHeap, 0, size + sizeof (int) * 2);
+	int blocksize = size + sizeof (int) * 2;
+	int *buf = NULL;
 
-	assert (buf);
-	memset (buf, 0, size + sizeof (int) * 2);
+	if (blocksize <= ZONE_MAXSLABBLOCK)
+		buf = (int *) this->AllocSlab (blocksize);
+	else if (!(buf = (int *) HeapAlloc (this->hHeap, 0, blocksize)))
+		Sys_Error ("CQuakeZone::Alloc - HeapAlloc failed on %i bytes", blocksize);
 
-	// mark as no-execute; not critical so fail it silently
-	// note that HeapAlloc uses VirtualAlloc behind the scenes, so this is valid
-	DWORD dwdummy = 0;
-	VirtualProtect (buf, size, PAGE_READWRITE, &dwdummy);
+	// the zone has always handed back cleared memory so that remains the default; callers that are
+	// going to overwrite the whole block anyway can skip it
+	if (zeromem) memset (buf + 2, 0, size);
 
+	// no VirtualProtect here any more; HeapCreate without HEAP_CREATE_ENABLE_EXECUTE already gives us
+	// no-execute memory under DEP so the per-alloc syscall was never buying us anything
 	buf[0] = HEAP_MAGIC;
 	buf[1] = size;
 
@@ -72,6 +298,10 @@ void *CQuakeZone::Alloc (int size)
 
 	if (TotalSize > TotalPeak) TotalPeak = TotalSize;
 
+	Heap_StatAlloc (this->Tag, size, caller);
+
+	if (HeapTrace) Heap_TraceEvent (this, buf + 2, size, zeromem);
+
 	return (buf + 2);
 }
 
@@ -90,16 +320,37 @@ void CQuakeZone::Free (void *data)
 	// this should never happen but let's protect release builds anyway...
 	if (buf[0] != HEAP_MAGIC) return;
 
-	this->Size -= buf[1];
-	TotalSize -= buf[1];
+	int size = buf[1];
+	int blocksize = size + sizeof (int) * 2;
+
+	this->Size -= size;
+	TotalSize -= size;
 
-	BOOL blah = HeapFree (this->hHeap, 0, buf);
-	assert (blah);
+	Heap_StatFree (this->Tag, size);
+
+	if (HeapTrace) Heap_TraceEvent (this, data, 0);
+
+	if (blocksize <= ZONE_MAXSLABBLOCK)
+	{
+		// back onto the free list for it's class
+		int cls = ZoneSlabClass[(blocksize + 15) >> 4];
+		zoneblock_t *block = (zoneblock_t *) buf;
+
+		block->magic = HEAP_FREEMAGIC;
+		block->next = (zoneblock_t *) this->FreeBlocks[cls];
+		this->FreeBlocks[cls] = block;
+	}
+	else
+	{
+		BOOL blah = HeapFree (this->hHeap, 0, buf);
+		assert (blah);
+	}
 }
 
 
 void CQuakeZone::Compact (void)
 {
+	// slabs stay with the zone until it's discarded so this only affects large blocks
 	HeapCompact (this->hHeap, 0);
 }
 
@@ -108,11 +359,20 @@ void CQuakeZone::EnsureHeap (void)
 {
 	if (!this->hHeap)
 	{
+		Zone_InitSlabClasses ();
+
 		this->hHeap = HeapCreate (0, 0x10000, 0);
 		assert (this->hHeap);
 
 		this->Size = 0;
 		this->Peak = 0;
+
+		for (int i = 0; i < ZONE_NUMCLASSES; i++)
+		{
+			this->FreeBlocks[i] = NULL;
+			this->SlabPtr[i] = NULL;
+			this->SlabEnd[i] = NULL;
+		}
 	}
 }
 
@@ -122,7 +382,10 @@ void CQuakeZone::Discard (void)
 	if (this->hHeap)
 	{
 		TotalSize -= this->Size;
+		MemStats[this->Tag].current -= this->Size;
 		this->Size = 0;
+
+		// this also releases all of the slabs
 		HeapDestroy (this->hHeap);
 		this->hHeap = NULL;
 	}
@@ -150,21 +413,44 @@ float CQuakeZone::GetSizeMB (void)
 	always be thrown out when the game changes, and may be discardable at any other time.  The cache is just a
 	wrapper around the Zone API.
 
-	The cache only grows, never shrinks, so it does not fragment.
+	Each named object owns the unnamed allocations that were made for it since the previous named object was
+	added, so that it can be evicted as a unit.  Objects are found by hash and kept in LRU order; if cache_budget
+	is set then least recently used objects are evicted between maps until the cache fits.  With no budget the
+	cache only grows, never shrinks, as before.
 
 ========================================================================================================================
 */
 
+cvar_t cache_budget ("cache_budget", 0.0f, CVAR_ARCHIVE);
+
+typedef struct cacheblock_s
+{
+	struct cacheblock_s *next;
+	int size;
+} cacheblock_t;
+
 typedef struct cacheobject_s
 {
-	struct cacheobject_s *next;
+	struct cacheobject_s *hashnext;
+	struct cacheobject_s *lruprev;
+	struct cacheobject_s *lrunext;
+	cacheblock_t *blocks;
 	void *data;
 	char *name;
+	unsigned int hash;
+	int size;
 } cacheobject_t;
 
 
-CQuakeCache::CQuakeCache (void)
+CQuakeCache::CQuakeCache (char *name, memtag_t tag)
 {
+	Q_strncpy (this->Name, name, 15);
+	this->Tag = tag;
+
+	this->Hits = 0;
+	this->Misses = 0;
+	this->Evictions = 0;
+
 	// so that the check in Init is valid
 	this->Heap = NULL;
 	this->Init ();
@@ -186,23 +472,44 @@ float CQuakeCache::GetSizeMB (void)
 void CQuakeCache::Init (void)
 {
 	if (!this->Heap)
-		this->Heap = new CQuakeZone ();
+		this->Heap = new CQuakeZone (this->Tag);
+
+	for (int i = 0; i < CACHE_HASH_SIZE; i++)
+		this->HashTable[i] = NULL;
 
-	this->Head = NULL;
+	this->LRUHead = this->LRUTail = NULL;
+	this->Pending = NULL;
+	this->PendingSize = 0;
+	this->NumObjects = 0;
+	this->ObjectSize = 0;
 }
 
 
 void *CQuakeCache::Alloc (int size)
 {
-	return this->Heap->Alloc (size);
+	cacheblock_t *block = (cacheblock_t *) this->Heap->Alloc (size + sizeof (cacheblock_t));
+
+	// hold it until the object that owns it is named
+	block->next = this->Pending;
+	block->size = size + sizeof (cacheblock_t);
+	this->Pending = block;
+	this->PendingSize += block->size;
+
+	return (block + 1);
 }
 
 
 void *CQuakeCache::Alloc (void *data, int size)
 {
-	void *buf = this->Heap->Alloc (size);
-	memcpy (buf, data, size);
-	return buf;
+	cacheblock_t *block = (cacheblock_t *) this->Heap->Alloc (size + sizeof (cacheblock_t), false);
+
+	block->next = this->Pending;
+	block->size = size + sizeof (cacheblock_t);
+	this->Pending = block;
+	this->PendingSize += block->size;
+
+	memcpy (block + 1, data, size);
+	return (block + 1);
 }
 
 
@@ -211,8 +518,8 @@ void *CQuakeCache::Alloc (char *name, void *data, int size)
 	cacheobject_t *cache = (cacheobject_t *) this->Heap->Alloc (sizeof (cacheobject_t));
 
 	// alloc on the cache
-	cache->name = (char *) this->Heap->Alloc (strlen (name) + 1);
-	cache->data = this->Heap->Alloc (size);
+	cache->name = (char *) this->Heap->Alloc (strlen (name) + 1, false);
+	cache->data = this->Heap->Alloc (size, data ? false : true);
 
 	// copy in the name
 	strcpy (cache->name, name);
@@ -220,9 +527,29 @@ void *CQuakeCache::Alloc (char *name, void *data, int size)
 	// copy to the cache buffer
 	if (data) memcpy (cache->data, data, size);
 
-	// link it in
-	cache->next = this->Head;
-	this->Head = cache;
+	// take ownership of everything that was allocated for this object
+	cache->blocks = this->Pending;
+	cache->size = this->PendingSize + sizeof (cacheobject_t) + strlen (name) + 1 + size;
+	this->Pending = NULL;
+	this->PendingSize = 0;
+
+	// link it in to the hash
+	cache->hash = COM_HashString (name, true);
+	cache->hashnext = this->HashTable[cache->hash & (CACHE_HASH_SIZE - 1)];
+	this->HashTable[cache->hash & (CACHE_HASH_SIZE - 1)] = cache;
+
+	// and at the head of the LRU as it's just been used
+	cache->lruprev = NULL;
+	cache->lrunext = this->LRUHead;
+
+	if (this->LRUHead)
+		this->LRUHead->lruprev = cache;
+	else this->LRUTail = cache;
+
+	this->LRUHead = cache;
+
+	this->NumObjects++;
+	this->ObjectSize += cache->size;
 
 	// return from the cache
 	return cache->data;
@@ -231,24 +558,99 @@ void *CQuakeCache::Alloc (char *name, void *data, int size)
 
 void *CQuakeCache::Check (char *name)
 {
-	for (cacheobject_t *cache = this->Head; cache; cache = cache->next)
+	unsigned int hash = COM_HashString (name, true);
+
+	for (cacheobject_t *cache = this->HashTable[hash & (CACHE_HASH_SIZE - 1)]; cache; cache = cache->hashnext)
 	{
 		// these should never happen
 		if (!cache->name) continue;
 		if (!cache->data) continue;
 
+		if (cache->hash != hash) continue;
+
 		if (!_stricmp (cache->name, name))
 		{
+			// move it to the head of the LRU
+			if (cache != this->LRUHead)
+			{
+				cache->lruprev->lrunext = cache->lrunext;
+
+				if (cache->lrunext)
+					cache->lrunext->lruprev = cache->lruprev;
+				else this->LRUTail = cache->lruprev;
+
+				cache->lruprev = NULL;
+				cache->lrunext = this->LRUHead;
+				this->LRUHead->lruprev = cache;
+				this->LRUHead = cache;
+			}
+
 			Con_DPrintf ("Reusing %s from cache\n", cache->name);
+			this->Hits++;
 			return cache->data;
 		}
 	}
 
 	// not found in cache
+	this->Misses++;
 	return NULL;
 }
 
 
+void CQuakeCache::Evict (cacheobject_t *cache)
+{
+	// unlink from the hash
+	for (cacheobject_t **link = &this->HashTable[cache->hash & (CACHE_HASH_SIZE - 1)]; *link; link = &(*link)->hashnext)
+	{
+		if (*link == cache)
+		{
+			*link = cache->hashnext;
+			break;
+		}
+	}
+
+	// and from the LRU
+	if (cache->lruprev)
+		cache->lruprev->lrunext = cache->lrunext;
+	else this->LRUHead = cache->lrunext;
+
+	if (cache->lrunext)
+		cache->lrunext->lruprev = cache->lruprev;
+	else this->LRUTail = cache->lruprev;
+
+	this->NumObjects--;
+	this->ObjectSize -= cache->size;
+	this->Evictions++;
+
+	Con_DPrintf ("Evicting %s from cache\n", cache->name);
+
+	// release everything it owns
+	for (cacheblock_t *block = cache->blocks, *next; block; block = next)
+	{
+		next = block->next;
+		this->Heap->Free (block);
+	}
+
+	this->Heap->Free (cache->data);
+	this->Heap->Free (cache->name);
+	this->Heap->Free (cache);
+}
+
+
+void CQuakeCache::Trim (int budget)
+{
+	// this must only be called when nothing is holding pointers into the cache (i.e. between maps)
+	// budget is in bytes; 0 or less means unlimited
+	if (budget <= 0) return;
+
+	while (this->LRUTail && this->ObjectSize > budget)
+		this->Evict (this->LRUTail);
+
+	// give the free space back to the OS
+	this->Heap->Compact ();
+}
+
+
 void CQuakeCache::Flush (void)
 {
 	// reinitialize the cache
@@ -257,6 +659,18 @@ void CQuakeCache::Flush (void)
 }
 
 
+void CQuakeCache::Report (void)
+{
+	Con_Printf ("%-8s %5i objects %7.2f MB  %7i hits %7i misses %7i evictions\n",
+		this->Name,
+		this->NumObjects,
+		(((float) this->ObjectSize) / 1024.0f) / 1024.0f,
+		this->Hits,
+		this->Misses,
+		this->Evictions);
+}
+
+
 /*
 ========================================================================================================================
 
@@ -268,11 +682,11 @@ void CQuakeCache::Flush (void)
 ========================================================================================================================
 */
 
-void *Zone_Alloc (int size)
+void *Zone_Alloc (int size, bool zeromem)
 {
-	if (!MainZone) MainZone = new CQuakeZone ();
+	if (!MainZone) MainZone = new CQuakeZone (mem_zone);
 
-	return MainZone->Alloc (size);
+	return MainZone->AllocFrom (size, zeromem, _ReturnAddress ());
 }
 
 
@@ -297,8 +711,11 @@ void Zone_Compact (void)
 ========================================================================================================================
 */
 
-CQuakeHunk::CQuakeHunk (int maxsizemb)
+CQuakeHunk::CQuakeHunk (int maxsizemb, memtag_t tag)
 {
+	this->Tag = tag;
+	Q_strncpy (this->Name, MemTagNames[tag], 63);
+
 	// sizes in KB
 	this->MaxSize = maxsizemb * 1024 * 1024;
 	this->LowMark = 0;
@@ -322,6 +739,7 @@ CQuakeHunk::~CQuakeHunk (void)
 	VirtualFree (this->BasePtr, this->MaxSize, MEM_DECOMMIT);
 	VirtualFree (this->BasePtr, 0, MEM_RELEASE);
 	TotalSize -= this->LowMark;
+	MemStats[this->Tag].current -= this->LowMark;
 	TotalReserved -= this->MaxSize;
 }
 
@@ -334,6 +752,7 @@ int CQuakeHunk::GetLowMark (void)
 void CQuakeHunk::FreeToLowMark (int mark)
 {
 	TotalSize -= (this->LowMark - mark);
+	Heap_StatFree (this->Tag, this->LowMark - mark);
 	this->LowMark = mark;
 }
 
@@ -370,6 +789,7 @@ void *CQuakeHunk::Alloc (int size)
 	this->LowMark += size;
 
 	TotalSize += size;
+	Heap_StatAlloc (this->Tag, size, _ReturnAddress ());
 
 	if (TotalSize > TotalPeak) TotalPeak = TotalSize;
 
@@ -381,6 +801,7 @@ void CQuakeHunk::Free (void)
 	// decommit all memory
 	VirtualFree (this->BasePtr, this->MaxSize, MEM_DECOMMIT);
 	TotalSize -= this->LowMark;
+	Heap_StatFree (this->Tag, this->LowMark);
 
 	// recommit the initial block
 	this->Initialize ();
@@ -397,6 +818,131 @@ void CQuakeHunk::Initialize (void)
 }
 
 
+/*
+========================================================================================================================
+
+		TRANSIENT MEMORY
+
+	Replaces scratchbuf for anything that might nest.  The arena is reserved up-front and committed on demand
+	like the hunk, and each thread has it's own so that work can be moved off the main thread without racing on
+	a shared buffer.  Allocations are 16-byte aligned and are released by returning to a mark, which is O(1).
+
+========================================================================================================================
+*/
+
+CQuakeScratch::CQuakeScratch (int maxsize)
+{
+	this->MaxSize = maxsize;
+	this->LowMark = 0;
+	this->HighMark = 0;
+	this->Peak = 0;
+
+	TotalReserved += this->MaxSize;
+
+	// reserve the full block but only commit as it's used
+	if (!(this->BasePtr = (byte *) VirtualAlloc (NULL, this->MaxSize, MEM_RESERVE, PAGE_NOACCESS)))
+		Sys_Error ("CQuakeScratch::CQuakeScratch - VirtualAlloc failed on memory pool");
+}
+
+
+CQuakeScratch::~CQuakeScratch (void)
+{
+	VirtualFree (this->BasePtr, 0, MEM_RELEASE);
+	TotalReserved -= this->MaxSize;
+}
+
+
+void *CQuakeScratch::Alloc (int size)
+{
+	assert (size > 0);
+
+	int newmark = this->LowMark + ((size + 15) & ~15);
+
+	// overflow is always a bug in the caller (a missing FreeToMark or an unbounded size) so don't try to recover
+	if (newmark > this->MaxSize)
+		Sys_Error ("CQuakeScratch::Alloc - overflow (%i bytes requested with %i in use)", size, this->LowMark);
+
+	if (newmark > this->HighMark)
+	{
+		// round to 64k boundaries
+		int newhigh = (newmark + 0xffff) & ~0xffff;
+
+		if (!VirtualAlloc (this->BasePtr + this->HighMark, newhigh - this->HighMark, MEM_COMMIT, PAGE_READWRITE))
+			Sys_Error ("CQuakeScratch::Alloc - VirtualAlloc failed on %i bytes", newhigh - this->HighMark);
+
+		this->HighMark = newhigh;
+	}
+
+	byte *buf = this->BasePtr + this->LowMark;
+	this->LowMark = newmark;
+
+	if (this->LowMark > this->Peak) this->Peak = this->LowMark;
+
+	return buf;
+}
+
+
+int CQuakeScratch::GetMark (void)
+{
+	return this->LowMark;
+}
+
+
+void CQuakeScratch::FreeToMark (int mark)
+{
+	// marks must be released in the reverse order they were taken
+	assert (mark >= 0 && mark <= this->LowMark);
+
+	if (mark < 0 || mark > this->LowMark)
+		Sys_Error ("CQuakeScratch::FreeToMark - mark %i is not valid (%i in use)", mark, this->LowMark);
+
+	this->LowMark = mark;
+}
+
+
+float CQuakeScratch::GetPeakMB (void)
+{
+	return (((float) this->Peak) / 1024.0f) / 1024.0f;
+}
+
+
+// one arena per thread, created on first use
+static __declspec (thread) CQuakeScratch *ThreadScratch = NULL;
+
+CQuakeScratch *Scratch_Get (void)
+{
+	if (!ThreadScratch) ThreadScratch = new CQuakeScratch (SCRATCH_MAXSIZE);
+
+	return ThreadScratch;
+}
+
+
+void Scratch_ReleaseThread (void)
+{
+	// worker threads should call this before they exit
+	SAFE_DELETE (ThreadScratch);
+}
+
+
+CScratchMark::CScratchMark (void)
+{
+	this->Arena = Scratch_Get ();
+	this->Mark = this->Arena->GetMark ();
+}
+
+
+CScratchMark::~CScratchMark (void)
+{
+	this->Arena->FreeToMark (this->Mark);
+}
+
+
+void *CScratchMark::Alloc (int size)
+{
+	return this->Arena->Alloc (size);
+}
+
+
 /*
 ========================================================================================================================
 
@@ -421,9 +967,9 @@ CQuakeZone *ModelZone = NULL;
 void Heap_Init (void)
 {
 	// init the pools we want to keep around all the time
-	if (!MainHunk) MainHunk = new CQuakeHunk (256);
-	if (!MainCache) MainCache = new CQuakeCache ();
-	if (!MainZone) MainZone = new CQuakeZone ();
+	if (!MainHunk) MainHunk = new CQuakeHunk (256, mem_hunk);
+	if (!MainCache) MainCache = new CQuakeCache ("Models");
+	if (!MainZone) MainZone = new CQuakeZone (mem_zone);
 
 	// take a chunk of memory for use by temporary loading functions and other doo-dahs
 	scratchbuf = (byte *) Zone_Alloc (SCRATCHBUF_SIZE);
@@ -456,6 +1002,7 @@ void Heap_Report_f (void)
 	if (RenderZone) Con_Printf ("  Renderer %6.2f MB\n", RenderZone->GetSizeMB ());
 	if (ModelZone) Con_Printf ("    Models %6.2f MB\n", ModelZone->GetSizeMB ());
 	if (MainCache) Con_Printf ("     Cache %6.2f MB\n", MainCache->GetSizeMB ());
+	Con_Printf ("   Scratch %6.2f MB peak\n", Scratch_Get ()->GetPeakMB ());
 
 	Con_Printf ("\n");
 	Con_Printf ("     Total %6.2f MB\n", ((((float) TotalSize) / 1024.0f) / 1024.0f));
@@ -465,3 +1012,459 @@ void Heap_Report_f (void)
 
 cmd_t Heap_Report_Cmd ("heap_report", Heap_Report_f);
 
+
+void Cache_Stats_f (void)
+{
+	if (cache_budget.value > 0)
+		Con_Printf ("Cache budget: %0.2f MB per cache\n\n", cache_budget.value);
+	else Con_Printf ("Cache budget: unlimited\n\n");
+
+	if (MainCache) MainCache->Report ();
+	if (SoundCache) SoundCache->Report ();
+}
+
+
+cmd_t Cache_Stats_Cmd ("cache_stats", Cache_Stats_f);
+
+
+static float Heap_MB (int bytes)
+{
+	return (((float) bytes) / 1024.0f) / 1024.0f;
+}
+
+
+static int Heap_SortCallSites (memcallsite_t **a, memcallsite_t **b)
+{
+	return (*b)->bytes - (*a)->bytes;
+}
+
+
+static int Heap_GetCallSites (memcallsite_t **sites)
+{
+	int numsites = 0;
+
+	for (int i = 0; i < MEM_MAXCALLSITES; i++)
+		if (MemCallSites[i].caller)
+			sites[numsites++] = &MemCallSites[i];
+
+	qsort (sites, numsites, sizeof (memcallsite_t *), (sortfunc_t) Heap_SortCallSites);
+	return numsites;
+}
+
+
+static void Heap_WriteStatsCSV (char *filename)
+{
+	FILE *f = fopen (va ("%s/%s", com_gamedir, filename), "w");
+
+	if (!f)
+	{
+		Con_Printf ("memstats : couldn't open \"%s\" for writing\n", filename);
+		return;
+	}
+
+	fprintf (f, "section,tag,current,peak,mappeak,allocs,frees");
+
+	for (int b = 0; b < MEM_NUMBUCKETS; b++)
+		fprintf (f, ",le%i", 16 << b);
+
+	fprintf (f, "\n");
+
+	for (int i = 0; i < MAX_MEMTAGS; i++)
+	{
+		memstats_t *ms = &MemStats[i];
+
+		fprintf (f, "tag,%s,%i,%i,%i,%i,%i", MemTagNames[i], ms->current, ms->peak, ms->mappeak, ms->allocs, ms->frees);
+
+		for (int b = 0; b < MEM_NUMBUCKETS; b++)
+			fprintf (f, ",%i", ms->buckets[b]);
+
+		fprintf (f, "\n");
+	}
+
+	fprintf (f, "\nsection,map");
+
+	for (int i = 0; i < MAX_MEMTAGS; i++)
+		fprintf (f, ",%s", MemTagNames[i]);
+
+	fprintf (f, "\n");
+
+	for (int m = 0; m < MemNumMaps; m++)
+	{
+		fprintf (f, "map,%s", MemMaps[m].name);
+
+		for (int i = 0; i < MAX_MEMTAGS; i++)
+			fprintf (f, ",%i", MemMaps[m].peak[i]);
+
+		fprintf (f, "\n");
+	}
+
+	memcallsite_t *sites[MEM_MAXCALLSITES];
+	int numsites = Heap_GetCallSites (sites);
+
+	fprintf (f, "\nsection,address,tag,allocs,bytes\n");
+
+	for (int i = 0; i < numsites; i++)
+		fprintf (f, "site,0x%p,%s,%i,%i\n", sites[i]->caller, MemTagNames[sites[i]->tag], sites[i]->allocs, sites[i]->bytes);
+
+	fclose (f);
+	Con_Printf ("Wrote memory stats to \"%s\"\n", filename);
+}
+
+
+void Heap_MemStats_f (void)
+{
+	char *opt = (Cmd_Argc () > 1) ? Cmd_Argv (1) : "";
+
+	if (!_stricmp (opt, "hist"))
+	{
+		Con_Printf ("Allocation counts by size (bytes, up to):\n\n");
+		Con_Printf ("%-9s", "");
+
+		for (int b = 0; b < MEM_NUMBUCKETS; b += 2)
+			Con_Printf (" %7i", 16 << (b + 1));
+
+		Con_Printf ("\n");
+
+		for (int i = 0; i < MAX_MEMTAGS; i++)
+		{
+			if (!MemStats[i].allocs) continue;
+
+			Con_Printf ("%-9s", MemTagNames[i]);
+
+			// pairs of buckets are combined so that it fits on the console
+			for (int b = 0; b < MEM_NUMBUCKETS; b += 2)
+				Con_Printf (" %7i", MemStats[i].buckets[b] + MemStats[i].buckets[b + 1]);
+
+			Con_Printf ("\n");
+		}
+	}
+	else if (!_stricmp (opt, "maps"))
+	{
+		Con_Printf ("Peak MB per map (most recent last):\n\n");
+
+		for (int m = 0; m < MemNumMaps; m++)
+		{
+			Con_Printf ("%s:\n", MemMaps[m].name);
+
+			for (int i = 0; i < MAX_MEMTAGS; i++)
+				if (MemMaps[m].peak[i])
+					Con_Printf ("   %-9s %7.2f\n", MemTagNames[i], Heap_MB (MemMaps[m].peak[i]));
+		}
+
+		if (MemMapName[0]) Con_Printf ("%s (current):\n", MemMapName);
+
+		for (int i = 0; i < MAX_MEMTAGS; i++)
+			if (MemMapName[0] && MemStats[i].mappeak)
+				Con_Printf ("   %-9s %7.2f\n", MemTagNames[i], Heap_MB (MemStats[i].mappeak));
+	}
+	else if (!_stricmp (opt, "sites"))
+	{
+		if (!memstats_callsites.integer && !MemNumCallSites)
+		{
+			Con_Printf ("memstats : set memstats_callsites 1 to record call sites\n");
+			return;
+		}
+
+		memcallsite_t *sites[MEM_MAXCALLSITES];
+		int numsites = Heap_GetCallSites (sites);
+
+		Con_Printf ("Top allocation sites by bytes:\n\n");
+
+		for (int i = 0; i < numsites && i < 20; i++)
+			Con_Printf ("0x%p %-9s %7i allocs %7.2f MB\n", sites[i]->caller, MemTagNames[sites[i]->tag], sites[i]->allocs, Heap_MB (sites[i]->bytes));
+	}
+	else if (!_stricmp (opt, "csv"))
+	{
+		if (Cmd_Argc () < 3)
+			Con_Printf ("memstats csv <file> : write all memory stats to <file>\n");
+		else Heap_WriteStatsCSV (Cmd_Argv (2));
+	}
+	else
+	{
+		Con_Printf ("%-9s %8s %8s %8s %9s %9s\n", "MB", "current", "peak", "map peak", "allocs", "frees");
+
+		for (int i = 0; i < MAX_MEMTAGS; i++)
+		{
+			memstats_t *ms = &MemStats[i];
+
+			if (!ms->allocs) continue;
+
+			Con_Printf ("%-9s %8.2f %8.2f %8.2f %9i %9i\n", MemTagNames[i], Heap_MB (ms->current), Heap_MB (ms->peak), Heap_MB (ms->mappeak), ms->allocs, ms->frees);
+		}
+
+		Con_Printf ("\nmemstats hist | maps | sites | csv <file> for more\n");
+	}
+}
+
+
+cmd_t Heap_MemStats_Cmd ("memstats", Heap_MemStats_f);
+
+
+
+/*
+========================================================================================================================
+
+		BENCHMARKING
+
+	heap_trace records every zone alloc and free (across all zones) while it's running; start it, load a map, then
+	stop it with a filename to write the trace out.  heap_replay plays a saved trace back against a fresh zone and
+	against the old HeapAlloc/memset/VirtualProtect path so that we can see what the slab allocator is buying us.
+
+========================================================================================================================
+*/
+
+#include <vector>
+#include <map>
+
+typedef struct heaptrace_s
+{
+	void *ptr;
+	int size;	// 0 is a free
+	int zeromem;
+} heaptrace_t;
+
+// on disk the pointers are replaced by slot numbers
+typedef struct heaptracefile_s
+{
+	int slot;
+	int size;
+	int zeromem;
+} heaptracefile_t;
+
+#define HEAPTRACE_ID	(('T' << 24) + ('H' << 16) + ('Q' << 8) + 'D')
+
+std::vector<heaptrace_t> HeapTraceEvents;
+
+// the server worker threads can allocate too so the events are appended under a lock
+static CRITICAL_SECTION HeapTraceLock;
+static bool HeapTraceLockInit = false;
+
+void Heap_TraceEvent (CQuakeZone *zone, void *ptr, int size, bool zeromem)
+{
+	heaptrace_t ev = {ptr, size, zeromem ? 1 : 0};
+
+	// std::vector allocates from the CRT heap so this doesn't recurse back into the zone
+	EnterCriticalSection (&HeapTraceLock);
+	HeapTraceEvents.push_back (ev);
+	LeaveCriticalSection (&HeapTraceLock);
+}
+
+
+void Heap_Trace_f (void)
+{
+	if (Cmd_Argc () < 2)
+	{
+		Con_Printf ("heap_trace start : begin recording zone allocations\n");
+		Con_Printf ("heap_trace stop <file> : stop recording and write the trace to <file>\n");
+		return;
+	}
+
+	if (!_stricmp (Cmd_Argv (1), "start"))
+	{
+		if (!HeapTraceLockInit)
+		{
+			InitializeCriticalSection (&HeapTraceLock);
+			HeapTraceLockInit = true;
+		}
+
+		HeapTraceEvents.clear ();
+		HeapTrace = true;
+		Con_Printf ("Recording zone allocations\n");
+		return;
+	}
+
+	if (_stricmp (Cmd_Argv (1), "stop"))
+	{
+		Con_Printf ("heap_trace : unknown option \"%s\"\n", Cmd_Argv (1));
+		return;
+	}
+
+	HeapTrace = false;
+
+	// let anything that's still in Heap_TraceEvent finish before the events are read
+	if (HeapTraceLockInit)
+	{
+		EnterCriticalSection (&HeapTraceLock);
+		LeaveCriticalSection (&HeapTraceLock);
+	}
+
+	if (Cmd_Argc () < 3)
+	{
+		Con_Printf ("heap_trace stop : no file specified; trace discarded\n");
+		HeapTraceEvents.clear ();
+		return;
+	}
+
+	FILE *f = fopen (va ("%s/%s", com_gamedir, Cmd_Argv (2)), "wb");
+
+	if (!f)
+	{
+		Con_Printf ("heap_trace stop : couldn't open \"%s\" for writing\n", Cmd_Argv (2));
+		HeapTraceEvents.clear ();
+		return;
+	}
+
+	// assign a slot to each live pointer; frees of blocks allocated before the trace began are dropped
+	std::map<void *, int> live;
+	std::vector<heaptracefile_t> out;
+	int numslots = 0;
+
+	for (int i = 0; i < HeapTraceEvents.size (); i++)
+	{
+		heaptrace_t *ev = &HeapTraceEvents[i];
+		heaptracefile_t fev = {0, ev->size, ev->zeromem};
+
+		if (ev->size)
+		{
+			fev.slot = numslots++;
+			live[ev->ptr] = fev.slot;
+		}
+		else
+		{
+			std::map<void *, int>::iterator it = live.find (ev->ptr);
+
+			if (it == live.end ()) continue;
+
+			fev.slot = it->second;
+			live.erase (it);
+		}
+
+		out.push_back (fev);
+	}
+
+	int header[3] = {HEAPTRACE_ID, numslots, out.size ()};
+
+	fwrite (header, sizeof (header), 1, f);
+	if (out.size ()) fwrite (&out[0], sizeof (heaptracefile_t), out.size (), f);
+	fclose (f);
+
+	Con_Printf ("Wrote %i events (%i allocations) to \"%s\"\n", out.size (), numslots, Cmd_Argv (2));
+	HeapTraceEvents.clear ();
+}
+
+
+static void *Heap_LegacyAlloc (HANDLE hHeap, int size)
+{
+	// replicates the pre-slab CQuakeZone::Alloc so that the comparison is fair
+	int *buf = (int *) HeapAlloc (hHeap, 0, size + sizeof (int) * 2);
+	memset (buf, 0, size + sizeof (int) * 2);
+
+	DWORD dwdummy = 0;
+	VirtualProtect (buf, size, PAGE_READWRITE, &dwdummy);
+
+	buf[0] = HEAP_MAGIC;
+	buf[1] = size;
+
+	return (buf + 2);
+}
+
+
+void Heap_Replay_f (void)
+{
+	if (Cmd_Argc () < 2)
+	{
+		Con_Printf ("heap_replay <file> [passes] : replay a recorded zone allocation trace\n");
+		return;
+	}
+
+	FILE *f = fopen (va ("%s/%s", com_gamedir, Cmd_Argv (1)), "rb");
+
+	if (!f)
+	{
+		Con_Printf ("heap_replay : couldn't open \"%s\"\n", Cmd_Argv (1));
+		return;
+	}
+
+	int header[3] = {0, 0, 0};
+
+	if (fread (header, sizeof (header), 1, f) != 1 || header[0] != HEAPTRACE_ID || header[1] < 0 || header[2] < 0)
+	{
+		Con_Printf ("heap_replay : \"%s\" is not a heap trace\n", Cmd_Argv (1));
+		fclose (f);
+		return;
+	}
+
+	int numslots = header[1];
+	int numevents = header[2];
+	int passes = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 10;
+
+	if (passes < 1) passes = 1;
+
+	std::vector<heaptracefile_t> events (numevents);
+	std::vector<void *> slots (numslots + 1);
+
+	if (numevents && fread (&events[0], sizeof (heaptracefile_t), numevents, f) != numevents)
+	{
+		Con_Printf ("heap_replay : \"%s\" is truncated\n", Cmd_Argv (1));
+		fclose (f);
+		return;
+	}
+
+	fclose (f);
+
+	// don't let the replay show up in a trace that's being recorded
+	bool oldtrace = HeapTrace;
+	HeapTrace = false;
+
+	double slabtime = 0;
+	double legacytime = 0;
+
+	for (int pass = 0; pass < passes; pass++)
+	{
+		// slab zone; deleting it takes it's size back off the totals so heap_report stays honest
+		CQuakeZone *zone = new CQuakeZone ();
+		double start = Sys_DoubleTime ();
+
+		for (int i = 0; i < numevents; i++)
+		{
+			heaptracefile_t *ev = &events[i];
+
+			if (ev->slot < 0 || ev->slot >= numslots) continue;
+
+			if (ev->size)
+				slots[ev->slot] = zone->Alloc (ev->size, ev->zeromem ? true : false);
+			else
+			{
+				zone->Free (slots[ev->slot]);
+				slots[ev->slot] = NULL;
+			}
+		}
+
+		slabtime += Sys_DoubleTime () - start;
+		delete zone;
+
+		// old path on a private heap
+		HANDLE hHeap = HeapCreate (0, 0x10000, 0);
+		start = Sys_DoubleTime ();
+
+		for (int i = 0; i < numevents; i++)
+		{
+			heaptracefile_t *ev = &events[i];
+
+			if (ev->slot < 0 || ev->slot >= numslots) continue;
+
+			if (ev->size)
+				slots[ev->slot] = Heap_LegacyAlloc (hHeap, ev->size);
+			else
+			{
+				HeapFree (hHeap, 0, ((int *) slots[ev->slot]) - 2);
+				slots[ev->slot] = NULL;
+			}
+		}
+
+		legacytime += Sys_DoubleTime () - start;
+		HeapDestroy (hHeap);
+	}
+
+	HeapTrace = oldtrace;
+
+	Con_Printf ("%i events x %i passes\n", numevents, passes);
+	Con_Printf ("  slab zone : %8.3f ms/pass\n", (slabtime * 1000.0) / passes);
+	Con_Printf ("     legacy : %8.3f ms/pass\n", (legacytime * 1000.0) / passes);
+
+	if (slabtime > 0) Con_Printf ("    speedup : %8.2fx\n", legacytime / slabtime);
+}
+
+
+cmd_t Heap_Trace_Cmd ("heap_trace", Heap_Trace_f);
+cmd_t Heap_Replay_Cmd ("heap_replay", Heap_Replay_f);
@@ -19,13 +19,33 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 // 1 MB buffer for general short-lived allocations
+// this is only safe if nothing further up or down the call stack is also using it; new code should
+// use the transient arena (Scratch_Get/CScratchMark) instead
 extern byte *scratchbuf;
 #define SCRATCHBUF_SIZE 0x100000
 
+// memory telemetry tags; stats are kept per tag rather than per object because most zones are recreated every map
+typedef enum
+{
+	mem_zone,
+	mem_hunk,
+	mem_game,
+	mem_server,
+	mem_client,
+	mem_render,
+	mem_model,
+	mem_cache,
+	mem_sound,
+	mem_other,
+	MAX_MEMTAGS
+} memtag_t;
+
 // interface
 void Heap_Init (void);
+void Heap_BeginMap (void);
+void Heap_SetMapName (char *mapname);
 
-void *Zone_Alloc (int size);
+void *Zone_Alloc (int size, bool zeromem = true);
 void Zone_FreeMemory (void *ptr);
 void Zone_Compact (void);
 
@@ -36,7 +56,7 @@ void Zone_Compact (void);
 class CQuakeHunk
 {
 public:
-	CQuakeHunk (int maxsizemb);
+	CQuakeHunk (int maxsizemb, memtag_t tag = mem_hunk);
 	~CQuakeHunk (void);
 	void *Alloc (int size);
 	void Free (void);
@@ -50,6 +70,7 @@ private:
 	int MaxSize;	// maximum memory reserved by this buffer (converted to bytes in constructor)
 	int LowMark;	// current memory pointer position
 	int HighMark;	// size of all committed memory so far
+	memtag_t Tag;
 
 	char Name[64];
 
@@ -57,12 +78,20 @@ private:
 };
 
 
+// size classes for the zone slab allocator; blocks up to ZONE_MAXSLABBLOCK (including the header) come from slabs
+#define ZONE_NUMCLASSES		16
+#define ZONE_MAXSLABBLOCK	4096
+#define ZONE_SLABSIZE		0x10000
+
 class CQuakeZone
 {
 public:
-	CQuakeZone (void);
+	CQuakeZone (memtag_t tag = mem_other);
 	~CQuakeZone (void);
-	void *Alloc (int size);
+	void *Alloc (int size, bool zeromem = true);
+
+	// for wrappers such as Zone_Alloc that want telemetry to go to their own caller
+	void *AllocFrom (int size, bool zeromem, void *caller);
 	void Free (void *data);
 	void Compact (void);
 	void Discard (void);
@@ -70,28 +99,98 @@ public:
 
 private:
 	void EnsureHeap (void);
+	void *AllocSlab (int blocksize);
 	HANDLE hHeap;
+	memtag_t Tag;
 	int Size;
 	int Peak;
+
+	// per-class free lists and the current slab each class is being carved from
+	void *FreeBlocks[ZONE_NUMCLASSES];
+	byte *SlabPtr[ZONE_NUMCLASSES];
+	byte *SlabEnd[ZONE_NUMCLASSES];
 };
 
 
+// transient arena for temporary memory; each thread gets it's own so there's no contention, and
+// allocations are released in stack order by returning to a previously taken mark
+#define SCRATCH_MAXSIZE		0x2000000
+
+class CQuakeScratch
+{
+public:
+	CQuakeScratch (int maxsize);
+	~CQuakeScratch (void);
+	void *Alloc (int size);
+	int GetMark (void);
+	void FreeToMark (int mark);
+	float GetPeakMB (void);
+
+private:
+	int MaxSize;	// memory reserved for the arena
+	int LowMark;	// current allocation position
+	int HighMark;	// committed so far
+	int Peak;
+
+	byte *BasePtr;
+};
+
+CQuakeScratch *Scratch_Get (void);
+void Scratch_ReleaseThread (void);
+
+// takes a mark on the calling thread's arena and releases back to it when it goes out of scope
+class CScratchMark
+{
+public:
+	CScratchMark (void);
+	~CScratchMark (void);
+	void *Alloc (int size);
+
+private:
+	CQuakeScratch *Arena;
+	int Mark;
+};
+
+
+#define CACHE_HASH_SIZE		256
+
 class CQuakeCache
 {
 public:
-	CQuakeCache (void);
+	CQuakeCache (char *name, memtag_t tag = mem_cache);
 	~CQuakeCache (void);
 	void *Alloc (int size);
 	void *Alloc (void *data, int size);
 	void *Alloc (char *name, void *data, int size);
 	void *Check (char *name);
 	void Flush (void);
+	void Trim (int budget);
+	void Report (void);
 	float GetSizeMB (void);
 
 private:
 	void Init (void);
+	void Evict (struct cacheobject_s *cache);
 	CQuakeZone *Heap;
-	struct cacheobject_s *Head;
+	memtag_t Tag;
+	char Name[16];
+
+	// name lookup and LRU order (most recently used at the head)
+	struct cacheobject_s *HashTable[CACHE_HASH_SIZE];
+	struct cacheobject_s *LRUHead;
+	struct cacheobject_s *LRUTail;
+
+	// unnamed allocations are held here until the named object they belong to is added
+	struct cacheblock_s *Pending;
+	int PendingSize;
+
+	int NumObjects;
+	int ObjectSize;
+
+	// these persist across flushes
+	int Hits;
+	int Misses;
+	int Evictions;
 };
 
 
@@ -78,11 +78,25 @@ void Host_SafeWipeClient (client_t *client)
 	byte *msgbuf = client->msgbuf;
 	float *ping_times = client->ping_times;
 	float *spawn_parms = client->spawn_parms;
+	int *entsent = client->entsent;
+	int maxentsent = client->maxentsent;
+	deltaframe_t *deltaframes = client->deltaframes;
 
 	// wipe the contents of what we copied out
 	if (msgbuf) memset (msgbuf, 0, MAX_MSGLEN);
 	if (ping_times) memset (ping_times, 0, sizeof (float) * NUM_PING_TIMES);
 	if (spawn_parms) memset (spawn_parms, 0, sizeof (float) * NUM_SPAWN_PARMS);
+	if (entsent) memset (entsent, 0, sizeof (int) * maxentsent);
+
+	// the delta frames keep their storage but none of them are valid any more
+	if (deltaframes)
+	{
+		for (int i = 0; i < DELTA_BACKUP; i++)
+		{
+			deltaframes[i].sequence = 0;
+			deltaframes[i].numents = 0;
+		}
+	}
 
 	// now we can safely wipe the struct
 	memset (client, 0, sizeof (client_t));
@@ -91,6 +105,9 @@ void Host_SafeWipeClient (client_t *client)
 	client->msgbuf = msgbuf;
 	client->ping_times = ping_times;
 	client->spawn_parms = spawn_parms;
+	client->entsent = entsent;
+	client->maxentsent = maxentsent;
+	client->deltaframes = deltaframes;
 }
 
 
@@ -141,6 +158,20 @@ void Host_InitClients (int numclients)
 				MainZone->Free (client->spawn_parms);
 				client->spawn_parms = NULL;
 			}
+
+			if (client->entsent)
+			{
+				MainZone->Free (client->entsent);
+				client->entsent = NULL;
+				client->maxentsent = 0;
+			}
+
+			if (client->deltaframes)
+			{
+				Delta_FreeFrames (client->deltaframes);
+				MainZone->Free (client->deltaframes);
+				client->deltaframes = NULL;
+			}
 		}
 	}
 }
@@ -565,9 +596,14 @@ cmd_t Cmd_SignalCacheClear ("cacheclear", Cmd_SignalCacheClear_f);
 cmd_t Cmd_CacheFlush ("cache_flush", Cmd_SignalCacheClear_f);
 
 void CL_ClearCLStruct (void);
+extern cvar_t cache_budget;
+extern CQuakeCache *SoundCache;
 
 void Host_ClearMemory (void)
 {
+	// close off per-map memory telemetry for the map we're leaving
+	Heap_BeginMap ();
+
 	// clear anything that needs to be cleared specifically
 	S_StopAllSounds (true);
 	Mod_ClearAll ();
@@ -581,6 +617,16 @@ void Host_ClearMemory (void)
 		MainCache->Flush ();
 		signal_cacheclear = false;
 	}
+	else if (cache_budget.value > 0)
+	{
+		// nothing is referencing cached objects at this point so it's safe to evict down to the budget;
+		// whatever the last map used is most recent so it's the last to go
+		// the budget is in bytes as an int so anything from 2gb up is as good as unlimited anyway
+		int budget = (cache_budget.value < 2047) ? (int) (cache_budget.value * 1024.0f * 1024.0f) : 2047 * 1024 * 1024;
+
+		MainCache->Trim (budget);
+		SoundCache->Trim (budget);
+	}
 
 	// this is now just used for short lived temp allocations during loading, so instead of wiping it fully we
 	// just reset the lowmark back to 0
@@ -640,7 +686,13 @@ void IN_CheckFreeLook (void);
 void Host_Frame (DWORD time)
 {
 	// something bad happened, or the server disconnected
-	if (setjmp (host_abortserver)) return;
+	if (setjmp (host_abortserver))
+	{
+		// the longjmp skipped the destructors of any scratch marks that were live, and nothing in the arena is
+		// kept from one frame to the next, so put it all back
+		Scratch_Get ()->FreeToMark (0);
+		return;
+	}
 
 	static DWORD milliseconds = 0;
 	static double nextframetime = 0;
@@ -719,8 +771,13 @@ void Host_Frame (DWORD time)
 	else host_fixedtime = 0.0;
 
 	Cbuf_Execute ();
+
+	double netpollstart = SV_ProfileTime ();
 	NET_Poll ();
 
+	// this is counted in the next server frame
+	if (sv.active) SV_ProfileAdd (SVPROF_NETPOLL, netpollstart);
+
 	if (sv.active && (host_fixedtime > 0))
 	{
 		CL_SendCmd (host_fixedtime);
@@ -872,6 +929,7 @@ void Host_ShutdownGame (void)
 	Host_WriteConfiguration ();
 	IPLog_WriteLog ();	// JPG 1.05 - ip loggging
 
+	SV_StopWorkers ();
 	CDAudio_Shutdown ();
 	MediaPlayer_Shutdown ();
 	NET_Shutdown ();
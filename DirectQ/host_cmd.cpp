@@ -848,6 +848,9 @@ void Host_Loadgame_f (void)
 	}
 
 	SVProgs->NumEdicts = entnum;
+
+	// the free edicts came from the save rather than from ED_Free
+	ED_RebuildFreeQueue ();
 	sv.time = time;
 
 	fclose (f);
@@ -906,6 +909,7 @@ void Host_Name_f (void)
 
 	strcpy (host_client->name, newName);
 	host_client->edict->v.netname = SVProgs->SetString (host_client->name);
+	PR_FindIndexEdict (host_client->edict);
 
 	// JPG 1.05 - log the IP address
 	if (sscanf (host_client->netconnection->address, "%d.%d.%d", &a, &b, &c) == 3)
@@ -1232,6 +1236,27 @@ void Host_Pause_f (void)
 //===========================================================================
 
 
+/*
+==================
+Host_DeltaFrames_f
+
+the client can take entity updates against the last frame it acknowledged; it asks during the signon after
+every serverinfo so this only lasts for the current map
+==================
+*/
+void Host_DeltaFrames_f (void)
+{
+	if (cmd_source == src_command)
+	{
+		Con_Printf ("deltaframes is not valid from the console\n");
+		return;
+	}
+
+	// if the server isn't doing them the client just gets full updates and never hears about it
+	host_client->deltaenabled = sv.deltaframes;
+}
+
+
 /*
 ==================
 Host_PreSpawn_f
@@ -1301,6 +1326,7 @@ void Host_Spawn_f (void)
 		ent->v.colormap = GetNumberForEdict (ent);
 		ent->v.team = (host_client->colors & 15) + 1;
 		ent->v.netname = SVProgs->SetString (host_client->name);
+		PR_FindIndexEdict (ent);
 
 		// copy spawn parms out of the client_t
 		for (i = 0; i < NUM_SPAWN_PARMS; i++)
@@ -2120,6 +2146,7 @@ cmd_t Host_Pause_f_Cmd ("pause", Host_Pause_f);
 cmd_t Host_Spawn_f_Cmd ("spawn", Host_Spawn_f);
 cmd_t Host_Begin_f_Cmd ("begin", Host_Begin_f);
 cmd_t Host_PreSpawn_f_Cmd ("prespawn", Host_PreSpawn_f);
+cmd_t Host_DeltaFrames_f_Cmd ("deltaframes", Host_DeltaFrames_f);
 cmd_t Host_Kick_f_Cmd ("kick", Host_Kick_f);
 cmd_t Host_Ping_f_Cmd ("ping", Host_Ping_f);
 cmd_t Host_Loadgame_f_Cmd ("load", Host_Loadgame_f);
@@ -131,7 +131,7 @@ void IPLog_Init (void)
 	if (!iplog_size) iplog_size = DEFAULT_IPLOGSIZE;
 
 	// in theory this gives us unlimited log space; in practice we'll need to untangle the messy tree structure to get there
-	IPLogZone = new CQuakeZone ();
+	IPLogZone = new CQuakeZone (mem_zone);
 	iplogs = (iplog_t *) IPLogZone->Alloc (iplog_size * sizeof (iplog_t));
 	iplog_next = 0;
 	iplog_head = NULL;
@@ -231,6 +231,7 @@ char *protolist[] =
 	"15",
 	"Fitz",
 	"RMQ",
+	"Delta",
 	NULL
 };
 
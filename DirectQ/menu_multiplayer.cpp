@@ -160,6 +160,8 @@ int Menu_TCPIPProtoDesc (int y)
 		Menu_PrintCenter (y, "FitzQuake extended protocol");
 	else if (selected_protocol == 2)
 		Menu_PrintCenter (y, "RMQ extended protocol");
+	else if (selected_protocol == 3)
+		Menu_PrintCenter (y, "RMQ protocol with delta frames");
 	else Menu_PrintCenter (y, "Unknown protocol");
 
 	return y + 15;
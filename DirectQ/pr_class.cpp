@@ -19,12 +19,116 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 #include "pr_class.h"
+#include <vector>
 
 // 2001-09-14 Enhanced BuiltIn Function System (EBFS) by Maddes  start
 cvar_t	pr_builtin_find ("pr_builtin_find", "0", CVAR_INTERNAL);
 cvar_t	pr_builtin_remap ("pr_builtin_remap", "0", CVAR_INTERNAL);
 // 2001-09-14 Enhanced BuiltIn Function System (EBFS) by Maddes  end
 
+// pr_profile counts statements per function for the profile command; this forces the slower instrumented loop
+cvar_t pr_profile ("pr_profile", 0.0f);
+
+void PR_SetInterpreter (cvar_t *var)
+{
+	if (SVProgs) SVProgs->Interpreter = var->integer;
+}
+
+// 0 = original interpreter, 1 = pre-decoded statements, 2 = pre-decoded with superinstructions
+cvar_t pr_interpreter ("pr_interpreter", "2", 0, PR_SetInterpreter);
+
+
+/*
+==============================================================================
+
+TIMING PROFILE
+
+wall-clock time is collected into a tree of calling contexts, so each node is one function or builtin as reached
+through one particular chain of callers.  time is charged to whatever node is current each time the progs enter or
+leave a function or builtin, which gives exclusive time directly and inclusive time by summing subtrees.
+
+==============================================================================
+*/
+
+typedef struct prprofnode_s
+{
+	int func;		// function number, or -builtin number; 0 for the root (outside of the progs)
+	int parent;
+	int child;
+	int sibling;
+	int calls;
+	double self;
+	double total;	// filled in when reporting
+} prprofnode_t;
+
+static std::vector<prprofnode_t> pr_profnodes;
+static int pr_profcurrent = 0;
+static double pr_proflast = 0;
+
+
+static void PR_ProfileReset (bool clear)
+{
+	if (clear || pr_profnodes.empty ())
+	{
+		prprofnode_t root = {0, -1, -1, -1, 0, 0, 0};
+
+		pr_profnodes.clear ();
+		pr_profnodes.push_back (root);
+	}
+
+	pr_profcurrent = 0;
+	pr_proflast = Sys_DoubleTime ();
+}
+
+
+static void PR_ProfileCharge (void)
+{
+	double now = Sys_DoubleTime ();
+
+	// time outside of the progs isn't ours
+	if (pr_profcurrent) pr_profnodes[pr_profcurrent].self += now - pr_proflast;
+
+	pr_proflast = now;
+}
+
+
+static void PR_ProfilePush (int func)
+{
+	PR_ProfileCharge ();
+
+	int child;
+
+	for (child = pr_profnodes[pr_profcurrent].child; child >= 0; child = pr_profnodes[child].sibling)
+		if (pr_profnodes[child].func == func)
+			break;
+
+	if (child < 0)
+	{
+		prprofnode_t node = {func, pr_profcurrent, -1, pr_profnodes[pr_profcurrent].child, 0, 0, 0};
+
+		child = pr_profnodes.size ();
+		pr_profnodes.push_back (node);
+		pr_profnodes[pr_profcurrent].child = child;
+	}
+
+	pr_profnodes[child].calls++;
+	pr_profcurrent = child;
+}
+
+
+static void PR_ProfilePop (void)
+{
+	PR_ProfileCharge ();
+
+	if (pr_profcurrent) pr_profcurrent = pr_profnodes[pr_profcurrent].parent;
+}
+
+
+bool CProgsDat::NeedsInstrumentation (void)
+{
+	return (this->Trace || this->Timing || pr_profile.integer);
+}
+
 
 // swimmonster_start_go
 // swimmonster_start
@@ -43,6 +147,8 @@ char *pr_opnames[] =
 
 char *PR_GlobalString (int ofs);
 char *PR_GlobalStringNoContents (int ofs);
+ddef_t *ED_GlobalAtOfs (int ofs);
+ddef_t *ED_FieldAtOfs (int ofs);
 
 
 void FindEdictFieldOffsets (void);
@@ -70,6 +176,7 @@ CProgsDat::CProgsDat (void)
 	this->GlobalDefs = NULL;
 	this->FieldDefs = NULL;
 	this->Statements = NULL;
+	this->Decoded = NULL;
 	this->Globals = NULL;
 	this->GlobalStruct = NULL;
 	this->EdictSize = 0;
@@ -77,12 +184,21 @@ CProgsDat::CProgsDat (void)
 	this->XFunction = NULL;
 	this->XStatement = 0;
 	this->Trace = false;
+	this->Timing = false;
 	this->Argc = 0;
+	this->Interpreter = PR_INTERP_FUSED;
 	this->FishHack = false;
 	this->NumFish = 0;
 	this->EdictPointers = NULL;
 	this->NumEdicts = 0;
 	this->MaxEdicts = 0;
+	this->FreeEdicts = NULL;
+	this->FreeEdictHead = 0;
+	this->FreeEdictCount = 0;
+
+	memset (&this->FieldLookup, 0, sizeof (prlookup_t));
+	memset (&this->GlobalLookup, 0, sizeof (prlookup_t));
+	memset (&this->FunctionLookup, 0, sizeof (prlookup_t));
 }
 
 
@@ -97,12 +213,6 @@ void CProgsDat::LoadProgs (char *progsname, cvar_t *overridecvar)
 	byte	progshash[16];
 	// 2001-09-14 Enhanced BuiltIn Function System (EBFS) by Maddes/Firestorm  end
 
-	// this can't be in a constructor yet because we need the instance already created in order to do
-	// FindEdictFieldOffsets without crashing.  When we get everything on the server gone to OOP we'll
-	// do it right.
-	// flush the non-C variable lookup cache
-	for (int i = 0; i < GEFV_CACHESIZE; i++) gefvCache[i].field[0] = 0;
-
 	CRC_Init (&this->CRC);
 
 	// the old heap corruption errors are now gone.  yayyyy!
@@ -143,13 +253,47 @@ void CProgsDat::LoadProgs (char *progsname, cvar_t *overridecvar)
 	this->GlobalStruct = (globalvars_t *) this->Globals;
 	this->EdictSize = this->QC->entityfields * 4 + sizeof (edict_t) - sizeof (entvars_t);
 
+	// function numbers in the timing profile and field numbers in find's index would be meaningless with different progs
+	PR_ProfileReset (true);
+	PR_FindIndexReset ();
+
+	// resolve operands and branches up front for the decoded interpreter
+	this->DecodeStatements ();
+	this->FuseStatements ();
+	this->Interpreter = pr_interpreter.integer;
+
 	// init the string table
 	this->StringSize = this->QC->numstrings;
 	this->KnownStrings = NULL;
+	this->StringTypes = NULL;
+	this->StringNext = NULL;
+	this->StringHash = NULL;
+	this->StringHashMask = 0;
+	this->FreeStrings = -1;
 	this->NumKnownStrings = 0;
 	this->MaxKnownStrings = 0;
+	this->StringArena = NULL;
+	this->StringArenaUsed = 0;
+	this->StringArenaSize = 0;
+	this->LiveStrings = 0;
+	this->LiveStringBytes = 0;
 	this->SetString ("");
 
+	// the temp strings get fixed slots so that SetString on one is just a hash lookup
+	for (int i = 0; i < PR_NUM_TEMP_STRINGS; i++)
+	{
+		this->TempStrings[i] = (char *) ServerZone->Alloc (PR_MAX_TEMP_STRING);
+		this->NewStringSlot (this->TempStrings[i], PRSTR_TEMP, 0);
+	}
+
+	this->TempStringNum = 0;
+	this->TempStringPeak = 0;
+
+	// name and offset lookups for ED_FindField and friends; these need GetString so they come after the string table
+	this->BuildLookup (&this->FieldLookup, this->FieldDefs, this->QC->numfielddefs, sizeof (ddef_t), offsetof (ddef_t, s_name), true);
+	this->BuildLookup (&this->GlobalLookup, this->GlobalDefs, this->QC->numglobaldefs, sizeof (ddef_t), offsetof (ddef_t, s_name), true);
+	this->BuildLookup (&this->FunctionLookup, this->Functions, this->QC->numfunctions, sizeof (dfunction_t), offsetof (dfunction_t, s_name), false);
+
 	// 2001-09-14 Enhanced BuiltIn Function System (EBFS) by Maddes/Firestorm  start
 	// initialize function numbers for PROGS.DAT
 	pr_numbuiltins = 0;
@@ -264,15 +408,10 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 	// ha!
 	if (!this->QC) return;
 
-	eval_t		*a, *b, *c;
+	dfunction_t	*f;
 	int		s;
-	dstatement_t	*st;
-	dfunction_t	*f, *newf;
-	int		runaway;
-	int		i;
-	edict_t		*ed = NULL;
 	int		exitdepth;
-	eval_t		*ptr;
+	int		runaway = 5000000;
 
 	if (!fnum || fnum < 0 || fnum >= this->QC->numfunctions)
 	{
@@ -288,33 +427,95 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 
 	f = &this->Functions[fnum];
 
-	runaway = 5000000;
 	this->Trace = false;
 
 	// make a stack frame
 	exitdepth = this->StackDepth;
 
+	// a top-level call starts from outside of the progs; this also recovers from an error leaving the profile deep
+	if (this->Timing && !exitdepth) PR_ProfileReset (false);
+
 	s = this->EnterFunction (f);
 
-	while (1)
+	// the timing profile needs the builtin hooks in the decoded loop
+	if (this->Interpreter == PR_INTERP_LEGACY && !this->Timing)
 	{
-		s++;	// next statement
+		this->ExecuteLegacy (s, exitdepth);
+		return;
+	}
 
-		if (s >= this->QC->numstatements) Host_Error ("CProgsDat::ExecuteProgram: s >= this->QC->numstatements");
+	// a first statement past the end goes to the overrun sentinel, which errors the same way the old bounds check did
+	if (s >= this->QC->numstatements) s = this->QC->numstatements - 1;
 
-		this->XStatement = s;
-		this->XFunction->profile++;
+	// the instrumented loop is only used if tracing or profiling; traceon/traceoff can only change from a builtin
+	// so the loops hand back to here to switch when that happens
+	for (;;)
+	{
+		if (this->NeedsInstrumentation ())
+			s = this->ExecuteDecoded<true, false> (s, exitdepth, runaway);
+		else if (this->Interpreter == PR_INTERP_FUSED)
+			s = this->ExecuteDecoded<false, true> (s, exitdepth, runaway);
+		else s = this->ExecuteDecoded<false, false> (s, exitdepth, runaway);
 
-		st = &this->Statements[s];
-		a = (eval_t *) &this->Globals[(unsigned short) st->a];
-		b = (eval_t *) &this->Globals[(unsigned short) st->b];
-		c = (eval_t *) &this->Globals[(unsigned short) st->c];
+		if (s < 0) return;
+	}
+}
 
-		if (!--runaway) this->RunError ("runaway loop error %d");
 
-		if (this->Trace) this->PrintStatement (st);
+// the second statement of a superinstruction; counts it for runaway the same as if it had been run on it's own
+#define PR_FUSED_STEP() \
+	st++; \
+	if (!--runaway) \
+	{ \
+		this->XStatement = st - this->Decoded; \
+		this->RunError ("runaway loop error %d"); \
+	}
 
-		switch (st->op)
+// comparison then IF/IFNOT on the result; the result is still stored because the global is visible to the progs
+#define PR_FUSED_BRANCH(fop, test) \
+	case fop##_IF: \
+		c->_float = test; \
+		PR_FUSED_STEP (); \
+		if (c->_int) st = this->Decoded + st->jump; \
+		break; \
+	case fop##_IFNOT: \
+		c->_float = test; \
+		PR_FUSED_STEP (); \
+		if (!c->_int) st = this->Decoded + st->jump; \
+		break;
+
+template <bool Instrumented, bool Fused> int CProgsDat::ExecuteDecoded (int s, int exitdepth, int &runaway)
+{
+	eval_t		*a, *b, *c;
+	prstatement_t	*st = this->Decoded + s;
+	dfunction_t	*newf;
+	int		i;
+	edict_t		*ed = NULL;
+	eval_t		*ptr;
+
+	while (1)
+	{
+		st++;	// next statement
+
+		if (Instrumented)
+		{
+			this->XStatement = st - this->Decoded;
+			this->XFunction->profile++;
+
+			if (this->Trace && st->op != OPX_OVERRUN) this->PrintStatement (&this->Statements[this->XStatement]);
+		}
+
+		if (!--runaway)
+		{
+			this->XStatement = st - this->Decoded;
+			this->RunError ("runaway loop error %d");
+		}
+
+		a = st->a;
+		b = st->b;
+		c = st->c;
+
+		switch (Fused ? st->op : st->base)
 		{
 		case OP_ADD_F:
 			c->_float = a->_float + b->_float;
@@ -386,7 +587,7 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 			c->_float = !a->vector[0] && !a->vector[1] && !a->vector[2];
 			break;
 		case OP_NOT_S:
-			c->_float = !a->string || !(SVProgs->GetString (a->string))[0];
+			c->_float = !a->string || !(this->GetString (a->string))[0];
 			break;
 		case OP_NOT_FNC:
 			c->_float = !a->function;
@@ -403,7 +604,7 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 						(a->vector[2] == b->vector[2]);
 			break;
 		case OP_EQ_S:
-			c->_float = !strcmp (SVProgs->GetString (a->string), SVProgs->GetString (b->string));
+			c->_float = !strcmp (this->GetString (a->string), this->GetString (b->string));
 			break;
 		case OP_EQ_E:
 			c->_float = a->_int == b->_int;
@@ -420,7 +621,7 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 						(a->vector[2] != b->vector[2]);
 			break;
 		case OP_NE_S:
-			c->_float = strcmp (SVProgs->GetString (a->string), SVProgs->GetString (b->string));
+			c->_float = strcmp (this->GetString (a->string), this->GetString (b->string));
 			break;
 		case OP_NE_E:
 			c->_float = a->_int != b->_int;
@@ -446,14 +647,18 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 		case OP_STOREP_F:
 		case OP_STOREP_ENT:
 		case OP_STOREP_FLD:		// integers
-		case OP_STOREP_S:
 		case OP_STOREP_FNC:		// pointers
-			//ptr = (eval_t *)((byte *)this->Edicts + b->_int);
 			ptr = (eval_t *) ((byte *) this->EdictPointers[b->_int / this->EdictSize] + (b->_int % this->EdictSize));
 			ptr->_int = a->_int;
+			break;
+		case OP_STOREP_S:
+			ptr = (eval_t *) ((byte *) this->EdictPointers[b->_int / this->EdictSize] + (b->_int % this->EdictSize));
+			ptr->_int = a->_int;
+
+			if (pr_numfindindexes) PR_FindIndexStore (b->_int);
+
 			break;
 		case OP_STOREP_V:
-			//ptr = (eval_t *)((byte *)this->Edicts + b->_int);
 			ptr = (eval_t *) ((byte *) this->EdictPointers[b->_int / this->EdictSize] + (b->_int % this->EdictSize));
 			ptr->vector[0] = a->vector[0];
 			ptr->vector[1] = a->vector[1];
@@ -464,11 +669,11 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 			ed = PROG_TO_EDICT (a->edict);
 
 			if (ed == (edict_t *) this->EdictPointers[0] && sv.state == ss_active)
+			{
+				this->XStatement = st - this->Decoded;
 				this->RunError ("CProgsDat::ExecuteProgram: assignment to world entity");
+			}
 
-			// c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)this->Edicts;
-			// beautiful, isn't it?  i much check the QCC source and see if the number here actually matters
-			// or can i just store the edict number and the offset in a short[2] member of the eval_t instead.
 			c->_int = (int) ((int *) ((byte *) &ed->v - (byte *) ed) + b->_int) + ed->Prog;
 			break;
 
@@ -495,21 +700,15 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 			//==================
 
 		case OP_IFNOT:
-
-			if (!a->_int)
-				s += (signed short) st->b - 1;	// offset the s++
-
+			if (!a->_int) st = this->Decoded + st->jump;
 			break;
 
 		case OP_IF:
-
-			if (a->_int)
-				s += (signed short) st->b - 1;	// offset the s++
-
+			if (a->_int) st = this->Decoded + st->jump;
 			break;
 
 		case OP_GOTO:
-			s += (signed short) st->a - 1;	// offset the s++
+			st = this->Decoded + st->jump;
 			break;
 
 		case OP_CALL0:
@@ -521,11 +720,13 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 		case OP_CALL6:
 		case OP_CALL7:
 		case OP_CALL8:
+			// the return point and anything that reports an error needs to know where we are
+			this->XStatement = st - this->Decoded;
 			this->Argc = st->op - OP_CALL0;
 
 			if (!a->function)
 			{
-				if ((st - 1)->op == OP_LOAD_FNC) // OK?
+				if (this->Statements[this->XStatement - 1].op == OP_LOAD_FNC) // OK?
 					ED_Print (ed); // Print owner edict, if any
 				else if (this->GlobalStruct->self)
 					ED_Print (PROG_TO_EDICT (this->GlobalStruct->self));
@@ -543,26 +744,41 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 				if (i >= pr_numbuiltins)
 					this->RunError ("CProgsDat::ExecuteProgram: bad builtin call number (%d, max = %d)", i, pr_numbuiltins);
 
-				pr_builtins[i] ();
+				if (Instrumented && this->Timing)
+				{
+					PR_ProfilePush (-i);
+					pr_builtins[i] ();
+					PR_ProfilePop ();
+				}
+				else pr_builtins[i] ();
+
+				// traceon/traceoff or pr_profile may have changed which loop we should be in
+				if (Instrumented != this->NeedsInstrumentation ()) return st - this->Decoded;
+
 				break;
 			}
 
 			s = this->EnterFunction (newf);
+
+			if (s >= this->QC->numstatements) s = this->QC->numstatements - 1;
+
+			st = this->Decoded + s;
 			break;
 
 		case OP_DONE:
 		case OP_RETURN:
-			this->Globals[OFS_RETURN] = this->Globals[(unsigned short) st->a];
-			this->Globals[OFS_RETURN+1] = this->Globals[(unsigned short) st->a+1];
-			this->Globals[OFS_RETURN+2] = this->Globals[(unsigned short) st->a+2];
+			this->Globals[OFS_RETURN] = a->vector[0];
+			this->Globals[OFS_RETURN+1] = a->vector[1];
+			this->Globals[OFS_RETURN+2] = a->vector[2];
 
 			s = this->LeaveFunction ();
 
 			if (this->StackDepth == exitdepth)
 			{
-				return;		// all done
+				return -1;		// all done
 			}
 
+			st = this->Decoded + s;
 			break;
 
 		case OP_STATE:
@@ -575,287 +791,1571 @@ void CProgsDat::ExecuteProgram (func_t fnum)
 			ed->v.think = b->function;
 			break;
 
-		default:
-			this->RunError ("CProgsDat::ExecuteProgram: bad opcode %i", st->op);
-		}
-	}
-}
+		case OPX_OVERRUN:
+			Host_Error ("CProgsDat::ExecuteProgram: s >= this->QC->numstatements");
+			break;
 
+			//==================
+			// superinstructions
+
+			PR_FUSED_BRANCH (OPX_EQ_F, a->_float == b->_float);
+			PR_FUSED_BRANCH (OPX_NE_F, a->_float != b->_float);
+			PR_FUSED_BRANCH (OPX_LT, a->_float < b->_float);
+			PR_FUSED_BRANCH (OPX_GT, a->_float > b->_float);
+			PR_FUSED_BRANCH (OPX_LE, a->_float <= b->_float);
+			PR_FUSED_BRANCH (OPX_GE, a->_float >= b->_float);
+			PR_FUSED_BRANCH (OPX_EQ_E, a->_int == b->_int);
+			PR_FUSED_BRANCH (OPX_NE_E, a->_int != b->_int);
+			PR_FUSED_BRANCH (OPX_EQ_S, !strcmp (this->GetString (a->string), this->GetString (b->string)));
+			PR_FUSED_BRANCH (OPX_NE_S, strcmp (this->GetString (a->string), this->GetString (b->string)));
+			PR_FUSED_BRANCH (OPX_NOT_F, !a->_float);
+			PR_FUSED_BRANCH (OPX_NOT_ENT, (PROG_TO_EDICT (a->edict) == this->EdictPointers[0]));
+
+		case OPX_ADDRESS_STOREP:
+		case OPX_ADDRESS_STOREP_V:
+			ed = PROG_TO_EDICT (a->edict);
 
-int CProgsDat::EnterFunction (dfunction_t *f)
-{
-	int i, j, c, o;
+			if (ed == (edict_t *) this->EdictPointers[0] && sv.state == ss_active)
+			{
+				this->XStatement = st - this->Decoded;
+				this->RunError ("CProgsDat::ExecuteProgram: assignment to world entity");
+			}
 
-	this->Stack[this->StackDepth].s = this->XStatement;
-	this->Stack[this->StackDepth].f = this->XFunction;
-	this->StackDepth++;
+			// this is where the STOREP would end up after converting the address back to an edict; take it
+			// before writing c in case c and b are the same global
+			ptr = (eval_t *) ((int *) &ed->v + b->_int);
+			c->_int = (int) ((int *) ((byte *) &ed->v - (byte *) ed) + b->_int) + ed->Prog;
 
-	if (this->StackDepth >= MAX_STACK_DEPTH) this->RunError ("CProgsDat::EnterFunction: stack overflow (%d, max = %d)", this->StackDepth, MAX_STACK_DEPTH - 1);
+			if (st->op == OPX_ADDRESS_STOREP)
+			{
+				PR_FUSED_STEP ();
+				ptr->_int = st->a->_int;
 
-	// save off any locals that the new function steps on
-	c = f->locals;
+				// b is the field here
+				if (pr_numfindindexes && st->base == OP_STOREP_S) PR_FindIndexUpdate (ed, b->_int);
+			}
+			else
+			{
+				PR_FUSED_STEP ();
+				ptr->vector[0] = st->a->vector[0];
+				ptr->vector[1] = st->a->vector[1];
+				ptr->vector[2] = st->a->vector[2];
+			}
 
-	if (this->LocalStackUsed + c > LOCALSTACK_SIZE)
-		this->RunError ("CProgsDat::EnterFunction: locals stack overflow (%d, max = %d)", this->LocalStackUsed + c, LOCALSTACK_SIZE);
+			break;
 
-	for (i = 0; i < c; i++)
-		this->LocalStack[this->LocalStackUsed + i] = ((int *) this->Globals)[f->parm_start + i];
+		case OPX_LOAD_ENT_LOAD:
+			ed = PROG_TO_EDICT (a->edict);
+			c->_int = ((eval_t *) ((int *) &ed->v + b->_int))->_int;
 
-	this->LocalStackUsed += c;
+			PR_FUSED_STEP ();
+			ed = PROG_TO_EDICT (st->a->edict);
 
-	// copy parameters
-	o = f->parm_start;
+			a = (eval_t *) ((int *) &ed->v + st->b->_int);
+			st->c->_int = a->_int;
+			break;
 
-	for (i = 0; i < f->numparms; i++)
-	{
-		for (j = 0; j < f->parm_size[i]; j++)
-		{
-			((int *) this->Globals)[o] = ((int *) this->Globals)[OFS_PARM0 + i * 3 + j];
-			o++;
+		case OPX_LOAD_ENT_LOAD_V:
+			ed = PROG_TO_EDICT (a->edict);
+			c->_int = ((eval_t *) ((int *) &ed->v + b->_int))->_int;
+
+			PR_FUSED_STEP ();
+			ed = PROG_TO_EDICT (st->a->edict);
+
+			a = (eval_t *) ((int *) &ed->v + st->b->_int);
+			st->c->vector[0] = a->vector[0];
+			st->c->vector[1] = a->vector[1];
+			st->c->vector[2] = a->vector[2];
+			break;
+
+		case OPX_STORE_STORE:
+			b->_int = a->_int;
+			PR_FUSED_STEP ();
+			st->b->_int = st->a->_int;
+			break;
+
+		case OPX_STORE_V_STORE_V:
+			b->vector[0] = a->vector[0];
+			b->vector[1] = a->vector[1];
+			b->vector[2] = a->vector[2];
+			PR_FUSED_STEP ();
+			st->b->vector[0] = st->a->vector[0];
+			st->b->vector[1] = st->a->vector[1];
+			st->b->vector[2] = st->a->vector[2];
+			break;
+
+		default:
+			this->XStatement = st - this->Decoded;
+			this->RunError ("CProgsDat::ExecuteProgram: bad opcode %i", st->jump);
 		}
 	}
-
-	this->XFunction = f;
-	return f->first_statement - 1;	// offset the s++
 }
 
 
-int CProgsDat::LeaveFunction (void)
+#undef PR_FUSED_BRANCH
+#undef PR_FUSED_STEP
+
+
+void CProgsDat::DecodeStatements (void)
 {
-	int		i, c;
+	int numstatements = this->QC->numstatements;
 
-	if (this->StackDepth <= 0)
-		Host_Error ("CProgsDat::LeaveFunction: prog stack underflow");
+	// one extra for the sentinel
+	this->Decoded = (prstatement_t *) ServerZone->Alloc ((numstatements + 1) * sizeof (prstatement_t), false);
 
-	// restore locals from the stack
-	c = this->XFunction->locals;
-	this->LocalStackUsed -= c;
+	for (int i = 0; i < numstatements; i++)
+	{
+		dstatement_t *st = &this->Statements[i];
+		prstatement_t *dst = &this->Decoded[i];
 
-	if (this->LocalStackUsed < 0)
-		this->RunError ("CProgsDat::LeaveFunction: locals stack underflow\n");
+		// same resolution as the old per-statement code so that any out-of-range operands behave as they did
+		dst->op = dst->base = st->op;
+		dst->jump = 0;
+		dst->a = (eval_t *) &this->Globals[st->a];
+		dst->b = (eval_t *) &this->Globals[st->b];
+		dst->c = (eval_t *) &this->Globals[st->c];
 
-	for (i = 0; i < c; i++)
-		((int *) this->Globals)[this->XFunction->parm_start + i] = this->LocalStack[this->LocalStackUsed + i];
+		if (st->op > OP_BITOR)
+		{
+			// errors when it's executed, not before
+			dst->op = dst->base = OPX_BADOP;
+			dst->jump = st->op;
+		}
+		else if (st->op == OP_IF || st->op == OP_IFNOT || st->op == OP_GOTO)
+		{
+			int target = i + (signed short) ((st->op == OP_GOTO) ? st->a : st->b);
 
-	// up stack
-	this->StackDepth--;
+			// a branch out of the statements goes to the sentinel
+			if (target < 0 || target > numstatements) target = numstatements;
 
-	this->XFunction = this->Stack[this->StackDepth].f;
-	return this->Stack[this->StackDepth].s;
+			dst->jump = target - 1;	// offset the st++
+		}
+	}
+
+	// falling off the end (or branching there) gives the same error as the old bounds check
+	this->Decoded[numstatements].op = this->Decoded[numstatements].base = OPX_OVERRUN;
+	this->Decoded[numstatements].jump = 0;
+	this->Decoded[numstatements].a = this->Decoded[numstatements].b = this->Decoded[numstatements].c = (eval_t *) this->Globals;
 }
 
 
-void CProgsDat::PrintStatement (dstatement_t *s)
+static int PR_FusedBranch (int op, int branch)
 {
-	if ((unsigned) s->op < STRUCT_ARRAY_LENGTH (pr_opnames))
-		Con_SafePrintf ("%-10s ", pr_opnames[s->op]);
-
-	if (s->op == OP_IF || s->op == OP_IFNOT)
-		Con_SafePrintf ("%sbranch %i", PR_GlobalString ((unsigned short) s->a), s->b);
-	else if (s->op == OP_GOTO)
-		Con_SafePrintf ("branch %i", s->a);
-	else if ((unsigned) (s->op - OP_STORE_F) < 6)
+	static const int compares[][2] =
 	{
-		Con_SafePrintf ("%s", PR_GlobalString ((unsigned short) s->a));
-		Con_SafePrintf ("%s", PR_GlobalStringNoContents ((unsigned short) s->b));
-	}
-	else
+		{OP_EQ_F, OPX_EQ_F_IF}, {OP_NE_F, OPX_NE_F_IF}, {OP_LT, OPX_LT_IF}, {OP_GT, OPX_GT_IF},
+		{OP_LE, OPX_LE_IF}, {OP_GE, OPX_GE_IF}, {OP_EQ_E, OPX_EQ_E_IF}, {OP_NE_E, OPX_NE_E_IF},
+		{OP_EQ_S, OPX_EQ_S_IF}, {OP_NE_S, OPX_NE_S_IF}, {OP_NOT_F, OPX_NOT_F_IF}, {OP_NOT_ENT, OPX_NOT_ENT_IF}
+	};
+
+	for (int i = 0; i < STRUCT_ARRAY_LENGTH (compares); i++)
 	{
-		if (s->a) Con_SafePrintf ("%s", PR_GlobalString ((unsigned short) s->a));
-		if (s->b) Con_SafePrintf ("%s", PR_GlobalString ((unsigned short) s->b));
-		if (s->c) Con_SafePrintf ("%s", PR_GlobalStringNoContents ((unsigned short) s->c));
+		// the IFNOT variant always follows the IF variant
+		if (compares[i][0] == op)
+			return compares[i][1] + (branch == OP_IFNOT ? 1 : 0);
 	}
 
-	Con_SafePrintf ("\n");
+	return 0;
 }
 
 
-void CProgsDat::RunError (char *error, ...)
+static bool PR_IsScalarStore (int op)
 {
-	va_list		argptr;
-	char		string[1024];
+	return (op == OP_STORE_F || op == OP_STORE_ENT || op == OP_STORE_FLD || op == OP_STORE_S || op == OP_STORE_FNC);
+}
 
-	va_start (argptr, error);
-	_vsnprintf (string, 1024, error, argptr);
-	va_end (argptr);
 
-	this->PrintStatement (this->Statements + this->XStatement);
-	this->StackTrace ();
-	Con_Printf ("%s\n", string);
+static bool PR_IsScalarStoreP (int op)
+{
+	return (op == OP_STOREP_F || op == OP_STOREP_ENT || op == OP_STOREP_FLD || op == OP_STOREP_S || op == OP_STOREP_FNC);
+}
 
-	// dump the stack so host_error can shutdown functions
-	this->StackDepth = 0;
 
-	QC_DebugOutput ("CProgsDat::RunError: %s", string);
-	Host_Error ("Program error");
+static bool PR_IsScalarLoad (int op)
+{
+	return (op == OP_LOAD_F || op == OP_LOAD_FLD || op == OP_LOAD_ENT || op == OP_LOAD_S || op == OP_LOAD_FNC);
+}
+
+
+void CProgsDat::FuseStatements (void)
+{
+	// look for pairs where the second statement consumes what the first one produced.  there's no need to check
+	// for branches into the second statement because it keeps it's own op; only the first becomes fused.
+	int numfused = 0;
+
+	for (int i = 0; i < this->QC->numstatements - 1; i++)
+	{
+		dstatement_t *st = &this->Statements[i];
+		dstatement_t *next = st + 1;
+		prstatement_t *dst = &this->Decoded[i];
+		int fused = 0;
+
+		// every pattern gets a look until one of them fuses; a pair that gets past the first part of a test
+		// but isn't fusable by it (e.g. a branch on something PR_FusedBranch doesn't handle) must fall through
+		if ((next->op == OP_IF || next->op == OP_IFNOT) && next->a == st->c)
+			fused = PR_FusedBranch (st->op, next->op);
+
+		if (!fused && st->op == OP_ADDRESS && PR_IsScalarStoreP (next->op) && next->b == st->c)
+			fused = OPX_ADDRESS_STOREP;
+
+		if (!fused && st->op == OP_ADDRESS && next->op == OP_STOREP_V && next->b == st->c)
+			fused = OPX_ADDRESS_STOREP_V;
+
+		if (!fused && st->op == OP_LOAD_ENT && PR_IsScalarLoad (next->op) && next->a == st->c)
+			fused = OPX_LOAD_ENT_LOAD;
+
+		if (!fused && st->op == OP_LOAD_ENT && next->op == OP_LOAD_V && next->a == st->c)
+			fused = OPX_LOAD_ENT_LOAD_V;
+
+		if (!fused && PR_IsScalarStore (st->op) && PR_IsScalarStore (next->op))
+			fused = OPX_STORE_STORE;
+
+		if (!fused && st->op == OP_STORE_V && next->op == OP_STORE_V)
+			fused = OPX_STORE_V_STORE_V;
+
+		if (fused)
+		{
+			dst->op = fused;
+			numfused++;
+		}
+	}
+
+	Con_DPrintf ("%i of %i statements fused\n", numfused, this->QC->numstatements);
+}
+
+
+void CProgsDat::ExecuteLegacy (int s, int exitdepth)
+{
+	// the original interpreter; kept as the reference for pr_benchmark and selectable with pr_interpreter 0
+	eval_t		*a, *b, *c;
+	dstatement_t	*st;
+	dfunction_t	*newf;
+	int		runaway = 5000000;
+	int		i;
+	edict_t		*ed = NULL;
+	eval_t		*ptr;
+
+	while (1)
+	{
+		s++;	// next statement
+
+		if (s >= this->QC->numstatements) Host_Error ("CProgsDat::ExecuteProgram: s >= this->QC->numstatements");
+
+		this->XStatement = s;
+		this->XFunction->profile++;
+
+		st = &this->Statements[s];
+		a = (eval_t *) &this->Globals[(unsigned short) st->a];
+		b = (eval_t *) &this->Globals[(unsigned short) st->b];
+		c = (eval_t *) &this->Globals[(unsigned short) st->c];
+
+		if (!--runaway) this->RunError ("runaway loop error %d");
+
+		if (this->Trace) this->PrintStatement (st);
+
+		switch (st->op)
+		{
+		case OP_ADD_F:
+			c->_float = a->_float + b->_float;
+			break;
+		case OP_ADD_V:
+			c->vector[0] = a->vector[0] + b->vector[0];
+			c->vector[1] = a->vector[1] + b->vector[1];
+			c->vector[2] = a->vector[2] + b->vector[2];
+			break;
+
+		case OP_SUB_F:
+			c->_float = a->_float - b->_float;
+			break;
+		case OP_SUB_V:
+			c->vector[0] = a->vector[0] - b->vector[0];
+			c->vector[1] = a->vector[1] - b->vector[1];
+			c->vector[2] = a->vector[2] - b->vector[2];
+			break;
+
+		case OP_MUL_F:
+			c->_float = a->_float * b->_float;
+			break;
+		case OP_MUL_V:
+			c->_float = a->vector[0] * b->vector[0]
+						+ a->vector[1] * b->vector[1]
+						+ a->vector[2] * b->vector[2];
+			break;
+		case OP_MUL_FV:
+			c->vector[0] = a->_float * b->vector[0];
+			c->vector[1] = a->_float * b->vector[1];
+			c->vector[2] = a->_float * b->vector[2];
+			break;
+		case OP_MUL_VF:
+			c->vector[0] = b->_float * a->vector[0];
+			c->vector[1] = b->_float * a->vector[1];
+			c->vector[2] = b->_float * a->vector[2];
+			break;
+		case OP_DIV_F:
+			c->_float = a->_float / b->_float;
+			break;
+		case OP_BITAND:
+			c->_float = (int) a->_float & (int) b->_float;
+			break;
+		case OP_BITOR:
+			c->_float = (int) a->_float | (int) b->_float;
+			break;
+		case OP_GE:
+			c->_float = a->_float >= b->_float;
+			break;
+		case OP_LE:
+			c->_float = a->_float <= b->_float;
+			break;
+		case OP_GT:
+			c->_float = a->_float > b->_float;
+			break;
+		case OP_LT:
+			c->_float = a->_float < b->_float;
+			break;
+		case OP_AND:
+			c->_float = a->_float && b->_float;
+			break;
+		case OP_OR:
+			c->_float = a->_float || b->_float;
+			break;
+		case OP_NOT_F:
+			c->_float = !a->_float;
+			break;
+		case OP_NOT_V:
+			c->_float = !a->vector[0] && !a->vector[1] && !a->vector[2];
+			break;
+		case OP_NOT_S:
+			c->_float = !a->string || !(SVProgs->GetString (a->string))[0];
+			break;
+		case OP_NOT_FNC:
+			c->_float = !a->function;
+			break;
+		case OP_NOT_ENT:
+			c->_float = (PROG_TO_EDICT (a->edict) == this->EdictPointers[0]);
+			break;
+		case OP_EQ_F:
+			c->_float = a->_float == b->_float;
+			break;
+		case OP_EQ_V:
+			c->_float = (a->vector[0] == b->vector[0]) &&
+						(a->vector[1] == b->vector[1]) &&
+						(a->vector[2] == b->vector[2]);
+			break;
+		case OP_EQ_S:
+			c->_float = !strcmp (SVProgs->GetString (a->string), SVProgs->GetString (b->string));
+			break;
+		case OP_EQ_E:
+			c->_float = a->_int == b->_int;
+			break;
+		case OP_EQ_FNC:
+			c->_float = a->function == b->function;
+			break;
+		case OP_NE_F:
+			c->_float = a->_float != b->_float;
+			break;
+		case OP_NE_V:
+			c->_float = (a->vector[0] != b->vector[0]) ||
+						(a->vector[1] != b->vector[1]) ||
+						(a->vector[2] != b->vector[2]);
+			break;
+		case OP_NE_S:
+			c->_float = strcmp (SVProgs->GetString (a->string), SVProgs->GetString (b->string));
+			break;
+		case OP_NE_E:
+			c->_float = a->_int != b->_int;
+			break;
+		case OP_NE_FNC:
+			c->_float = a->function != b->function;
+			break;
+
+			//==================
+		case OP_STORE_F:
+		case OP_STORE_ENT:
+		case OP_STORE_FLD:		// integers
+		case OP_STORE_S:
+		case OP_STORE_FNC:		// pointers
+			b->_int = a->_int;
+			break;
+		case OP_STORE_V:
+			b->vector[0] = a->vector[0];
+			b->vector[1] = a->vector[1];
+			b->vector[2] = a->vector[2];
+			break;
+
+		case OP_STOREP_F:
+		case OP_STOREP_ENT:
+		case OP_STOREP_FLD:		// integers
+		case OP_STOREP_FNC:		// pointers
+			//ptr = (eval_t *)((byte *)this->Edicts + b->_int);
+			ptr = (eval_t *) ((byte *) this->EdictPointers[b->_int / this->EdictSize] + (b->_int % this->EdictSize));
+			ptr->_int = a->_int;
+			break;
+		case OP_STOREP_S:
+			ptr = (eval_t *) ((byte *) this->EdictPointers[b->_int / this->EdictSize] + (b->_int % this->EdictSize));
+			ptr->_int = a->_int;
+
+			if (pr_numfindindexes) PR_FindIndexStore (b->_int);
+
+			break;
+		case OP_STOREP_V:
+			//ptr = (eval_t *)((byte *)this->Edicts + b->_int);
+			ptr = (eval_t *) ((byte *) this->EdictPointers[b->_int / this->EdictSize] + (b->_int % this->EdictSize));
+			ptr->vector[0] = a->vector[0];
+			ptr->vector[1] = a->vector[1];
+			ptr->vector[2] = a->vector[2];
+			break;
+
+		case OP_ADDRESS:
+			ed = PROG_TO_EDICT (a->edict);
+
+			if (ed == (edict_t *) this->EdictPointers[0] && sv.state == ss_active)
+				this->RunError ("CProgsDat::ExecuteProgram: assignment to world entity");
+
+			// c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)this->Edicts;
+			// beautiful, isn't it?  i much check the QCC source and see if the number here actually matters
+			// or can i just store the edict number and the offset in a short[2] member of the eval_t instead.
+			c->_int = (int) ((int *) ((byte *) &ed->v - (byte *) ed) + b->_int) + ed->Prog;
+			break;
+
+		case OP_LOAD_F:
+		case OP_LOAD_FLD:
+		case OP_LOAD_ENT:
+		case OP_LOAD_S:
+		case OP_LOAD_FNC:
+			ed = PROG_TO_EDICT (a->edict);
+
+			a = (eval_t *) ((int *) &ed->v + b->_int);
+			c->_int = a->_int;
+			break;
+
+		case OP_LOAD_V:
+			ed = PROG_TO_EDICT (a->edict);
+
+			a = (eval_t *) ((int *) &ed->v + b->_int);
+			c->vector[0] = a->vector[0];
+			c->vector[1] = a->vector[1];
+			c->vector[2] = a->vector[2];
+			break;
+
+			//==================
+
+		case OP_IFNOT:
+
+			if (!a->_int)
+				s += (signed short) st->b - 1;	// offset the s++
+
+			break;
+
+		case OP_IF:
+
+			if (a->_int)
+				s += (signed short) st->b - 1;	// offset the s++
+
+			break;
+
+		case OP_GOTO:
+			s += (signed short) st->a - 1;	// offset the s++
+			break;
+
+		case OP_CALL0:
+		case OP_CALL1:
+		case OP_CALL2:
+		case OP_CALL3:
+		case OP_CALL4:
+		case OP_CALL5:
+		case OP_CALL6:
+		case OP_CALL7:
+		case OP_CALL8:
+			this->Argc = st->op - OP_CALL0;
+
+			if (!a->function)
+			{
+				if ((st - 1)->op == OP_LOAD_FNC) // OK?
+					ED_Print (ed); // Print owner edict, if any
+				else if (this->GlobalStruct->self)
+					ED_Print (PROG_TO_EDICT (this->GlobalStruct->self));
+
+				this->RunError ("PR_ExecuteProgram2: NULL function");
+			}
+
+			newf = &this->Functions[a->function];
+
+			if (newf->first_statement < 0)
+			{
+				// negative statements are built in functions
+				i = -newf->first_statement;
+
+				if (i >= pr_numbuiltins)
+					this->RunError ("CProgsDat::ExecuteProgram: bad builtin call number (%d, max = %d)", i, pr_numbuiltins);
+
+				pr_builtins[i] ();
+				break;
+			}
+
+			s = this->EnterFunction (newf);
+			break;
+
+		case OP_DONE:
+		case OP_RETURN:
+			this->Globals[OFS_RETURN] = this->Globals[(unsigned short) st->a];
+			this->Globals[OFS_RETURN+1] = this->Globals[(unsigned short) st->a+1];
+			this->Globals[OFS_RETURN+2] = this->Globals[(unsigned short) st->a+2];
+
+			s = this->LeaveFunction ();
+
+			if (this->StackDepth == exitdepth)
+			{
+				return;		// all done
+			}
+
+			break;
+
+		case OP_STATE:
+			ed = PROG_TO_EDICT (this->GlobalStruct->self);
+			ed->v.nextthink = this->GlobalStruct->time + 0.1;
+
+			if (a->_float != ed->v.frame)
+				ed->v.frame = a->_float;
+
+			ed->v.think = b->function;
+			break;
+
+		default:
+			this->RunError ("CProgsDat::ExecuteProgram: bad opcode %i", st->op);
+		}
+	}
+}
+
+
+
+
+int CProgsDat::EnterFunction (dfunction_t *f)
+{
+	int i, j, c, o;
+
+	this->Stack[this->StackDepth].s = this->XStatement;
+	this->Stack[this->StackDepth].f = this->XFunction;
+	this->StackDepth++;
+
+	if (this->StackDepth >= MAX_STACK_DEPTH) this->RunError ("CProgsDat::EnterFunction: stack overflow (%d, max = %d)", this->StackDepth, MAX_STACK_DEPTH - 1);
+
+	// save off any locals that the new function steps on
+	c = f->locals;
+
+	if (this->LocalStackUsed + c > LOCALSTACK_SIZE)
+		this->RunError ("CProgsDat::EnterFunction: locals stack overflow (%d, max = %d)", this->LocalStackUsed + c, LOCALSTACK_SIZE);
+
+	for (i = 0; i < c; i++)
+		this->LocalStack[this->LocalStackUsed + i] = ((int *) this->Globals)[f->parm_start + i];
+
+	this->LocalStackUsed += c;
+
+	// copy parameters
+	o = f->parm_start;
+
+	for (i = 0; i < f->numparms; i++)
+	{
+		for (j = 0; j < f->parm_size[i]; j++)
+		{
+			((int *) this->Globals)[o] = ((int *) this->Globals)[OFS_PARM0 + i * 3 + j];
+			o++;
+		}
+	}
+
+	this->XFunction = f;
+
+	if (this->Timing) PR_ProfilePush (f - this->Functions);
+
+	return f->first_statement - 1;	// offset the s++
+}
+
+
+int CProgsDat::LeaveFunction (void)
+{
+	int		i, c;
+
+	if (this->StackDepth <= 0)
+		Host_Error ("CProgsDat::LeaveFunction: prog stack underflow");
+
+	// restore locals from the stack
+	c = this->XFunction->locals;
+	this->LocalStackUsed -= c;
+
+	if (this->LocalStackUsed < 0)
+		this->RunError ("CProgsDat::LeaveFunction: locals stack underflow\n");
+
+	for (i = 0; i < c; i++)
+		((int *) this->Globals)[this->XFunction->parm_start + i] = this->LocalStack[this->LocalStackUsed + i];
+
+	if (this->Timing) PR_ProfilePop ();
+
+	// up stack
+	this->StackDepth--;
+
+	this->XFunction = this->Stack[this->StackDepth].f;
+	return this->Stack[this->StackDepth].s;
+}
+
+
+void CProgsDat::PrintStatement (dstatement_t *s)
+{
+	if ((unsigned) s->op < STRUCT_ARRAY_LENGTH (pr_opnames))
+		Con_SafePrintf ("%-10s ", pr_opnames[s->op]);
+
+	if (s->op == OP_IF || s->op == OP_IFNOT)
+		Con_SafePrintf ("%sbranch %i", PR_GlobalString ((unsigned short) s->a), s->b);
+	else if (s->op == OP_GOTO)
+		Con_SafePrintf ("branch %i", s->a);
+	else if ((unsigned) (s->op - OP_STORE_F) < 6)
+	{
+		Con_SafePrintf ("%s", PR_GlobalString ((unsigned short) s->a));
+		Con_SafePrintf ("%s", PR_GlobalStringNoContents ((unsigned short) s->b));
+	}
+	else
+	{
+		if (s->a) Con_SafePrintf ("%s", PR_GlobalString ((unsigned short) s->a));
+		if (s->b) Con_SafePrintf ("%s", PR_GlobalString ((unsigned short) s->b));
+		if (s->c) Con_SafePrintf ("%s", PR_GlobalStringNoContents ((unsigned short) s->c));
+	}
+
+	Con_SafePrintf ("\n");
+}
+
+
+void CProgsDat::RunError (char *error, ...)
+{
+	va_list		argptr;
+	char		string[1024];
+
+	va_start (argptr, error);
+	_vsnprintf (string, 1024, error, argptr);
+	va_end (argptr);
+
+	this->PrintStatement (this->Statements + this->XStatement);
+	this->StackTrace ();
+	Con_Printf ("%s\n", string);
+
+	// dump the stack so host_error can shutdown functions
+	this->StackDepth = 0;
+
+	QC_DebugOutput ("CProgsDat::RunError: %s", string);
+	Host_Error ("Program error");
+}
+
+
+void CProgsDat::Profile (void)
+{
+	dfunction_t	*f, *best;
+	int			max;
+	int			num;
+	int			i;
+
+	num = 0;
+
+	do
+	{
+		max = 0;
+		best = NULL;
+
+		for (i = 0; i < this->QC->numfunctions; i++)
+		{
+			f = &this->Functions[i];
+
+			if (f->profile > max)
+			{
+				max = f->profile;
+				best = f;
+			}
+		}
+
+		if (best)
+		{
+			if (num < 10)
+				Con_Printf ("%7i %s\n", best->profile, SVProgs->GetString (best->s_name));
+
+			num++;
+			best->profile = 0;
+		}
+	} while (best);
+}
+
+
+void CProgsDat::StackTrace (void)
+{
+	dfunction_t	*f;
+	int			i;
+
+	if (this->StackDepth == 0)
+	{
+		Con_Printf ("<NO STACK>\n");
+		return;
+	}
+
+	if (this->StackDepth > MAX_STACK_DEPTH) this->StackDepth = MAX_STACK_DEPTH;
+
+	this->Stack[this->StackDepth].s = this->XStatement;
+	this->Stack[this->StackDepth].f = this->XFunction;
+
+	for (i = this->StackDepth; i >= 0; i--)
+	{
+		f = this->Stack[i].f;
+
+		if (f)
+		{
+			Con_Printf
+			(
+				"%12s : %s statement %i\n",
+				SVProgs->GetString (f->s_file),
+				SVProgs->GetString (f->s_name),
+				this->Stack[i].s - f->first_statement
+			);
+		}
+		else Con_Printf ("<NO FUNCTION>\n");
+	}
+}
+
+
+// =====================================================================================================================
+// STRINGS
+
+#define	PR_STRING_ALLOCSLOTS	256
+#define	PR_STRING_ARENASIZE		0x10000
+
+static bool pr_keepzonestrings = false;
+
+void CProgsDat::AllocStringSlots (void)
+{
+	int oldmax = this->MaxKnownStrings;
+
+	// double each time so that a mod that makes a lot of strings doesn't spend it's time copying
+	if (this->MaxKnownStrings)
+		this->MaxKnownStrings *= 2;
+	else this->MaxKnownStrings = PR_STRING_ALLOCSLOTS;
+
+	Con_DPrintf ("PR_AllocStringSlots: realloc'ing for %d slots\n", this->MaxKnownStrings);
+
+	char **newstrings = (char **) ServerZone->Alloc (this->MaxKnownStrings * sizeof (char *));
+	byte *newtypes = (byte *) ServerZone->Alloc (this->MaxKnownStrings * sizeof (byte));
+
+	if (this->KnownStrings)
+	{
+		memcpy (newstrings, this->KnownStrings, oldmax * sizeof (char *));
+		memcpy (newtypes, this->StringTypes, oldmax * sizeof (byte));
+
+		ServerZone->Free (this->KnownStrings);
+		ServerZone->Free (this->StringTypes);
+		ServerZone->Free (this->StringNext);
+		ServerZone->Free (this->StringHash);
+	}
+
+	this->KnownStrings = newstrings;
+	this->StringTypes = newtypes;
+
+	// the hash has as many buckets as there are slots (always a power of 2)
+	this->StringNext = (int *) ServerZone->Alloc (this->MaxKnownStrings * sizeof (int), false);
+	this->StringHash = (int *) ServerZone->Alloc (this->MaxKnownStrings * sizeof (int), false);
+	this->StringHashMask = this->MaxKnownStrings - 1;
+
+	this->RebuildStrings ();
+}
+
+
+void CProgsDat::RebuildStrings (void)
+{
+	// rebuild the free list and the hash from the slots; the free list comes out lowest slot first
+	memset (this->StringHash, 0, this->MaxKnownStrings * sizeof (int));
+
+	this->FreeStrings = -1;
+	this->NumKnownStrings = 0;
+	this->LiveStrings = 0;
+	this->LiveStringBytes = 0;
+
+	for (int i = this->MaxKnownStrings - 1; i >= 0; i--)
+	{
+		if (this->StringTypes[i] == PRSTR_FREE)
+		{
+			this->KnownStrings[i] = NULL;
+			this->StringNext[i] = this->FreeStrings;
+			this->FreeStrings = i;
+			continue;
+		}
+
+		if (!this->NumKnownStrings) this->NumKnownStrings = i + 1;
+
+		this->HashString (i);
+		this->LiveStrings++;
+
+		if (this->StringTypes[i] == PRSTR_ZONE || this->StringTypes[i] == PRSTR_ARENA)
+			this->LiveStringBytes += strlen (this->KnownStrings[i]) + 1;
+	}
+}
+
+
+/*
+===================================================================================================================
+
+		DEF AND FUNCTION LOOKUPS
+
+	ED_FindField, ED_FindGlobal and ED_FindFunction used to walk every def comparing names, and ED_FieldAtOfs and
+	ED_GlobalAtOfs every def comparing offsets.  that's a lot of strcmps for each key of each entity on an entity
+	dense map, so they now go through tables built once per progs.  the first item with a given name or ofs is
+	the one that goes in, which is what the linear scans returned.
+
+===================================================================================================================
+*/
+
+static inline char *PR_LookupName (CProgsDat *progs, prlookup_t *lookup, int item)
+{
+	return progs->GetString (*(int *) (lookup->items + item * lookup->stride + lookup->nameofs));
+}
+
+
+void CProgsDat::BuildLookup (prlookup_t *lookup, void *items, int count, int stride, int nameofs, bool offsets)
+{
+	lookup->items = (byte *) items;
+	lookup->stride = stride;
+	lookup->nameofs = nameofs;
+	lookup->count = count;
+
+	// at least twice as many buckets as items keeps the probes short
+	int numbuckets;
+
+	for (numbuckets = 16; numbuckets < count * 2; numbuckets <<= 1);
+
+	lookup->names = (int *) ServerZone->Alloc (numbuckets * sizeof (int));
+	lookup->namemask = numbuckets - 1;
+
+	for (int i = 0; i < count; i++)
+	{
+		char *name = PR_LookupName (this, lookup, i);
+
+		for (int b = COM_HashString (name) & lookup->namemask;; b = (b + 1) & lookup->namemask)
+		{
+			if (!lookup->names[b])
+			{
+				lookup->names[b] = i + 1;
+				break;
+			}
+
+			// a later def with the same name (there are lots of IMMEDIATEs) is never found by name
+			if (!strcmp (PR_LookupName (this, lookup, lookup->names[b] - 1), name)) break;
+		}
+	}
+
+	lookup->offsets = NULL;
+	lookup->numoffsets = 0;
+
+	if (!offsets) return;
+
+	// the defs are all ddef_t when we want offsets
+	for (int i = 0; i < count; i++)
+	{
+		ddef_t *def = (ddef_t *) (lookup->items + i * stride);
+
+		if (def->ofs >= lookup->numoffsets)
+			lookup->numoffsets = def->ofs + 1;
+	}
+
+	if (!lookup->numoffsets) return;
+
+	lookup->offsets = (int *) ServerZone->Alloc (lookup->numoffsets * sizeof (int));
+
+	for (int i = 0; i < count; i++)
+	{
+		ddef_t *def = (ddef_t *) (lookup->items + i * stride);
+
+		if (!lookup->offsets[def->ofs])
+			lookup->offsets[def->ofs] = i + 1;
+	}
+}
+
+
+int CProgsDat::FindName (prlookup_t *lookup, char *name)
+{
+	// item number or -1
+	if (!lookup->names) return -1;
+
+	for (int b = COM_HashString (name) & lookup->namemask;; b = (b + 1) & lookup->namemask)
+	{
+		if (!lookup->names[b]) return -1;
+		if (!strcmp (PR_LookupName (this, lookup, lookup->names[b] - 1), name)) return lookup->names[b] - 1;
+	}
+}
+
+
+int CProgsDat::FindOfs (prlookup_t *lookup, int ofs)
+{
+	// item number or -1
+	if (ofs < 0 || ofs >= lookup->numoffsets) return -1;
+
+	return lookup->offsets[ofs] - 1;
+}
+
+
+static inline int PR_HashPointer (char *s)
+{
+	// the low bits of a heap pointer are mostly alignment
+	return (int) (((uintptr_t) s >> 3) * 2654435761u);
+}
+
+
+void CProgsDat::HashString (int slot)
+{
+	int bucket = PR_HashPointer (this->KnownStrings[slot]) & this->StringHashMask;
+
+	this->StringNext[slot] = this->StringHash[bucket] - 1;
+	this->StringHash[bucket] = slot + 1;
+}
+
+
+int CProgsDat::FindStringSlot (char *s)
+{
+	// nothing allocated yet
+	if (!this->StringHash) return -1;
+
+	for (int i = this->StringHash[PR_HashPointer (s) & this->StringHashMask] - 1; i >= 0; i = this->StringNext[i])
+		if (this->KnownStrings[i] == s)
+			return i;
+
+	return -1;
+}
+
+
+int CProgsDat::NewStringSlot (char *s, int type, int size)
+{
+	if (this->FreeStrings < 0)
+		this->AllocStringSlots ();
+
+	int i = this->FreeStrings;
+
+	this->FreeStrings = this->StringNext[i];
+
+	this->KnownStrings[i] = s;
+	this->StringTypes[i] = type;
+	this->HashString (i);
+
+	if (i >= this->NumKnownStrings) this->NumKnownStrings = i + 1;
+
+	this->LiveStrings++;
+
+	// strings we don't own don't count
+	this->LiveStringBytes += size;
+
+	return -1 - i;
+}
+
+
+int CProgsDat::AllocString (int size, char **ptr)
+{
+	char *str;
+
+	if (!size)
+		return 0;
+
+	if (size > PR_STRING_ARENASIZE / 4)
+	{
+		// big strings get their own allocation so that they don't waste the rest of a block
+		str = (char *) ServerZone->Alloc (size);
+	}
+	else
+	{
+		if (this->StringArenaUsed + size > this->StringArenaSize)
+		{
+			// the rest of the old block is lost; strings in the arena live until the map changes anyway
+			this->StringArena = (byte *) ServerZone->Alloc (PR_STRING_ARENASIZE);
+			this->StringArenaSize = PR_STRING_ARENASIZE;
+			this->StringArenaUsed = 0;
+		}
+
+		str = (char *) (this->StringArena + this->StringArenaUsed);
+		this->StringArenaUsed += size;
+	}
+
+	if (ptr)
+		*ptr = str;
+
+	return this->NewStringSlot (str, PRSTR_ARENA, size);
+}
+
+
+int CProgsDat::ZoneString (char *s)
+{
+	int size = strlen (s) + 1;
+	char *str = (char *) ServerZone->Alloc (size, false);
+
+	memcpy (str, s, size);
+
+	return this->NewStringSlot (str, PRSTR_ZONE, size);
+}
+
+
+void CProgsDat::FreeString (int num)
+{
+	int i = -1 - num;
+
+	// only strings from ZoneString can be freed; anything else is left alone
+	if (num >= 0 || i >= this->NumKnownStrings) return;
+	if (this->StringTypes[i] != PRSTR_ZONE) return;
+
+	// unlink it from it's hash chain; the bucket holds slot + 1 but the chain links hold the slot
+	int bucket = PR_HashPointer (this->KnownStrings[i]) & this->StringHashMask;
+
+	if (this->StringHash[bucket] - 1 == i)
+		this->StringHash[bucket] = this->StringNext[i] + 1;
+	else
+	{
+		for (int j = this->StringHash[bucket] - 1; j >= 0; j = this->StringNext[j])
+		{
+			if (this->StringNext[j] == i)
+			{
+				this->StringNext[j] = this->StringNext[i];
+				break;
+			}
+		}
+	}
+
+	this->LiveStringBytes -= strlen (this->KnownStrings[i]) + 1;
+	this->LiveStrings--;
+
+	// pr_benchmark puts back slots that may have been freed during a run so it needs the memory to stay valid
+	if (!pr_keepzonestrings) ServerZone->Free (this->KnownStrings[i]);
+
+	this->KnownStrings[i] = NULL;
+	this->StringTypes[i] = PRSTR_FREE;
+	this->StringNext[i] = this->FreeStrings;
+	this->FreeStrings = i;
+}
+
+
+char *CProgsDat::GetString (int num)
+{
+	if (num >= 0 && num < this->StringSize)
+		return this->Strings + num;
+	else if (num < 0 && num >= -this->NumKnownStrings)
+	{
+		if (!this->KnownStrings[-1 - num])
+			return "";
+		else return this->KnownStrings[-1 - num];
+	}
+	else return "";
 }
 
 
-void CProgsDat::Profile (void)
+int CProgsDat::SetString (char *s)
 {
-	dfunction_t	*f, *best;
-	int			max;
-	int			num;
-	int			i;
+	if (!s) return 0;
 
-	num = 0;
+	if (s >= this->Strings && s <= this->Strings + this->StringSize - 2)
+		return (int) (s - this->Strings);
 
-	do
-	{
-		max = 0;
-		best = NULL;
+	// the same pointer always gets the same number back
+	int i = this->FindStringSlot (s);
 
-		for (i = 0; i < this->QC->numfunctions; i++)
-		{
-			f = &this->Functions[i];
+	if (i >= 0)
+		return -1 - i;
 
-			if (f->profile > max)
-			{
-				max = f->profile;
-				best = f;
-			}
-		}
+	return this->NewStringSlot (s, PRSTR_EXTERNAL, 0);
+}
 
-		if (best)
-		{
-			if (num < 10)
-				Con_Printf ("%7i %s\n", best->profile, SVProgs->GetString (best->s_name));
 
-			num++;
-			best->profile = 0;
-		}
-	} while (best);
+char *CProgsDat::TempString (void)
+{
+	// go to a new temp string, rotate the buffer if needed, and ensure that it's null termed
+	char *str = this->TempStrings[this->TempStringNum % PR_NUM_TEMP_STRINGS];
+
+	if (++this->TempStringNum > this->TempStringPeak) this->TempStringPeak = this->TempStringNum;
+
+	str[0] = 0;
+
+	return str;
 }
 
 
-void CProgsDat::StackTrace (void)
+void CProgsDat::ClearTempStrings (void)
 {
-	dfunction_t	*f;
-	int			i;
+	// temps from the last frame are fair game now
+	this->TempStringNum = 0;
+}
 
-	if (this->StackDepth == 0)
+
+void PR_Strings_f (void)
+{
+	if (!sv.active || !SVProgs)
 	{
-		Con_Printf ("<NO STACK>\n");
+		Con_Printf ("pr_strings : no server running\n");
 		return;
 	}
 
-	if (this->StackDepth > MAX_STACK_DEPTH) this->StackDepth = MAX_STACK_DEPTH;
-
-	this->Stack[this->StackDepth].s = this->XStatement;
-	this->Stack[this->StackDepth].f = this->XFunction;
+	int longest = 0;
 
-	for (i = this->StackDepth; i >= 0; i--)
+	for (int i = 0; i <= SVProgs->StringHashMask; i++)
 	{
-		f = this->Stack[i].f;
+		int len = 0;
 
-		if (f)
-		{
-			Con_Printf
-			(
-				"%12s : %s statement %i\n",
-				SVProgs->GetString (f->s_file),
-				SVProgs->GetString (f->s_name),
-				this->Stack[i].s - f->first_statement
-			);
-		}
-		else Con_Printf ("<NO FUNCTION>\n");
+		for (int j = SVProgs->StringHash[i] - 1; j >= 0; j = SVProgs->StringNext[j])
+			len++;
+
+		if (len > longest) longest = len;
 	}
+
+	Con_Printf ("%i live strings in %i slots (%i max)\n", SVProgs->LiveStrings, SVProgs->NumKnownStrings, SVProgs->MaxKnownStrings);
+	Con_Printf ("%i bytes in arena and zoned strings\n", SVProgs->LiveStringBytes);
+	Con_Printf ("%i temp strings peak per frame (%i in ring)\n", SVProgs->TempStringPeak, PR_NUM_TEMP_STRINGS);
+	Con_Printf ("longest hash chain %i\n", longest);
 }
 
 
-// =====================================================================================================================
-// STRINGS
+cmd_t PR_Strings_Cmd ("pr_strings", PR_Strings_f);
 
-#define	PR_STRING_ALLOCSLOTS	256
 
-void CProgsDat::AllocStringSlots (void)
+/*
+==============================================================================
+
+INTERPRETER BENCHMARK
+
+runs the same frames of server physics from the same starting state under each interpreter, times them and checks
+that they leave the progs in the same state.  the server is put back the way it was found afterwards.
+
+==============================================================================
+*/
+
+typedef struct prsnapshot_s
 {
-	int oldmax = this->MaxKnownStrings;
+	float *globals;
+	byte *edicts;
+	int numedicts;
+	int maxknownstrings;
+	char **knownstrings;
+	byte *stringtypes;
+	int tempstringnum;
+	server_t *sv;
+	int *msgsize;
+	byte **msgdata;
+} prsnapshot_t;
+
+
+static void PR_SnapshotSave (prsnapshot_t *snap, CScratchMark &mark)
+{
+	snap->globals = (float *) mark.Alloc (SVProgs->QC->numglobals * sizeof (float));
+	memcpy (snap->globals, SVProgs->Globals, SVProgs->QC->numglobals * sizeof (float));
 
-	this->MaxKnownStrings += PR_STRING_ALLOCSLOTS;
-	Con_DPrintf ("PR_AllocStringSlots: realloc'ing for %d slots\n", this->MaxKnownStrings);
+	snap->numedicts = SVProgs->NumEdicts;
+	snap->edicts = (byte *) mark.Alloc (snap->numedicts * SVProgs->EdictSize);
 
-	// don't abuse zone memory
-	if (this->KnownStrings)
+	for (int i = 0; i < snap->numedicts; i++)
+		memcpy (snap->edicts + i * SVProgs->EdictSize, SVProgs->EdictPointers[i], SVProgs->EdictSize);
+
+	snap->maxknownstrings = SVProgs->MaxKnownStrings;
+	snap->knownstrings = (char **) mark.Alloc (snap->maxknownstrings * sizeof (char *));
+	snap->stringtypes = (byte *) mark.Alloc (snap->maxknownstrings);
+	memcpy (snap->knownstrings, SVProgs->KnownStrings, snap->maxknownstrings * sizeof (char *));
+	memcpy (snap->stringtypes, SVProgs->StringTypes, snap->maxknownstrings);
+	snap->tempstringnum = SVProgs->TempStringNum;
+
+	snap->sv = (server_t *) mark.Alloc (sizeof (server_t));
+	memcpy (snap->sv, &sv, sizeof (server_t));
+
+	snap->msgsize = (int *) mark.Alloc (svs.maxclients * sizeof (int));
+	snap->msgdata = (byte **) mark.Alloc (svs.maxclients * sizeof (byte *));
+
+	for (int i = 0; i < svs.maxclients; i++)
 	{
-		char **tmpks = (char **) ServerZone->Alloc (this->MaxKnownStrings * sizeof (char *));
-		memset (tmpks, 0, this->MaxKnownStrings * sizeof (char *));
+		snap->msgsize[i] = svs.clients[i].message.cursize;
+		snap->msgdata[i] = NULL;
 
-		memcpy (tmpks, this->KnownStrings, oldmax * sizeof (char *));
+		if (!snap->msgsize[i]) continue;
 
-		ServerZone->Free (this->KnownStrings);
-		this->KnownStrings = tmpks;
+		snap->msgdata[i] = (byte *) mark.Alloc (snap->msgsize[i]);
+		memcpy (snap->msgdata[i], svs.clients[i].message.data, snap->msgsize[i]);
 	}
-	else
+}
+
+
+static void PR_SnapshotRestore (prsnapshot_t *snap)
+{
+	memcpy (SVProgs->Globals, snap->globals, SVProgs->QC->numglobals * sizeof (float));
+
+	// anything spawned since the snapshot goes away; the area links are stale either way
+	for (int i = snap->numedicts; i < SVProgs->NumEdicts; i++)
+	{
+		SVProgs->EdictPointers[i]->free = true;
+		SVProgs->EdictPointers[i]->area.prev = SVProgs->EdictPointers[i]->area.next = NULL;
+	}
+
+	for (int i = 0; i < snap->numedicts; i++)
+		memcpy (SVProgs->EdictPointers[i], snap->edicts + i * SVProgs->EdictSize, SVProgs->EdictSize);
+
+	SVProgs->NumEdicts = snap->numedicts;
+
+	// strings made since are leaked to the server zone until the map changes; the slots are put back the way they
+	// were and the free list rebuilt so that each run gets the same string numbers
+	memcpy (SVProgs->KnownStrings, snap->knownstrings, snap->maxknownstrings * sizeof (char *));
+	memcpy (SVProgs->StringTypes, snap->stringtypes, snap->maxknownstrings);
+	memset (SVProgs->StringTypes + snap->maxknownstrings, PRSTR_FREE, SVProgs->MaxKnownStrings - snap->maxknownstrings);
+
+	SVProgs->RebuildStrings ();
+	SVProgs->TempStringNum = snap->tempstringnum;
+
+	memcpy (&sv, snap->sv, sizeof (server_t));
+
+	for (int i = 0; i < svs.maxclients; i++)
+	{
+		svs.clients[i].message.cursize = snap->msgsize[i];
+
+		if (snap->msgdata[i]) memcpy (svs.clients[i].message.data, snap->msgdata[i], snap->msgsize[i]);
+	}
+
+	// rebuild the areanodes from what was linked at the time
+	SV_ClearWorld ();
+
+	for (int i = 0; i < snap->numedicts; i++)
 	{
-		this->KnownStrings = (char **) ServerZone->Alloc (this->MaxKnownStrings * sizeof (char *));
-		memset (this->KnownStrings, 0, this->MaxKnownStrings * sizeof (char *));
+		edict_t *ed = SVProgs->EdictPointers[i];
+		bool linked = (ed->area.prev != NULL);
+
+		ed->area.prev = ed->area.next = NULL;
+
+		// the big leaf buffer may have been refilled for a different box since
+		ed->leafboxvalid = false;
+
+		if (linked && !ed->free) SV_LinkEdict (ed, false);
+
+		// the fields were put back without find's index knowing
+		PR_FindIndexEdict (ed);
 	}
+
+	// and without ED_Alloc's free queue knowing
+	ED_RebuildFreeQueue ();
 }
 
 
-int CProgsDat::AllocString (int size, char **ptr)
+static bool PR_SnapshotCompare (prsnapshot_t *a, prsnapshot_t *b)
 {
-	int i;
+	int vofs = (byte *) &SVProgs->EdictPointers[0]->v - (byte *) SVProgs->EdictPointers[0];
 
-	if (!size)
-		return 0;
+	for (int i = 0; i < SVProgs->QC->numglobals; i++)
+	{
+		if (((int *) a->globals)[i] != ((int *) b->globals)[i])
+		{
+			ddef_t *def = ED_GlobalAtOfs (i);
+			Con_Printf ("global %s differs\n", def ? SVProgs->GetString (def->s_name) : va ("%i", i));
+			return false;
+		}
+	}
 
-	for (i = 0; i < this->NumKnownStrings; i++)
+	if (a->numedicts != b->numedicts)
 	{
-		if (!this->KnownStrings[i])
-			break;
+		Con_Printf ("edict count differs (%i, %i)\n", a->numedicts, b->numedicts);
+		return false;
 	}
 
-	if (i >= this->MaxKnownStrings)
-		this->AllocStringSlots ();
+	for (int i = 0; i < a->numedicts; i++)
+	{
+		edict_t *ea = (edict_t *) (a->edicts + i * SVProgs->EdictSize);
+		edict_t *eb = (edict_t *) (b->edicts + i * SVProgs->EdictSize);
 
-	this->NumKnownStrings++;
-	this->KnownStrings[i] = (char *) ServerZone->Alloc (size);
+		if (ea->free != eb->free)
+		{
+			Con_Printf ("edict %i free differs\n", i);
+			return false;
+		}
 
-	if (ptr)
-		*ptr = this->KnownStrings[i];
+		if (ea->free) continue;
 
-	return -1 - i;
+		int *fa = (int *) &ea->v;
+		int *fb = (int *) &eb->v;
+
+		for (int j = 0; j < (SVProgs->EdictSize - vofs) / 4; j++)
+		{
+			if (fa[j] != fb[j])
+			{
+				ddef_t *def = ED_FieldAtOfs (j);
+				Con_Printf ("edict %i field %s differs\n", i, def ? SVProgs->GetString (def->s_name) : va ("%i", j));
+				return false;
+			}
+		}
+	}
+
+	return true;
 }
 
 
-char *CProgsDat::GetString (int num)
+static double PR_BenchmarkRun (prsnapshot_t *start, int interpreter, bool parallel, int frames)
 {
-	if (num >= 0 && num < this->StringSize)
-		return this->Strings + num;
-	else if (num < 0 && num >= -this->NumKnownStrings)
+	extern cvar_t sv_parallelphysics;
+	int oldinterpreter = SVProgs->Interpreter;
+	float oldparallel = sv_parallelphysics.value;
+
+	PR_SnapshotRestore (start);
+	srand (1);
+
+	SVProgs->Interpreter = interpreter;
+	sv_parallelphysics.value = parallel ? 1 : 0;
+
+	double starttime = Sys_DoubleTime ();
+
+	for (int i = 0; i < frames; i++)
 	{
-		if (!this->KnownStrings[-1 - num])
-			return "";
-		else return this->KnownStrings[-1 - num];
+		SVProgs->GlobalStruct->frametime = sv_deltatime;
+		SV_ClearDatagram ();
+
+		for (int j = 0; j < svs.maxclients; j++)
+			svs.clients[j].message.cursize = 0;
+
+		SV_Physics (sv_deltatime);
 	}
-	else return "";
+
+	double endtime = Sys_DoubleTime ();
+
+	SVProgs->Interpreter = oldinterpreter;
+	sv_parallelphysics.value = oldparallel;
+
+	return endtime - starttime;
 }
 
 
-int CProgsDat::SetString (char *s)
+void PR_Benchmark_f (void)
 {
-	int		i;
+	if (!sv.active || !SVProgs)
+	{
+		Con_Printf ("pr_benchmark : no server running\n");
+		return;
+	}
 
-	if (!s) return 0;
+	int frames = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 500;
+
+	if (frames < 1) frames = 1;
+
+	CScratchMark mark;
+	prsnapshot_t start, legacy, decoded, fused, parallel;
+
+	PR_SnapshotSave (&start, mark);
+	pr_keepzonestrings = true;
+
+	double legacytime = PR_BenchmarkRun (&start, PR_INTERP_LEGACY, false, frames);
+	PR_SnapshotSave (&legacy, mark);
+
+	double decodedtime = PR_BenchmarkRun (&start, PR_INTERP_DECODED, false, frames);
+	PR_SnapshotSave (&decoded, mark);
+
+	double fusedtime = PR_BenchmarkRun (&start, PR_INTERP_FUSED, false, frames);
+	PR_SnapshotSave (&fused, mark);
+
+	// projectile physics on the worker threads
+	double paralleltime = PR_BenchmarkRun (&start, PR_INTERP_FUSED, true, frames);
+	PR_SnapshotSave (&parallel, mark);
+
+	// the legacy interpreter is the reference
+	bool decodedmatch = PR_SnapshotCompare (&legacy, &decoded);
+	bool fusedmatch = PR_SnapshotCompare (&legacy, &fused);
+	bool parallelmatch = PR_SnapshotCompare (&fused, &parallel);
+
+	Con_Printf ("%i frames of %i edicts\n", frames, start.numedicts);
+	Con_Printf ("legacy  : %8.3f ms\n", legacytime * 1000.0);
+
+	Con_Printf ("decoded : %8.3f ms (%0.2fx) %s\n", decodedtime * 1000.0, decodedtime > 0 ? legacytime / decodedtime : 0, decodedmatch ? "matches" : "DIFFERS");
+	Con_Printf ("fused   : %8.3f ms (%0.2fx) %s\n", fusedtime * 1000.0, fusedtime > 0 ? legacytime / fusedtime : 0, fusedmatch ? "matches" : "DIFFERS");
+	Con_Printf ("fused with parallel physics : %8.3f ms (%0.2fx) %s\n", paralleltime * 1000.0, paralleltime > 0 ? fusedtime / paralleltime : 0, parallelmatch ? "matches" : "DIFFERS");
+
+	PR_SnapshotRestore (&start);
+	pr_keepzonestrings = false;
+}
+
+
+cmd_t PR_Benchmark_Cmd ("pr_benchmark", PR_Benchmark_f);
+
+
+/*
+==============================================================================
+
+TIMING PROFILE REPORTS
+
+==============================================================================
+*/
+
+static char *PR_ProfileName (int func)
+{
+	if (func > 0) return SVProgs->GetString (SVProgs->Functions[func].s_name);
+	if (!func) return "server";
+
+	for (int i = 1; i < pr_ebfs_numbuiltins; i++)
+		if (pr_ebfs_builtins[i].funcno == -func)
+			return pr_ebfs_builtins[i].funcname;
+
+	return va ("builtin#%i", -func);
+}
+
+
+static double PR_ProfileTotals (int node)
+{
+	// fill in inclusive time for the subtree
+	prprofnode_t *n = &pr_profnodes[node];
+	double total = n->self;
+
+	for (int child = n->child; child >= 0; child = pr_profnodes[child].sibling)
+		total += PR_ProfileTotals (child);
+
+	return (pr_profnodes[node].total = total);
+}
 
-	if (s >= this->Strings && s <= this->Strings + this->StringSize - 2)
-		return (int) (s - this->Strings);
 
-	for (i = 0; i < this->NumKnownStrings; i++)
+typedef struct prprofsum_s
+{
+	int func;
+	int calls;
+	double inclusive;
+	double exclusive;
+	int onpath;		// recursion guard so that a recursive function's time isn't counted more than once
+} prprofsum_t;
+
+
+static void PR_ProfileSum (int node, prprofsum_t *sums)
+{
+	prprofnode_t *n = &pr_profnodes[node];
+	prprofsum_t *sum = &sums[n->func + pr_numbuiltins];
+
+	sum->func = n->func;
+	sum->calls += n->calls;
+	sum->exclusive += n->self;
+
+	if (!sum->onpath) sum->inclusive += n->total;
+
+	sum->onpath++;
+
+	for (int child = n->child; child >= 0; child = pr_profnodes[child].sibling)
+		PR_ProfileSum (child, sums);
+
+	sum->onpath--;
+}
+
+
+static int PR_ProfileSortFunc (const void *a, const void *b)
+{
+	double diff = ((prprofsum_t *) b)->inclusive - ((prprofsum_t *) a)->inclusive;
+
+	return (diff > 0) ? 1 : ((diff < 0) ? -1 : 0);
+}
+
+
+static void PR_ProfileReport (int count)
+{
+	// function numbers and negative builtin numbers both go in the one array
+	int numsums = pr_numbuiltins + SVProgs->QC->numfunctions;
+	CScratchMark mark;
+	prprofsum_t *sums = (prprofsum_t *) mark.Alloc (numsums * sizeof (prprofsum_t));
+
+	memset (sums, 0, numsums * sizeof (prprofsum_t));
+
+	double total = PR_ProfileTotals (0);
+
+	for (int child = pr_profnodes[0].child; child >= 0; child = pr_profnodes[child].sibling)
+		PR_ProfileSum (child, sums);
+
+	qsort (sums, numsums, sizeof (prprofsum_t), PR_ProfileSortFunc);
+
+	Con_Printf ("%0.3f ms in progs over %i contexts\n", total * 1000.0, (int) pr_profnodes.size () - 1);
+	Con_Printf ("   incl ms    excl ms    calls name\n");
+
+	for (int i = 0; i < numsums && count > 0; i++)
 	{
-		// replace an existing string
-		if (this->KnownStrings[i] == s)
-			return -1 - i;
+		if (!sums[i].calls) continue;
+
+		Con_Printf
+		(
+			"%10.3f %10.3f %8i %s%s\n",
+			sums[i].inclusive * 1000.0,
+			sums[i].exclusive * 1000.0,
+			sums[i].calls,
+			sums[i].func < 0 ? "#" : "",
+			PR_ProfileName (sums[i].func)
+		);
+
+		count--;
 	}
+}
 
-	if (i >= this->MaxKnownStrings)
-		this->AllocStringSlots ();
 
-	this->NumKnownStrings++;
-	this->KnownStrings[i] = s;
+static void PR_ProfileCollapsed (char *filename)
+{
+	FILE *f = fopen (va ("%s/%s", com_gamedir, filename), "w");
 
-	return -1 - i;
+	if (!f)
+	{
+		Con_Printf ("PR_ProfileCollapsed : couldn't open %s\n", filename);
+		return;
+	}
+
+	// one line per calling context in the "a;b;c microseconds" form that flame graph tools read
+	CScratchMark mark;
+	int *path = (int *) mark.Alloc (MAX_STACK_DEPTH * 2 * sizeof (int));
+	int lines = 0;
+
+	for (int i = 1; i < pr_profnodes.size (); i++)
+	{
+		int usec = (int) (pr_profnodes[i].self * 1000000.0);
+		int depth = 0;
+
+		if (usec < 1) continue;
+
+		for (int node = i; node > 0 && depth < MAX_STACK_DEPTH * 2; node = pr_profnodes[node].parent)
+			path[depth++] = pr_profnodes[node].func;
+
+		for (int j = depth - 1; j >= 0; j--)
+			fprintf (f, "%s%s%s", path[j] < 0 ? "#" : "", PR_ProfileName (path[j]), j ? ";" : "");
+
+		fprintf (f, " %i\n", usec);
+		lines++;
+	}
+
+	fclose (f);
+
+	Con_Printf ("wrote %i stacks to %s\n", lines, filename);
+}
+
+
+void PR_TimeProfile_f (void)
+{
+	if (!sv.active || !SVProgs)
+	{
+		Con_Printf ("pr_timeprofile : no server running\n");
+		return;
+	}
+
+	char *opt = (Cmd_Argc () > 1) ? Cmd_Argv (1) : "";
+
+	if (!_stricmp (opt, "start"))
+	{
+		PR_ProfileReset (true);
+		SVProgs->Timing = true;
+		Con_Printf ("timing profile started\n");
+	}
+	else if (!_stricmp (opt, "stop"))
+	{
+		SVProgs->Timing = false;
+		Con_Printf ("timing profile stopped\n");
+	}
+	else if (!_stricmp (opt, "report"))
+	{
+		if (pr_profnodes.empty ())
+			Con_Printf ("pr_timeprofile : nothing collected\n");
+		else PR_ProfileReport ((Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 20);
+	}
+	else if (!_stricmp (opt, "collapsed"))
+	{
+		if (Cmd_Argc () < 3)
+			Con_Printf ("pr_timeprofile collapsed <file>\n");
+		else if (pr_profnodes.empty ())
+			Con_Printf ("pr_timeprofile : nothing collected\n");
+		else PR_ProfileCollapsed (Cmd_Argv (2));
+	}
+	else
+	{
+		Con_Printf ("pr_timeprofile start : begin collecting wall-clock time per function and builtin\n");
+		Con_Printf ("pr_timeprofile stop : stop collecting\n");
+		Con_Printf ("pr_timeprofile report [count] : show the top functions and builtins by inclusive time\n");
+		Con_Printf ("pr_timeprofile collapsed <file> : write collapsed stacks for flame graph tools\n");
+	}
 }
 
+
+cmd_t PR_TimeProfile_Cmd ("pr_timeprofile", PR_TimeProfile_f);
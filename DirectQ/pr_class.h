@@ -22,17 +22,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef PR_CLASS_H
 #define PR_CLASS_H
 
-#define GEFV_CACHESIZE	16	// bumped for more cached values
-#define	MAX_FIELD_LEN	64
-
-typedef struct
-{
-	ddef_t	*pcache;
-	char	field[MAX_FIELD_LEN];
-} gefv_cache;
-
-extern gefv_cache gefvCache[];
-
 typedef struct prstack_s
 {
 	int s;
@@ -42,6 +31,86 @@ typedef struct prstack_s
 #define	MAX_STACK_DEPTH		2048
 #define	LOCALSTACK_SIZE		16384
 
+// internal opcodes used by the pre-decoded statements; these never appear in a progs.dat
+enum
+{
+	OPX_BADOP = OP_BITOR + 1,	// opcode that isn't valid; the original is kept in jump for the error message
+	OPX_OVERRUN,				// sentinel after the last statement
+
+	// superinstructions; each does the work of it's own statement and the one after it.  the statement after
+	// keeps it's own op so that a branch into the middle of a pair still runs correctly.
+	OPX_EQ_F_IF, OPX_EQ_F_IFNOT,
+	OPX_NE_F_IF, OPX_NE_F_IFNOT,
+	OPX_LT_IF, OPX_LT_IFNOT,
+	OPX_GT_IF, OPX_GT_IFNOT,
+	OPX_LE_IF, OPX_LE_IFNOT,
+	OPX_GE_IF, OPX_GE_IFNOT,
+	OPX_EQ_E_IF, OPX_EQ_E_IFNOT,
+	OPX_NE_E_IF, OPX_NE_E_IFNOT,
+	OPX_EQ_S_IF, OPX_EQ_S_IFNOT,
+	OPX_NE_S_IF, OPX_NE_S_IFNOT,
+	OPX_NOT_F_IF, OPX_NOT_F_IFNOT,
+	OPX_NOT_ENT_IF, OPX_NOT_ENT_IFNOT,
+	OPX_ADDRESS_STOREP,			// ADDRESS then STOREP_F/ENT/FLD/S/FNC through it
+	OPX_ADDRESS_STOREP_V,		// ADDRESS then STOREP_V through it
+	OPX_LOAD_ENT_LOAD,			// LOAD_ENT then LOAD_F/FLD/ENT/S/FNC from it
+	OPX_LOAD_ENT_LOAD_V,		// LOAD_ENT then LOAD_V from it
+	OPX_STORE_STORE,			// two scalar STOREs (usually parms being set up for a call)
+	OPX_STORE_V_STORE_V,		// two STORE_Vs
+
+	OPX_NUMOPS
+};
+
+// a statement with it's operands resolved to global pointers and it's branch target resolved, so that none of
+// this needs to be done while running.  built once in LoadProgs.
+typedef struct prstatement_s
+{
+	int op;			// may be a superinstruction
+	int base;		// op without fusion, for the plain and instrumented loops
+	int jump;		// statement before the branch target so that the st++ lands on it
+	eval_t *a;
+	eval_t *b;
+	eval_t *c;
+} prstatement_t;
+
+// dynamic string slot types
+#define PRSTR_FREE			0
+#define PRSTR_EXTERNAL		1	// memory belongs to someone else (SetString)
+#define PRSTR_ARENA			2	// in the string arena for the life of the map (AllocString)
+#define PRSTR_ZONE			3	// individually allocated and can be freed (strzone/strunzone)
+#define PRSTR_TEMP			4	// one of the temp string ring
+
+#define PR_MAX_TEMP_STRING		1024
+#define PR_NUM_TEMP_STRINGS		16
+
+// name and offset lookups over the field defs, global defs or functions; built once in LoadProgs
+typedef struct prlookup_s
+{
+	byte *items;		// the defs or functions themselves
+	int stride;
+	int nameofs;		// offset of s_name in each item
+	int count;
+
+	int *names;			// item + 1 in each bucket, open addressed; only the first item with a name goes in
+	int namemask;
+
+	int *offsets;		// item + 1 at each ofs, the first item with that ofs; NULL for functions
+	int numoffsets;
+} prlookup_t;
+
+// an edict in ED_Alloc's free queue; the freetime is kept so that an entry for an edict that was since
+// reused (or freed again) can be told apart from a live one
+typedef struct edictfree_s
+{
+	int ednum;
+	float freetime;
+} edictfree_t;
+
+// interpreter selection (pr_interpreter)
+#define PR_INTERP_LEGACY	0
+#define PR_INTERP_DECODED	1
+#define PR_INTERP_FUSED		2
+
 
 class CProgsDat
 {
@@ -53,6 +122,7 @@ public:
 	ddef_t			*FieldDefs;
 	ddef_t			*GlobalDefs;
 	dstatement_t	*Statements;
+	prstatement_t	*Decoded;			// Statements after the load-time decoding pass, plus the overrun sentinel
 	globalvars_t	*GlobalStruct;
 	float			*Globals;			// same as SVProgs->GlobalStruct
 	int				EdictSize;	// in bytes
@@ -61,13 +131,45 @@ public:
 	// string handling
 	int StringSize;
 	char **KnownStrings;
-	int NumKnownStrings;
+	byte *StringTypes;		// PRSTR_ for each slot
+	int *StringNext;		// hash chain for slots in use, free list for slots that aren't
+	int *StringHash;		// slot + 1 of the first string in each bucket
+	int StringHashMask;
+	int FreeStrings;		// first free slot or -1
+	int NumKnownStrings;	// one past the highest slot in use
 	int MaxKnownStrings;
+
+	// the arena that AllocString carves from
+	byte *StringArena;
+	int StringArenaUsed;
+	int StringArenaSize;
+
+	// temp strings are a ring that starts over every frame
+	char *TempStrings[PR_NUM_TEMP_STRINGS];
+	int TempStringNum;
+	int TempStringPeak;
+
+	// counters
+	int LiveStrings;
+	int LiveStringBytes;
 
 	int AllocString (int bufferlength, char **ptr);
 	char *GetString (int num);
 	int SetString (char *s);
+	int ZoneString (char *s);
+	void FreeString (int num);
+	char *TempString (void);
+	void ClearTempStrings (void);
+	void RebuildStrings (void);
 
+	// def and function lookups
+	prlookup_t FieldLookup;
+	prlookup_t GlobalLookup;
+	prlookup_t FunctionLookup;
+
+	int FindName (prlookup_t *lookup, char *name);
+	int FindOfs (prlookup_t *lookup, int ofs);
+
 	// progs execution stack
 	prstack_t *Stack;
 	int StackDepth;
@@ -79,7 +181,9 @@ public:
 	int XStatement;
 
 	bool Trace;
+	bool Timing;		// pr_timeprofile is running
 	int Argc;
+	int Interpreter;
 
 	CProgsDat (void);
 	~CProgsDat (void);
@@ -88,6 +192,9 @@ public:
 
 	// execution
 	void ExecuteProgram (func_t fnum);
+	void ExecuteLegacy (int s, int exitdepth);
+	template <bool Instrumented, bool Fused> int ExecuteDecoded (int s, int exitdepth, int &runaway);
+	bool NeedsInstrumentation (void);
 	int EnterFunction (dfunction_t *f);
 	int LeaveFunction (void);
 	void PrintStatement (dstatement_t *s);
@@ -105,8 +212,19 @@ public:
 	int NumEdicts;
 	int MaxEdicts;
 
+	// free edicts oldest first, a ring of MAX_EDICTS
+	edictfree_t *FreeEdicts;
+	int FreeEdictHead;
+	int FreeEdictCount;
+
 private:
 	void AllocStringSlots (void);
+	int NewStringSlot (char *s, int type, int size);
+	int FindStringSlot (char *s);
+	void HashString (int slot);
+	void DecodeStatements (void);
+	void FuseStatements (void);
+	void BuildLookup (prlookup_t *lookup, void *items, int count, int stride, int nameofs, bool offsets);
 };
 
 extern CProgsDat *SVProgs;
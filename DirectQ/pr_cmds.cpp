@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "pr_class.h"
 
 #include <vector>
+#include <algorithm>
 
 
 edict_t *ED_Alloc (CProgsDat *Progs);
@@ -83,6 +84,7 @@ char *pr_extensions[] =
 	"DP_TE_PARTICLESNOW",
 	"DP_SV_CLIENTCAMERA",
 	"FRIK_FILE",
+	"DQ_QC_TRACELINEBATCH",
 	NULL
 };
 
@@ -174,28 +176,10 @@ cmd_t PR_Extension_List_Cmd ("extensionlist", PR_Extension_List_f);
 ===============================================================================
 */
 
-#define PR_MAX_TEMP_STRING		1024
-#define PR_NUM_TEMP_STRINGS		8
-#define PR_TEMP_STRING_MASK		(PR_NUM_TEMP_STRINGS - 1)
-
 char *PR_GetTempString (void)
 {
-	static char **pr_temp_strings = NULL;
-	static int pr_temp_string_num = 0;
-
-	if (!pr_temp_strings)
-	{
-		// place these in the permanent pool cos they'll always be needed
-		pr_temp_strings = (char **) Zone_Alloc (sizeof (char *) * PR_NUM_TEMP_STRINGS);
-
-		for (int i = 0; i < PR_NUM_TEMP_STRINGS; i++) pr_temp_strings[i] = (char *) Zone_Alloc (PR_MAX_TEMP_STRING);
-	}
-
-	// go to a new temp string, rotate the buffer if needed, and ensure that it's null termed
-	(++pr_temp_string_num) &= PR_TEMP_STRING_MASK;
-	pr_temp_strings[pr_temp_string_num][0] = 0;
-
-	return pr_temp_strings[pr_temp_string_num];
+	// the ring lives in the progs so that the strings have fixed slots and come back each frame
+	return SVProgs->TempString ();
 }
 
 
@@ -402,6 +386,7 @@ void PF_setmodel (void)
 	}
 
 	e->v.model = SVProgs->SetString (m);
+	PR_FindIndexEdict (e);
 	e->v.modelindex = i;
 
 	mod = sv.models[(int) e->v.modelindex];
@@ -795,6 +780,84 @@ void PF_traceline (void)
 	else SVProgs->GlobalStruct->trace_ent = EDICT_TO_PROG (SVProgs->EdictPointers[0]);
 }
 
+/*
+=================
+PF_tracelinebatch_add, PF_tracelinebatch_run, PF_tracelinebatch_get
+
+batched world traces for bots and AI that need lots of them.  QC adds as many lines as it wants, runs them
+all in one go (spread across the worker threads) and then reads back each result into the usual trace_
+globals.  the traces are point traces against the world only, so they don't hit any entities at all (not even
+doors and plats), and each one gives exactly the same result as it would if run on it's own.
+
+float tracelinebatch_add (vector v1, vector v2) returns the index of the trace or -1 if the batch is full
+float tracelinebatch_run (void) runs all of the traces added since the last run and returns how many there were
+float tracelinebatch_get (float index) sets the trace_ globals from a trace in the last run and returns it's fraction
+=================
+*/
+#define PR_MAX_BATCH_TRACES	4096
+
+static vec3_t pr_batchstarts[PR_MAX_BATCH_TRACES];
+static vec3_t pr_batchends[PR_MAX_BATCH_TRACES];
+static trace_t pr_batchtraces[PR_MAX_BATCH_TRACES];
+static int pr_numbatchtraces = 0;
+static bool pr_batchtracesrun = false;
+
+void PF_tracelinebatch_add (void)
+{
+	// adding after a run starts a new batch
+	if (pr_batchtracesrun)
+	{
+		pr_numbatchtraces = 0;
+		pr_batchtracesrun = false;
+	}
+
+	if (pr_numbatchtraces >= PR_MAX_BATCH_TRACES)
+	{
+		G_FLOAT (OFS_RETURN) = -1;
+		return;
+	}
+
+	VectorCopy (G_VECTOR (OFS_PARM0), pr_batchstarts[pr_numbatchtraces]);
+	VectorCopy (G_VECTOR (OFS_PARM1), pr_batchends[pr_numbatchtraces]);
+
+	G_FLOAT (OFS_RETURN) = pr_numbatchtraces++;
+}
+
+
+void PF_tracelinebatch_run (void)
+{
+	if (!pr_batchtracesrun)
+	{
+		SV_WorldTraceBatch (pr_numbatchtraces, pr_batchstarts, pr_batchends, pr_batchtraces);
+		pr_batchtracesrun = true;
+	}
+
+	G_FLOAT (OFS_RETURN) = pr_numbatchtraces;
+}
+
+
+void PF_tracelinebatch_get (void)
+{
+	int index = G_FLOAT (OFS_PARM0);
+
+	if (!pr_batchtracesrun || index < 0 || index >= pr_numbatchtraces)
+		SVProgs->RunError ("tracelinebatch_get: bad index %i", index);
+
+	trace_t *trace = &pr_batchtraces[index];
+
+	SVProgs->GlobalStruct->trace_allsolid = trace->allsolid;
+	SVProgs->GlobalStruct->trace_startsolid = trace->startsolid;
+	SVProgs->GlobalStruct->trace_fraction = trace->fraction;
+	SVProgs->GlobalStruct->trace_inwater = trace->inwater;
+	SVProgs->GlobalStruct->trace_inopen = trace->inopen;
+	VectorCopy (trace->endpos, SVProgs->GlobalStruct->trace_endpos);
+	VectorCopy (trace->plane.normal, SVProgs->GlobalStruct->trace_plane_normal);
+	SVProgs->GlobalStruct->trace_plane_dist =  trace->plane.dist;
+	SVProgs->GlobalStruct->trace_ent = EDICT_TO_PROG (SVProgs->EdictPointers[0]);
+
+	G_FLOAT (OFS_RETURN) = trace->fraction;
+}
+
 
 extern trace_t SV_Trace_Toss (edict_t *ent, edict_t *ignore);
 
@@ -1053,45 +1116,191 @@ PF_findradius
 Returns a chain of entities that have origins within a spherical area
 
 findradius (origin, radius)
+
+sv_findradius_area 1 takes the candidates from the areanode tree instead of looking at every edict.  that
+only finds entities where they were last linked, so something that had it's origin written by the progs
+without a setorigin, or was linked as SOLID_NOT and had .solid changed after, can be missed.  it's off by
+default for that reason.
 =================
 */
-void PF_findradius (void)
+cvar_t sv_findradius_area ("sv_findradius_area", "0");
+
+static int PR_FindRadiusSortFunc (const void *a, const void *b)
+{
+	return (*(edict_t **) a)->ednum - (*(edict_t **) b)->ednum;
+}
+
+
+static edict_t *PR_FindRadiusTest (edict_t *ent, edict_t *chain, float *org, float rad)
 {
-	edict_t	*ent, *chain;
-	float	rad;
-	float	*org;
 	vec3_t	eorg;
-	int		i, j;
+
+	if (ent->free)
+		return chain;
+
+	if (ent->v.solid == SOLID_NOT)
+		return chain;
+
+	for (int j = 0; j < 3; j++)
+		eorg[j] = org[j] - (ent->v.origin[j] + (ent->v.mins[j] + ent->v.maxs[j]) * 0.5);
+
+	if (Length (eorg) > rad)
+		return chain;
+
+	ent->v.chain = EDICT_TO_PROG (chain);
+	return ent;
+}
+
+
+edict_t *PR_FindRadius (float *org, float rad, bool usearea)
+{
+	edict_t	*ent, *chain;
+	int		i;
 
 	chain = (edict_t *) SVProgs->EdictPointers[0];
 
-	org = G_VECTOR (OFS_PARM0);
-	rad = G_FLOAT (OFS_PARM1);
+	// a negative or NaN radius behaves the way it always did
+	if (usearea && rad >= 0)
+	{
+		vec3_t mins = {org[0] - rad, org[1] - rad, org[2] - rad};
+		vec3_t maxs = {org[0] + rad, org[1] + rad, org[2] + rad};
+		CScratchMark mark;
+		edict_t **list = (edict_t **) mark.Alloc (SVProgs->NumEdicts * sizeof (edict_t *));
+		int count = SV_AreaEdicts (mins, maxs, list, SVProgs->NumEdicts);
+
+		// the chain is built in the same order as the full scan so that the progs see no difference
+		qsort (list, count, sizeof (edict_t *), PR_FindRadiusSortFunc);
+
+		for (i = 0; i < count; i++)
+			chain = PR_FindRadiusTest (list[i], chain, org, rad);
+
+		return chain;
+	}
 
 	ent = NEXT_EDICT (SVProgs->EdictPointers[0]);
 
 	for (i = 1; i < SVProgs->NumEdicts; i++, ent = NEXT_EDICT (ent))
+		chain = PR_FindRadiusTest (ent, chain, org, rad);
+
+	return chain;
+}
+
+
+void PF_findradius (void)
+{
+	RETURN_EDICT (PR_FindRadius (G_VECTOR (OFS_PARM0), G_FLOAT (OFS_PARM1), !!sv_findradius_area.integer));
+}
+
+
+/*
+=================
+PR_FindRadiusBench_f
+
+times findradius both ways from random points in the map and checks that they give the same chains.  extra
+entities can be spawned to see how it scales; they're removed again after.
+=================
+*/
+void PR_FindRadiusBench_f (void)
+{
+	if (!sv.active || !SVProgs)
 	{
-		if (ent->free)
-			continue;
+		Con_Printf ("findradius_bench : no server running\n");
+		return;
+	}
 
-		if (ent->v.solid == SOLID_NOT)
-			continue;
+	int queries = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 1000;
+	int extra = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 0;
+	float rad = (Cmd_Argc () > 3) ? atof (Cmd_Argv (3)) : 256;
 
-		for (j = 0; j < 3; j++)
-			eorg[j] = org[j] - (ent->v.origin[j] + (ent->v.mins[j] + ent->v.maxs[j]) * 0.5);
+	if (queries < 1) queries = 1;
+	if (extra < 0) extra = 0;
 
-		if (Length (eorg) > rad)
-			continue;
+	float *wmins = sv.worldmodel->mins;
+	float *wmaxs = sv.worldmodel->maxs;
+	CScratchMark mark;
+	edict_t **extras = extra ? (edict_t **) mark.Alloc (extra * sizeof (edict_t *)) : NULL;
+	float *points = (float *) mark.Alloc (queries * 3 * sizeof (float));
+
+	// every query overwrites .chain, which the progs may be keeping something in from one frame to the next
+	int numchains = SVProgs->NumEdicts;
+	int *chains = (int *) mark.Alloc (numchains * sizeof (int));
+
+	for (int i = 0; i < numchains; i++)
+		chains[i] = SVProgs->EdictPointers[i]->v.chain;
+
+	srand (1);
 
-		ent->v.chain = EDICT_TO_PROG (chain);
-		chain = ent;
+	for (int i = 0; i < extra; i++)
+	{
+		edict_t *ed = extras[i] = ED_Alloc (SVProgs);
+
+		for (int j = 0; j < 3; j++)
+		{
+			ed->v.origin[j] = wmins[j] + (wmaxs[j] - wmins[j]) * (rand () & 0x7fff) / (float) 0x7fff;
+			ed->v.mins[j] = -8;
+			ed->v.maxs[j] = 8;
+		}
+
+		ed->v.solid = SOLID_TRIGGER;
+		SV_LinkEdict (ed, false);
 	}
 
-	RETURN_EDICT (chain);
+	for (int i = 0; i < queries * 3; i++)
+		points[i] = wmins[i % 3] + (wmaxs[i % 3] - wmins[i % 3]) * (rand () & 0x7fff) / (float) 0x7fff;
+
+	// check they agree first, as the timed runs below overwrite each others chains
+	int found = 0;
+	int mismatches = 0;
+	int *scanlist = (int *) mark.Alloc (SVProgs->NumEdicts * sizeof (int));
+
+	for (int i = 0; i < queries; i++)
+	{
+		int count = 0;
+
+		for (edict_t *ed = PR_FindRadius (&points[i * 3], rad, false); ed != SVProgs->EdictPointers[0]; ed = PROG_TO_EDICT (ed->v.chain))
+			scanlist[count++] = ed->ednum;
+
+		found += count;
+
+		edict_t *ed = PR_FindRadius (&points[i * 3], rad, true);
+		int j;
+
+		for (j = 0; j < count && ed != SVProgs->EdictPointers[0]; j++, ed = PROG_TO_EDICT (ed->v.chain))
+			if (ed->ednum != scanlist[j])
+				break;
+
+		if (j != count || ed != SVProgs->EdictPointers[0]) mismatches++;
+	}
+
+	double scanstart = Sys_DoubleTime ();
+
+	for (int i = 0; i < queries; i++)
+		PR_FindRadius (&points[i * 3], rad, false);
+
+	double scantime = Sys_DoubleTime () - scanstart;
+	double areastart = Sys_DoubleTime ();
+
+	for (int i = 0; i < queries; i++)
+		PR_FindRadius (&points[i * 3], rad, true);
+
+	double areatime = Sys_DoubleTime () - areastart;
+
+	for (int i = 0; i < extra; i++)
+		ED_Free (extras[i]);
+
+	for (int i = 0; i < numchains; i++)
+		SVProgs->EdictPointers[i]->v.chain = chains[i];
+
+	Con_Printf ("%i queries of radius %g over %i edicts, %0.1f found per query\n", queries, rad, SVProgs->NumEdicts, (float) found / queries);
+	Con_Printf ("scan : %8.3f ms\n", scantime * 1000.0);
+	Con_Printf ("area : %8.3f ms (%0.2fx)\n", areatime * 1000.0, areatime > 0 ? scantime / areatime : 0);
+	Con_Printf ("%i queries gave different chains\n", mismatches);
 }
 
 
+cmd_t PR_FindRadiusBench_Cmd ("findradius_bench", PR_FindRadiusBench_f);
+
+
 /*
 =========
 PF_dprint
@@ -1244,6 +1453,214 @@ void PF_Remove (void)
 
 
 // entity (entity start, .string field, string match) find = #5;
+/*
+=================
+FIND INDEX
+
+an index of entities by string field contents for the fields that find is actually used on.  each bucket is a
+sorted list of entity numbers so that find can still return the next match after the entity it was given.
+
+strings that can change under us (temp strings and strings that belong to the engine) can't be filed by their
+contents so entities holding those go on a per-field list that's always checked the slow way.  entries aren't
+removed when an entity is cleared or freed; they just fail the check when found.  (a string that's strunzone'd
+while an entity still refers to it is a bug in the progs and isn't allowed for.)
+=================
+*/
+#define PR_FIND_MAXINDEXES		8
+#define PR_FIND_HASHSIZE		256
+#define PR_FIND_THRESHOLD		16		// finds on a field before it gets an index
+#define PR_FIND_UNFILED			-1
+#define PR_FIND_VOLATILE		-2
+
+typedef struct prfindindex_s
+{
+	int field;
+	std::vector<int> buckets[PR_FIND_HASHSIZE];
+	std::vector<int> volatiles;
+	std::vector<int> filed;			// bucket each entity is in, or one of PR_FIND_UNFILED/PR_FIND_VOLATILE
+} prfindindex_t;
+
+cvar_t pr_findindex ("pr_findindex", "1");
+
+int pr_numfindindexes = 0;
+static prfindindex_t *pr_findindexes[PR_FIND_MAXINDEXES];
+static std::vector<int> pr_findcounts;	// finds per field before indexing
+
+
+void PR_FindIndexReset (void)
+{
+	// field offsets mean nothing with different progs
+	for (int i = 0; i < pr_numfindindexes; i++)
+	{
+		delete pr_findindexes[i];
+		pr_findindexes[i] = NULL;
+	}
+
+	pr_numfindindexes = 0;
+	pr_findcounts.clear ();
+}
+
+
+static prfindindex_t *PR_FindIndexForField (int field)
+{
+	for (int i = 0; i < pr_numfindindexes; i++)
+		if (pr_findindexes[i]->field == field)
+			return pr_findindexes[i];
+
+	return NULL;
+}
+
+
+static void PR_FindIndexRemove (std::vector<int> &list, int entnum)
+{
+	std::vector<int>::iterator it = std::lower_bound (list.begin (), list.end (), entnum);
+
+	if (it != list.end () && *it == entnum) list.erase (it);
+}
+
+
+static void PR_FindIndexInsert (std::vector<int> &list, int entnum)
+{
+	list.insert (std::lower_bound (list.begin (), list.end (), entnum), entnum);
+}
+
+
+static void PR_FindIndexFile (prfindindex_t *idx, edict_t *ed)
+{
+	int entnum = ed->ednum;
+	string_t str = *(string_t *) &((float *) &ed->v)[idx->field];
+	int where = PR_FIND_UNFILED;
+
+	if (entnum >= idx->filed.size ()) idx->filed.resize (SVProgs->MaxEdicts, PR_FIND_UNFILED);
+
+	// anything that isn't a known string (e.g. a float that was punned into the field) can't be looked up either
+	// so find goes through it the slow way the same as a temp string
+	if (str < 0 && str < -SVProgs->NumKnownStrings)
+		where = PR_FIND_VOLATILE;
+	else if (str < 0 && SVProgs->StringTypes[-1 - str] != PRSTR_ARENA && SVProgs->StringTypes[-1 - str] != PRSTR_ZONE)
+		where = PR_FIND_VOLATILE;
+	else
+	{
+		char *s = SVProgs->GetString (str);
+
+		// find on an empty string goes the slow way so these don't need to be anywhere
+		if (s[0]) where = COM_HashString (s) & (PR_FIND_HASHSIZE - 1);
+	}
+
+	int old = idx->filed[entnum];
+
+	if (where == old) return;
+
+	if (old == PR_FIND_VOLATILE)
+		PR_FindIndexRemove (idx->volatiles, entnum);
+	else if (old != PR_FIND_UNFILED)
+		PR_FindIndexRemove (idx->buckets[old], entnum);
+
+	if (where == PR_FIND_VOLATILE)
+		PR_FindIndexInsert (idx->volatiles, entnum);
+	else if (where != PR_FIND_UNFILED)
+		PR_FindIndexInsert (idx->buckets[where], entnum);
+
+	idx->filed[entnum] = where;
+}
+
+
+void PR_FindIndexUpdate (edict_t *ed, int field)
+{
+	for (int i = 0; i < pr_numfindindexes; i++)
+	{
+		if (pr_findindexes[i]->field == field)
+		{
+			PR_FindIndexFile (pr_findindexes[i], ed);
+			return;
+		}
+	}
+}
+
+
+void PR_FindIndexStore (int pointer)
+{
+	// a STOREP_S through a pointer from OP_ADDRESS
+	edict_t *ed = SVProgs->EdictPointers[pointer / SVProgs->EdictSize];
+	int ofs = (pointer % SVProgs->EdictSize) - ((byte *) &ed->v - (byte *) ed);
+
+	PR_FindIndexUpdate (ed, ofs / 4);
+}
+
+
+void PR_FindIndexEdict (edict_t *ed)
+{
+	for (int i = 0; i < pr_numfindindexes; i++)
+		PR_FindIndexFile (pr_findindexes[i], ed);
+}
+
+
+static prfindindex_t *PR_FindIndexCreate (int field)
+{
+	prfindindex_t *idx = new prfindindex_t;
+
+	idx->field = field;
+	idx->filed.resize (SVProgs->MaxEdicts, PR_FIND_UNFILED);
+
+	for (int i = 1; i < SVProgs->NumEdicts; i++)
+	{
+		edict_t *ed = GetEdictForNumber (i);
+
+		if (!ed->free) PR_FindIndexFile (idx, ed);
+	}
+
+	pr_findindexes[pr_numfindindexes++] = idx;
+	Con_DPrintf ("PF_Find : indexed field %i\n", field);
+
+	return idx;
+}
+
+
+static bool PR_FindMatch (int entnum, int field, char *s)
+{
+	if (entnum >= SVProgs->NumEdicts) return false;
+
+	edict_t *ed = GetEdictForNumber (entnum);
+
+	if (ed->free) return false;
+
+	char *t = E_STRING (ed, field);
+
+	return (t && !strcmp (t, s));
+}
+
+
+static int PR_FindIndexed (prfindindex_t *idx, int e, char *s)
+{
+	// first match in the bucket after e
+	std::vector<int> &bucket = idx->buckets[COM_HashString (s) & (PR_FIND_HASHSIZE - 1)];
+	int best = -1;
+
+	for (std::vector<int>::iterator it = std::upper_bound (bucket.begin (), bucket.end (), e); it != bucket.end (); it++)
+	{
+		if (PR_FindMatch (*it, idx->field, s))
+		{
+			best = *it;
+			break;
+		}
+	}
+
+	// then anything earlier among the ones that have to be checked every time
+	for (std::vector<int>::iterator it = std::upper_bound (idx->volatiles.begin (), idx->volatiles.end (), e); it != idx->volatiles.end (); it++)
+	{
+		if (best >= 0 && *it > best) break;
+
+		if (PR_FindMatch (*it, idx->field, s))
+		{
+			best = *it;
+			break;
+		}
+	}
+
+	return best;
+}
+
+
 void PF_Find (void)
 {
 	int		e;
@@ -1258,6 +1675,28 @@ void PF_Find (void)
 	if (!s)
 		SVProgs->RunError ("PF_Find: bad search string");
 
+	if (pr_findindex.integer && s[0] && f >= 0 && f < SVProgs->QC->entityfields)
+	{
+		prfindindex_t *idx = PR_FindIndexForField (f);
+
+		if (!idx && pr_numfindindexes < PR_FIND_MAXINDEXES)
+		{
+			if (pr_findcounts.size () < SVProgs->QC->entityfields) pr_findcounts.resize (SVProgs->QC->entityfields, 0);
+			if (++pr_findcounts[f] >= PR_FIND_THRESHOLD) idx = PR_FindIndexCreate (f);
+		}
+
+		if (idx)
+		{
+			e = PR_FindIndexed (idx, e, s);
+
+			if (e < 0)
+				RETURN_EDICT (SVProgs->EdictPointers[0]);
+			else RETURN_EDICT (GetEdictForNumber (e));
+
+			return;
+		}
+	}
+
 	for (e++; e < SVProgs->NumEdicts; e++)
 	{
 		ed = GetEdictForNumber (e);
@@ -2086,14 +2525,11 @@ string strzone (string)
 */
 void PF_strzone (void)
 {
-	char *m, *p;
+	char *m;
 
 	m = G_STRING (OFS_PARM0);
-	p = (char *) Zone_Alloc (strlen (m) + 1);
-
-	strcpy (p, m);
 
-	G_INT (OFS_RETURN) = SVProgs->SetString (p);
+	G_INT (OFS_RETURN) = SVProgs->ZoneString (m);
 }
 
 
@@ -2106,12 +2542,9 @@ string strunzone (string)
 */
 void PF_strunzone (void)
 {
-	// the compiler freaks if I pass this directly into Zone_Free...
-	void *blah = (void *) (G_STRING (OFS_PARM0));
-
-	// fixme - was this a crash condition in the original implementation?
-	// if so, find out why and fix it!
-	Zone_Free (blah);
+	// this used to free whatever pointer it was given, including strings that were never zoned;
+	// now only strings from strzone are freed and their slot goes back for reuse
+	SVProgs->FreeString (G_INT (OFS_PARM0));
 
 	G_INT (OFS_PARM0) = OFS_NULL; // empty the def
 };
@@ -2560,6 +2993,9 @@ ebfs_builtin_t pr_ebfs_builtins[] =
 	{   0, "zone", PF_strzone},		// 0 indicates that this entry is just for remapping (because of name and number change)
 	{   0, "unzone", PF_strunzone},
 	// 2001-09-20 QuakeC string manipulation by FrikaC/Maddes  end
+	{ 120, "tracelinebatch_add", PF_tracelinebatch_add},	// float(vector v1, vector v2) tracelinebatch_add = #120;
+	{ 121, "tracelinebatch_run", PF_tracelinebatch_run},	// float() tracelinebatch_run = #121;
+	{ 122, "tracelinebatch_get", PF_tracelinebatch_get},	// float(float index) tracelinebatch_get = #122;
 	// 2001-11-15 DarkPlaces general builtin functions by Lord Havoc  start
 	// not implemented yet
 	/*
@@ -41,8 +41,8 @@ cvar_t	saved2 ("saved2", "0", CVAR_ARCHIVE);
 cvar_t	saved3 ("saved3", "0", CVAR_ARCHIVE);
 cvar_t	saved4 ("saved4", "0", CVAR_ARCHIVE);
 
-
-gefv_cache gefvCache[GEFV_CACHESIZE] = {{NULL, ""}, {NULL, ""}};
+// 0 goes back to the old linear scans in ED_FindField and friends so that map spawn times can be compared
+cvar_t	pr_hashlookups ("pr_hashlookups", "1");
 
 int ed_alpha;
 int ed_fullbright;
@@ -108,6 +108,117 @@ void ED_ClearEdict (CProgsDat *Progs, edict_t *e)
 }
 
 
+/*
+=================
+ED_FreeQueue
+
+ED_Free puts edicts on the back of a ring and ED_Alloc takes them off the front, so the ring is in freetime order
+(sv.time never goes backwards during a map) and the front is always the edict that has been free the longest.
+if that one can't be reused yet then nothing can, so ED_Alloc never needs to look past it.
+
+entries aren't removed when an edict is brought back some other way (a savegame or a benchmark snapshot); they're
+just skipped when they get to the front because the edict is no longer free or has a different freetime.
+=================
+*/
+static bool ED_FreeEntryValid (edictfree_t *f)
+{
+	// the client edicts are never handed out and anything past NumEdicts is handed out by growing
+	if (f->ednum <= svs.maxclients || f->ednum >= SVProgs->NumEdicts) return false;
+
+	edict_t *e = GetEdictForNumber (f->ednum);
+
+	return (e->free && e->freetime == f->freetime);
+}
+
+
+static edictfree_t *ED_FreeQueueFront (void)
+{
+	while (SVProgs->FreeEdictCount)
+	{
+		edictfree_t *f = &SVProgs->FreeEdicts[SVProgs->FreeEdictHead];
+
+		if (ED_FreeEntryValid (f)) return f;
+
+		// stale
+		SVProgs->FreeEdictHead = (SVProgs->FreeEdictHead + 1) & (MAX_EDICTS - 1);
+		SVProgs->FreeEdictCount--;
+	}
+
+	return NULL;
+}
+
+
+static void ED_FreeQueuePush (edict_t *e)
+{
+	if (!SVProgs->FreeEdicts)
+	{
+		SVProgs->FreeEdicts = (edictfree_t *) ServerZone->Alloc (MAX_EDICTS * sizeof (edictfree_t));
+		SVProgs->FreeEdictHead = 0;
+		SVProgs->FreeEdictCount = 0;
+	}
+
+	if (SVProgs->FreeEdictCount >= MAX_EDICTS)
+	{
+		// squeeze out the stale entries; there's at most one live entry per free edict so this makes room
+		int count = 0;
+
+		for (int i = 0; i < SVProgs->FreeEdictCount; i++)
+		{
+			edictfree_t *f = &SVProgs->FreeEdicts[(SVProgs->FreeEdictHead + i) & (MAX_EDICTS - 1)];
+
+			if (ED_FreeEntryValid (f))
+				SVProgs->FreeEdicts[(SVProgs->FreeEdictHead + count++) & (MAX_EDICTS - 1)] = *f;
+		}
+
+		SVProgs->FreeEdictCount = count;
+
+		// an edict freed twice in the same frame could in theory still leave it full; it just doesn't go on
+		if (count >= MAX_EDICTS) return;
+	}
+
+	edictfree_t *f = &SVProgs->FreeEdicts[(SVProgs->FreeEdictHead + SVProgs->FreeEdictCount) & (MAX_EDICTS - 1)];
+
+	f->ednum = e->ednum;
+	f->freetime = e->freetime;
+	SVProgs->FreeEdictCount++;
+}
+
+
+static int ED_FreeEntryCompare (const void *a, const void *b)
+{
+	edictfree_t *fa = (edictfree_t *) a;
+	edictfree_t *fb = (edictfree_t *) b;
+
+	if (fa->freetime < fb->freetime) return -1;
+	if (fa->freetime > fb->freetime) return 1;
+
+	return fa->ednum - fb->ednum;
+}
+
+
+void ED_RebuildFreeQueue (void)
+{
+	// for when edicts have been freed behind ED_Free's back
+	if (!SVProgs->FreeEdicts) SVProgs->FreeEdicts = (edictfree_t *) ServerZone->Alloc (MAX_EDICTS * sizeof (edictfree_t));
+
+	SVProgs->FreeEdictHead = 0;
+	SVProgs->FreeEdictCount = 0;
+
+	for (int i = svs.maxclients + 1; i < SVProgs->NumEdicts; i++)
+	{
+		edict_t *e = GetEdictForNumber (i);
+
+		if (!e->free) continue;
+
+		SVProgs->FreeEdicts[SVProgs->FreeEdictCount].ednum = i;
+		SVProgs->FreeEdicts[SVProgs->FreeEdictCount].freetime = e->freetime;
+		SVProgs->FreeEdictCount++;
+	}
+
+	qsort (SVProgs->FreeEdicts, SVProgs->FreeEdictCount, sizeof (edictfree_t), ED_FreeEntryCompare);
+}
+
+
 /*
 =================
 ED_Alloc
@@ -123,45 +234,33 @@ void SV_AllocEdicts (int numedicts);
 
 edict_t *ED_Alloc (CProgsDat *Progs)
 {
-	int			i;
 	edict_t		*e;
+	edictfree_t	*f = ED_FreeQueueFront ();
 
-	// start on the edict after the clients
-	for (i = svs.maxclients + 1; i < SVProgs->NumEdicts; i++)
+	// the first couple seconds of server time can involve a lot of
+	// freeing and allocating, so relax the replacement policy
+	if (f && (f->freetime < 2.0f || sv.time - f->freetime > 0.5f))
 	{
-		e = GetEdictForNumber (i);
+		e = GetEdictForNumber (f->ednum);
 
-		// the first couple seconds of server time can involve a lot of
-		// freeing and allocating, so relax the replacement policy
-		if (e->free && (e->freetime < 2.0f || sv.time - e->freetime > 0.5f))
-		{
-			ED_ClearEdict (Progs, e);
-			return e;
-		}
+		SVProgs->FreeEdictHead = (SVProgs->FreeEdictHead + 1) & (MAX_EDICTS - 1);
+		SVProgs->FreeEdictCount--;
+
+		ED_ClearEdict (Progs, e);
+		return e;
 	}
 
-	if (i >= MAX_EDICTS)
+	if (SVProgs->NumEdicts >= MAX_EDICTS)
 	{
-		// if we hit the absolute upper limit just pick the one with the lowest free time
-		float bestfree = sv.time;
-		int bestedict = -1;
-
-		for (i = svs.maxclients + 1; i < SVProgs->NumEdicts; i++)
+		// if we hit the absolute upper limit just pick the one with the lowest free time, which is the front
+		if (f && f->freetime < sv.time)
 		{
-			e = GetEdictForNumber (i);
+			e = GetEdictForNumber (f->ednum);
 
-			if (e->free && e->freetime < bestfree)
-			{
-				bestedict = i;
-				bestfree = e->freetime;
-			}
-		}
+			SVProgs->FreeEdictHead = (SVProgs->FreeEdictHead + 1) & (MAX_EDICTS - 1);
+			SVProgs->FreeEdictCount--;
 
-		if (bestedict > -1)
-		{
-			e = GetEdictForNumber (bestedict);
 			ED_ClearEdict (Progs, e);
-
 			return e;
 		}
 
@@ -170,10 +269,10 @@ edict_t *ED_Alloc (CProgsDat *Progs)
 	}
 
 	// alloc 32 more edicts
-	if (i >= SVProgs->MaxEdicts) SV_AllocEdicts (32);
+	if (SVProgs->NumEdicts >= SVProgs->MaxEdicts) SV_AllocEdicts (32);
 
+	e = GetEdictForNumber (SVProgs->NumEdicts);
 	SVProgs->NumEdicts++;
-	e = GetEdictForNumber (i);
 	ED_ClearEdict (Progs, e);
 
 	return e;
@@ -205,6 +304,7 @@ void ED_Free (edict_t *ed)
 	ed->num_leafs = 0;
 
 	ed->freetime = sv.time;
+	ED_FreeQueuePush (ed);
 }
 
 //===========================================================================
@@ -219,6 +319,13 @@ ddef_t *ED_GlobalAtOfs (int ofs)
 	ddef_t		*def;
 	int			i;
 
+	if (pr_hashlookups.value && SVProgs->GlobalLookup.names)
+	{
+		if ((i = SVProgs->FindOfs (&SVProgs->GlobalLookup, ofs)) < 0) return NULL;
+
+		return &SVProgs->GlobalDefs[i];
+	}
+
 	for (i = 0; i < SVProgs->QC->numglobaldefs; i++)
 	{
 		def = &SVProgs->GlobalDefs[i];
@@ -240,6 +347,13 @@ ddef_t *ED_FieldAtOfs (int ofs)
 	ddef_t		*def;
 	int			i;
 
+	if (pr_hashlookups.value && SVProgs->FieldLookup.names)
+	{
+		if ((i = SVProgs->FindOfs (&SVProgs->FieldLookup, ofs)) < 0) return NULL;
+
+		return &SVProgs->FieldDefs[i];
+	}
+
 	for (i = 0; i < SVProgs->QC->numfielddefs; i++)
 	{
 		def = &SVProgs->FieldDefs[i];
@@ -261,6 +375,13 @@ ddef_t *ED_FindField (char *name)
 	ddef_t		*def;
 	int			i;
 
+	if (pr_hashlookups.value && SVProgs->FieldLookup.names)
+	{
+		if ((i = SVProgs->FindName (&SVProgs->FieldLookup, name)) < 0) return NULL;
+
+		return &SVProgs->FieldDefs[i];
+	}
+
 	for (i = 0; i < SVProgs->QC->numfielddefs; i++)
 	{
 		def = &SVProgs->FieldDefs[i];
@@ -283,6 +404,13 @@ ddef_t *ED_FindGlobal (char *name)
 	ddef_t		*def;
 	int			i;
 
+	if (pr_hashlookups.value && SVProgs->GlobalLookup.names)
+	{
+		if ((i = SVProgs->FindName (&SVProgs->GlobalLookup, name)) < 0) return NULL;
+
+		return &SVProgs->GlobalDefs[i];
+	}
+
 	for (i = 0; i < SVProgs->QC->numglobaldefs; i++)
 	{
 		def = &SVProgs->GlobalDefs[i];
@@ -305,6 +433,13 @@ dfunction_t *ED_FindFunction (char *name)
 	dfunction_t		*func;
 	int				i;
 
+	if (pr_hashlookups.value && SVProgs->FunctionLookup.names)
+	{
+		if ((i = SVProgs->FindName (&SVProgs->FunctionLookup, name)) < 0) return NULL;
+
+		return &SVProgs->Functions[i];
+	}
+
 	for (i = 0; i < SVProgs->QC->numfunctions; i++)
 	{
 		func = &SVProgs->Functions[i];
@@ -319,29 +454,8 @@ dfunction_t *ED_FindFunction (char *name)
 
 eval_t *GetEdictFieldValue (edict_t *ed, char *field)
 {
-	ddef_t			*def = NULL;
-	int				i;
-	static int		rep = 0;
-
-	for (i = 0; i < GEFV_CACHESIZE; i++)
-	{
-		if (!strcmp (field, gefvCache[i].field))
-		{
-			def = gefvCache[i].pcache;
-			goto Done;
-		}
-	}
-
-	def = ED_FindField (field);
-
-	if (strlen (field) < MAX_FIELD_LEN)
-	{
-		gefvCache[rep].pcache = def;
-		strcpy (gefvCache[rep].field, field);
-		rep ^= 1;
-	}
-
-Done:
+	// ED_FindField is a hash lookup now so the old two-entry cache in front of it is gone
+	ddef_t *def = ED_FindField (field);
 
 	if (!def)
 		return NULL;
@@ -1025,6 +1139,9 @@ char *ED_ParseEdict (char *data, edict_t *ent)
 	if (!init)
 		ent->free = true;
 
+	// keep find's index in step with the new field values
+	PR_FindIndexEdict (ent);
+
 	return data;
 }
 
@@ -1219,6 +1336,7 @@ void ED_LoadFromFile (char *data)
 
 	int ed_warning = 0;
 	int ed_number = 0;
+	double spawntime = Sys_DoubleTime ();
 
 	// parse ents
 	while (1)
@@ -1321,6 +1439,7 @@ void ED_LoadFromFile (char *data)
 	}
 
 	Con_DPrintf ("%i entities with %i inhibited\n", ed_number, inhibit);
+	Con_DPrintf ("spawned in %0.2f ms (pr_hashlookups %i)\n", (Sys_DoubleTime () - spawntime) * 1000.0, (int) pr_hashlookups.value);
 
 	sv_levelstats.sorted = (entitystat_t **) ServerZone->Alloc (sv_levelstats.numenttypes * sizeof (entitystat_t *));
 	int nument = 0;
@@ -1349,8 +1468,14 @@ PR_Profile_f
 
 ============
 */
+extern cvar_t pr_profile;
+
 void PR_Profile_f (void)
 {
+	// the decoded interpreter doesn't count statements unless asked to
+	if (SVProgs->Interpreter != PR_INTERP_LEGACY && !pr_profile.integer)
+		Con_Printf ("set pr_profile 1 to count statements\n");
+
 	SVProgs->Profile ();
 }
 
@@ -54,12 +54,29 @@ extern int ed_gravity;
 // bumped to 64 for bounding spheres as they can enclose greater extents (tradeoff is that the test is faster)
 #define MAX_ENT_LEAFS	64
 
+// the leaf numbers that go with num_leafs
+#define ED_LEAFNUMS(ed) (((ed)->num_leafs > MAX_ENT_LEAFS) ? (ed)->bigleafs : (ed)->leafnums)
+
 typedef struct edict_s
 {
 	bool			free;
 	link_t			area;			// linked to a division node or leaf
+	struct areamirror_s	*areamirror;	// the box mirror of the list it's linked into
+	int				areaslot;		// and where it is in it
 	int				num_leafs;
 	unsigned int	leafnums[MAX_ENT_LEAFS];	// BSP2 can have > 64k leafs
+	unsigned int	*bigleafs;		// all of the leafs instead when there are more than MAX_ENT_LEAFS
+	int				maxbigleafs;
+	int				leafbox[6];		// abs box rounded out to whole units that the leafs were last found for
+	int				leafboxleafs;	// and how many leafs that was
+	bool			leafboxvalid;
+	unsigned int	leafclusters[4];	// summary of the leafs for SV_WriteEntitiesToClient (see SV_EdictLeafClusters)
+	int				encodeframe;	// the entity cache frame it's update was last encoded in
+	int				encodeofs;		// and where the bytes are
+	int				encodelen;
+	int				unseenframe;	// the last entity cache frame a client couldn't see it in
+	entity_state_t	sendstate;		// what goes to clients this frame, built once by SV_EntityState
+	int				stateframe;
 	entity_state_t	baseline;
 	float			freetime;		// time when the object was freed
 	float			tracetimer;		// timer for cullentities tracing
@@ -91,6 +108,7 @@ typedef struct edict_s
 void PR_Init (void);
 
 void ED_Free (edict_t *ed);
+void ED_RebuildFreeQueue (void);
 
 char	*ED_NewString (char *string);
 // returns a copy of the string allocated from the server's string heap
@@ -161,5 +179,12 @@ extern cvar_t	pr_builtin_remap;
 void ED_PrintEdicts (void);
 void ED_PrintNum (int ent);
 
+// string field index for find; anything that stores a non-empty string to an entity field must tell it
+extern int pr_numfindindexes;
+void PR_FindIndexReset (void);
+void PR_FindIndexUpdate (edict_t *ed, int field);
+void PR_FindIndexStore (int pointer);
+void PR_FindIndexEdict (edict_t *ed);
+
 eval_t *GetEdictFieldValue (edict_t *ed, char *field);
 
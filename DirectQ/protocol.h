@@ -39,6 +39,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define PRFL_FLOATANGLE         (1 << 2)
 #define PRFL_24BITCOORD         (1 << 3)
 #define PRFL_FLOATCOORD         (1 << 4)
+#define PRFL_EDICTSCALE         (1 << 5)        // used by other RMQ engines; not supported here
 #define PRFL_MOREFLAGS          (1 << 31)       // to do - support this...
 
 
@@ -204,12 +205,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define svc_skyboxsize          50      // [coord] size (default is 4096)
 #define svc_fog			51	// [byte] enable <optional past this point, only included if enable is true> [float] density [byte] red [byte] green [byte] blue
 
+// delta frames; only sent to a client that asked for them with the "deltaframes" stringcmd
+#define svc_deltaframe	52	// [long] frame [long] frame the updates that follow are against, 0 for the baselines
+
 // client to server
 #define	clc_bad			0
 #define	clc_nop 		1
 #define	clc_disconnect	2
 #define	clc_move		3			// [usercmd_t]
 #define	clc_stringcmd	4		// [string] message
+#define	clc_deltaack	16		// [long] last delta frame received; only sent once svc_deltaframe has been
 
 
 // temp entity events
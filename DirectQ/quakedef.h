@@ -282,6 +282,22 @@ typedef struct
 	int		alpha;
 } entity_state_t;
 
+// the entity states in one delta frame, kept on both ends so that updates can be against them
+#define DELTA_BACKUP	32
+#define DELTA_MASK		(DELTA_BACKUP - 1)
+
+typedef struct deltaframe_s
+{
+	int				sequence;	// 0 is never a valid frame
+	int				numents;
+	int				maxents;
+	int				*ednums;
+	entity_state_t	*states;
+} deltaframe_t;
+
+void Delta_AddState (deltaframe_t *frame, int ednum, entity_state_t *state);
+void Delta_FreeFrames (deltaframe_t *frames);
+
 
 #include "wad.h"
 #include "draw.h"
@@ -73,6 +73,7 @@ typedef struct
 	int		signondiff;		// Track extra bytes due to >256 model support, kludge
 	int		Protocol;
 	unsigned PrototcolFlags;
+	bool	deltaframes;	// clients may ask for delta frames
 } server_t;
 
 
@@ -114,6 +115,18 @@ typedef struct client_s
 
 	// client known data for deltas
 	int				old_frags;
+
+	// entity update frame each edict was last sent in, so that the ones left out of a full datagram rotate in
+	int				*entsent;
+	int				maxentsent;
+	int				entframe;
+
+	// delta frames (if the client asked for them); the entity states sent in the last DELTA_BACKUP frames and
+	// the last one the client got
+	bool			deltaenabled;
+	deltaframe_t	*deltaframes;
+	int				deltasequence;
+	int				deltaack;
 } client_t;
 
 
@@ -267,3 +280,31 @@ void SV_RunClients (float frametime);
 void SV_SaveSpawnparms ();
 void SV_SpawnServer (char *server);
 
+void SV_InitPVSCache (void);
+void SV_EdictLeafClusters (edict_t *ent);
+
+// server frame profiler; phases are timed into the current frame and SV_UpdateServer rolls them up at the end of it
+#define SVPROF_FRAME		0
+#define SVPROF_NETPOLL		1
+#define SVPROF_RUNCLIENTS	2
+#define SVPROF_PHYSICS		3
+#define SVPROF_STARTFRAME	4
+#define SVPROF_MOVECLIENT	5
+#define SVPROF_MOVEPUSH		6
+#define SVPROF_MOVENONE		7
+#define SVPROF_MOVEFOLLOW	8
+#define SVPROF_MOVENOCLIP	9
+#define SVPROF_MOVESTEP		10
+#define SVPROF_MOVETOSS		11
+#define SVPROF_SEND			12
+#define SVPROF_ENCODE		13		// one sample per client rather than per frame
+#define SVPROF_MAXPHASES	14
+
+extern bool sv_profiling;
+
+double SV_ProfileTime (void);
+void SV_ProfileAdd (int phase, double start);
+void SV_ProfileMove (int movetype, double start);
+void SV_ProfileEncode (int clientnum, double start);
+void SV_ProfileEndFrame (double start);
+
@@ -175,8 +175,8 @@ cmd_t S_SoundInfo_f_Cmd ("soundinfo", S_SoundInfo_f);
 void S_Init (void)
 {
 	// alloc the cache that we'll use for the rest of the game
-	SoundCache = new CQuakeCache ();
-	SoundHeap = new CQuakeZone ();
+	SoundCache = new CQuakeCache ("Sounds", mem_sound);
+	SoundHeap = new CQuakeZone (mem_sound);
 
 	// always init this otherwise we'll crash during sound clearing
 	S_ClearSounds ();
@@ -51,6 +51,10 @@ void SV_AllocEdicts (int numedicts)
 		ed->ednum = j;
 		ed->Prog = ed->ednum * SVProgs->EdictSize;
 
+		ed->bigleafs = NULL;
+		ed->maxbigleafs = 0;
+		ed->leafboxvalid = false;
+
 		// this is just test code to ensure that the allocation is valid and that
 		// there is no remaining code assuming that the edicts are in consecutive memory
 		// Pool_Edicts->Alloc ((rand () & 255) + 1);
@@ -92,18 +96,24 @@ SV_SetProtocol_f
 ===============
 */
 static int sv_protocol = PROTOCOL_VERSION_FITZ;
+static bool sv_deltaframes = false;	// "delta" is RMQ with delta frames for the clients that ask
 extern char *protolist[];
 
 static void SV_SetProtocol_f (void)
 {
 	if (Cmd_Argc() == 1)
 	{
-		Con_Printf ("sv_protocol is %d\n", sv_protocol);
+		if (sv_deltaframes)
+			Con_Printf ("sv_protocol is %d with delta frames\n", sv_protocol);
+		else Con_Printf ("sv_protocol is %d\n", sv_protocol);
+
 		return;
 	}
 
 	char *newprotocol = Cmd_Argv (1);
 
+	sv_deltaframes = false;
+
 	for (int i = 0; ; i++)
 	{
 		if (!protolist[i]) break;
@@ -114,7 +124,13 @@ static void SV_SetProtocol_f (void)
 				sv_protocol = 15;
 			else if (i == 1)
 				sv_protocol = 666;
-			else sv_protocol = 999;
+			else if (i == 2)
+				sv_protocol = 999;
+			else
+			{
+				sv_protocol = 999;
+				sv_deltaframes = true;
+			}
 
 			if (com_rmq && sv_protocol != 999)
 			{
@@ -339,6 +355,22 @@ void SV_SendServerinfo (client_t *client)
 	char			**s;
 	char			message[2048];
 
+	// delta frames from the last map are against entities that aren't there any more.  the sequence keeps counting
+	// so that an ack for an old frame still in flight can't match a new one.
+	if (client->deltaframes)
+	{
+		for (int i = 0; i < DELTA_BACKUP; i++)
+		{
+			client->deltaframes[i].sequence = 0;
+			client->deltaframes[i].numents = 0;
+		}
+	}
+
+	client->deltaack = 0;
+
+	// the client asks again after this if it wants them (and an old client that doesn't never gets them)
+	client->deltaenabled = false;
+
 	MSG_WriteByte (&client->message, svc_print);
 	_snprintf (message, 2048, "%c\nVERSION %1.2f SERVER (%i CRC)", 2, VERSION, SVProgs->CRC);
 	MSG_WriteString (&client->message, message);
@@ -542,7 +574,122 @@ byte	*fatpvs = NULL;
 cvar_t sv_pvsfat ("sv_pvsfat", "8", CVAR_ARCHIVE | CVAR_SERVER);
 cvar_t sv_novis ("sv_novis", "0", CVAR_SERVER);
 
-void SV_AddToFatPVS (vec3_t org, mnode_t *node)
+/*
+=============================================================================
+
+PVS CACHE
+
+each leaf's PVS row is decompressed the first time it's wanted and kept for the map, and each client keeps it's
+fat PVS and only builds it again when it's view moves.  with the fat PVS goes a summary with a bit for each run
+of leafs that has anything visible in it, and each edict keeps the same summary of the leafs it touches, so most
+of the edicts that can't be seen are out after ANDing 4 ints without going near their leafs.
+
+=============================================================================
+*/
+
+#define PVS_CLUSTERS	128				// bits in a summary
+#define PVS_MAXCACHE	(32 * 1024 * 1024)	// past this rows are decompressed each time again
+
+cvar_t sv_pvscache ("sv_pvscache", "1");
+
+typedef struct svclientpvs_s
+{
+	bool valid;
+	vec3_t org;
+	int fat;
+	unsigned int *bits;
+	unsigned int clusters[PVS_CLUSTERS / 32];
+} svclientpvs_t;
+
+typedef struct svpvscache_s
+{
+	model_t *model;
+	int numleafs;
+	int rowwords;
+	int clustershift;		// leaf number >> clustershift is the summary bit
+	unsigned int **rows;	// NULL until wanted
+	unsigned int *temprow;
+	int cachedbytes;
+	svclientpvs_t clients[MAX_SCOREBOARD];
+} svpvscache_t;
+
+static svpvscache_t sv_pvsdata;
+
+
+void SV_InitPVSCache (void)
+{
+	// everything comes from the server zone so it all goes at the next map
+	memset (&sv_pvsdata, 0, sizeof (svpvscache_t));
+
+	sv_pvsdata.model = sv.worldmodel;
+	sv_pvsdata.numleafs = sv.worldmodel->brushhdr->numleafs;
+	sv_pvsdata.rowwords = (sv_pvsdata.numleafs + 31) >> 5;
+
+	// rows are indexed by leaf number and the vis leafs go from 1 to numleafs (leaf 0 is the solid leaf)
+	sv_pvsdata.rows = (unsigned int **) ServerZone->Alloc ((sv_pvsdata.numleafs + 1) * sizeof (unsigned int *));
+	sv_pvsdata.temprow = (unsigned int *) ServerZone->Alloc (sv_pvsdata.rowwords * sizeof (unsigned int));
+
+	while (((sv_pvsdata.numleafs - 1) >> sv_pvsdata.clustershift) >= PVS_CLUSTERS)
+		sv_pvsdata.clustershift++;
+}
+
+
+static unsigned int *SV_LeafPVSRow (mleaf_t *leaf)
+{
+	int leafnum = leaf - sv.worldmodel->brushhdr->leafs;
+	int rowbytes = (sv_pvsdata.numleafs + 7) >> 3;
+	bool cacheable = (sv_pvscache.value && leafnum >= 0 && leafnum <= sv_pvsdata.numleafs);
+	unsigned int *row = cacheable ? sv_pvsdata.rows[leafnum] : NULL;
+
+	if (row) return row;
+
+	if (cacheable && sv_pvsdata.cachedbytes < PVS_MAXCACHE)
+	{
+		// zeroed so the words are clear past the end of the row
+		row = (unsigned int *) ServerZone->Alloc (sv_pvsdata.rowwords * sizeof (unsigned int));
+		sv_pvsdata.rows[leafnum] = row;
+		sv_pvsdata.cachedbytes += sv_pvsdata.rowwords * sizeof (unsigned int);
+	}
+	else
+	{
+		row = sv_pvsdata.temprow;
+		memset (row, 0, sv_pvsdata.rowwords * sizeof (unsigned int));
+	}
+
+	memcpy (row, Mod_LeafPVS (leaf, sv.worldmodel), rowbytes);
+
+	return row;
+}
+
+
+static void SV_SetCluster (unsigned int *clusters, int leafnum)
+{
+	int c = leafnum >> sv_pvsdata.clustershift;
+
+	// only a novis row can have bits past the last leaf, and nothing is in those
+	if (c < PVS_CLUSTERS) clusters[c >> 5] |= 1 << (c & 31);
+}
+
+
+void SV_EdictLeafClusters (edict_t *ent)
+{
+	if (sv_pvsdata.model != sv.worldmodel)
+	{
+		// no summary for this map so everything passes
+		memset (ent->leafclusters, 0xff, sizeof (ent->leafclusters));
+		return;
+	}
+
+	unsigned int *leafnums = ED_LEAFNUMS (ent);
+
+	memset (ent->leafclusters, 0, sizeof (ent->leafclusters));
+
+	for (int i = 0; i < ent->num_leafs; i++)
+		SV_SetCluster (ent->leafclusters, leafnums[i]);
+}
+
+
+void SV_AddToFatPVS (svclientpvs_t *cpvs, vec3_t org, mnode_t *node)
 {
 	while (1)
 	{
@@ -551,9 +698,9 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node)
 		{
 			if (node->contents != CONTENTS_SOLID)
 			{
-				byte *pvs = Mod_LeafPVS ((mleaf_t *) node, sv.worldmodel);
+				unsigned int *row = SV_LeafPVSRow ((mleaf_t *) node);
 
-				for (int i = 0; i < fatbytes; i++) fatpvs[i] |= pvs[i];
+				for (int i = 0; i < sv_pvsdata.rowwords; i++) cpvs->bits[i] |= row[i];
 			}
 
 			return;
@@ -568,7 +715,7 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node)
 		else
 		{
 			// go down both
-			SV_AddToFatPVS (org, node->children[0]);
+			SV_AddToFatPVS (cpvs, org, node->children[0]);
 			node = node->children[1];
 		}
 	}
@@ -583,21 +730,470 @@ Calculates a PVS that is the inclusive or of all leafs within 8 pixels of the
 given point.
 =============
 */
-byte *SV_FatPVS (vec3_t org)
+static svclientpvs_t *SV_FatPVS (int clientnum, vec3_t org)
 {
-	fatbytes = (sv.worldmodel->brushhdr->numleafs + 31) >> 3;
+	svclientpvs_t *cpvs = &sv_pvsdata.clients[clientnum];
+
+	if (sv_pvsdata.model != sv.worldmodel) SV_InitPVSCache ();
+
+	// a client whose view hasn't moved sees the same as last time
+	if (cpvs->valid && sv_pvscache.value && VectorCompare (cpvs->org, org) && cpvs->fat == sv_pvsfat.integer)
+		return cpvs;
+
+	if (!cpvs->bits) cpvs->bits = (unsigned int *) ServerZone->Alloc (sv_pvsdata.rowwords * sizeof (unsigned int));
+
+	memset (cpvs->bits, 0, sv_pvsdata.rowwords * sizeof (unsigned int));
+	SV_AddToFatPVS (cpvs, org, sv.worldmodel->brushhdr->nodes);
 
-	if (!fatpvs) fatpvs = (byte *) ServerZone->Alloc (fatbytes);
+	// summarise it
+	int span = (sv_pvsdata.clustershift < 5) ? (1 << sv_pvsdata.clustershift) : 32;
+	unsigned int mask = (span < 32) ? ((1u << span) - 1) : 0xffffffff;
 
-	memset (fatpvs, 0, fatbytes);
-	SV_AddToFatPVS (org, sv.worldmodel->brushhdr->nodes);
+	memset (cpvs->clusters, 0, sizeof (cpvs->clusters));
 
-	return fatpvs;
+	for (int w = 0; w < sv_pvsdata.rowwords; w++)
+	{
+		if (!cpvs->bits[w]) continue;
+
+		for (int b = 0; b < 32; b += span)
+			if ((cpvs->bits[w] >> b) & mask)
+				SV_SetCluster (cpvs->clusters, (w << 5) + b);
+	}
+
+	VectorCopy (org, cpvs->org);
+	cpvs->fat = sv_pvsfat.integer;
+	cpvs->valid = true;
+
+	return cpvs;
 }
 
 
 void PR_WriteGibletsToClient (sizebuf_t *buf);
 
+/*
+=============
+SV_EntityState
+
+builds what gets sent for an entity this frame.  the step lerp in here changes the entity so it must only run
+once a frame however many clients see it, and nothing depends on the client so it's kept for the rest of the frame.
+=============
+*/
+static int sv_encodeframe = 0;
+
+static entity_state_t *SV_EntityState (edict_t *ent)
+{
+	if (ent->stateframe == sv_encodeframe) return &ent->sendstate;
+
+	int alpha;
+
+	float origin[3];
+	float angles[3];
+	extern cvar_t r_lerporient;
+
+	// darkplaces 1.05 server-side interpolation code
+	// this replaces client-side transform interpolation if connected to a server locally; if connected remotely
+	// we still use the old client-side system
+	if (ent->v.movetype == MOVETYPE_STEP && ((int) ent->v.flags & (FL_ONGROUND | FL_FLY | FL_SWIM)) && r_lerporient.integer)
+	{
+		// monsters have smoothed walking/flying/swimming movement
+		if (!ent->steplerptime || ent->steplerptime > sv.time) // when the level just started...
+		{
+			ent->steplerptime = sv.time;
+			VectorCopy (ent->v.origin, ent->stepoldorigin);
+			VectorCopy (ent->v.angles, ent->stepoldangles);
+			VectorCopy (ent->v.origin, ent->steporigin);
+			VectorCopy (ent->v.angles, ent->stepangles);
+		}
+
+		VectorSubtract (ent->v.origin, ent->steporigin, origin);
+		VectorSubtract (ent->v.angles, ent->stepangles, angles);
+
+		if (DotProduct (origin, origin) >= 0.125 || DotProduct (angles, angles) >= 1.4)
+		{
+			// update lerp positions
+			ent->steplerptime = sv.time;
+			VectorCopy (ent->steporigin, ent->stepoldorigin);
+			VectorCopy (ent->stepangles, ent->stepoldangles);
+			VectorCopy (ent->v.origin, ent->steporigin);
+			VectorCopy (ent->v.angles, ent->stepangles);
+		}
+
+		float movelerp = (sv.time - ent->steplerptime) * 10.0;
+
+		if (movelerp > 1) movelerp = 1;
+
+		float moveilerp = 1 - movelerp;
+
+		origin[0] = ent->stepoldorigin[0] * moveilerp + ent->steporigin[0] * movelerp;
+		origin[1] = ent->stepoldorigin[1] * moveilerp + ent->steporigin[1] * movelerp;
+		origin[2] = ent->stepoldorigin[2] * moveilerp + ent->steporigin[2] * movelerp;
+
+		// choose shortest rotate (to avoid 'spin around' situations)
+		VectorSubtract (ent->stepangles, ent->stepoldangles, angles);
+
+		if (angles[0] < -180) angles[0] += 360; if (angles[0] >= 180) angles[0] -= 360;
+		if (angles[1] < -180) angles[1] += 360; if (angles[1] >= 180) angles[1] -= 360;
+		if (angles[2] < -180) angles[2] += 360; if (angles[2] >= 180) angles[2] -= 360;
+
+		angles[0] = angles[0] * movelerp + ent->stepoldangles[0];
+		angles[1] = angles[1] * movelerp + ent->stepoldangles[1];
+		angles[2] = angles[2] * movelerp + ent->stepoldangles[2];
+	}
+	else
+	{
+		// copy as they are
+		VectorCopy (ent->v.origin, origin);
+		VectorCopy (ent->v.angles, angles);
+
+		if (ent->v.movetype == MOVETYPE_STEP)
+		{
+			// monster, but airborn, update lerp info
+			ent->steplerptime = sv.time;
+			VectorCopy (ent->v.origin, ent->stepoldorigin);
+			VectorCopy (ent->v.angles, ent->stepoldangles);
+			VectorCopy (ent->v.origin, ent->steporigin);
+			VectorCopy (ent->v.angles, ent->stepangles);
+		}
+	}
+
+	alpha = ent->baseline.alpha;
+	/*
+	// assume that alpha is not going to change
+	alpha = ent->baseline.alpha;
+
+	// figure out alpha
+	if (nehahra && sv.Protocol == PROTOCOL_VERSION_NQ)
+	{
+	}
+	else if (nehahra)
+	{
+	}
+	else if (sv.Protocol != PROTOCOL_VERSION_NQ)
+	{
+		alpha = ent->alpha;
+	}
+	*/
+
+	// Nehahra: Model Alpha
+	eval_t *val = NULL;
+
+	alpha = ent->alphaval;
+
+	if (ed_alpha)
+	{
+		if ((val = GETEDICTFIELDVALUEFAST (ent, ed_alpha)) != NULL)
+		{
+			if (val->_float <= 0)
+				alpha = 0;
+			else if (val->_float >= 1)
+				alpha = 0;
+			else alpha = val->_float * 255;
+		}
+	}
+
+	// to do
+	float fullbright;
+
+	if (ed_fullbright)
+	{
+		if (val = GETEDICTFIELDVALUEFAST (ent, ed_fullbright))
+			fullbright = val->_float;
+		else fullbright = 0;
+	}
+	else fullbright = 0;
+
+	// only send U_TRANS if protocol 15 - note - FUCKING nehahra uses protocol 15 but sends non-standard messages - FUCK FUCK FUCK
+	// if (((alpha < 255 && alpha > 0) || fullbright) && (sv.Protocol == PROTOCOL_VERSION_NQ || nehahra)) bits |= U_TRANS;
+
+	entity_state_t *state = &ent->sendstate;
+
+	VectorCopy (origin, state->origin);
+	VectorCopy (angles, state->angles);
+
+	state->modelindex = ent->v.modelindex;
+	state->frame = ent->v.frame;
+	state->colormap = ent->v.colormap;
+	state->skin = ent->v.skin;
+	state->effects = ent->v.effects;
+	state->alpha = alpha;
+
+	ent->stateframe = sv_encodeframe;
+
+	return state;
+}
+
+
+/*
+=============
+SV_WriteEntityDelta
+
+writes the update for one entity against a previous state of it, which is the baseline unless the client
+has acknowledged a delta frame.
+=============
+*/
+static void SV_WriteEntityDelta (edict_t *ent, int e, entity_state_t *from, entity_state_t *to, sizebuf_t *msg)
+{
+	int bits = 0;
+
+	// only transmit origin if changed
+	if (to->origin[0] != from->origin[0]) bits |= U_ORIGIN1;
+	if (to->origin[1] != from->origin[1]) bits |= U_ORIGIN2;
+	if (to->origin[2] != from->origin[2]) bits |= U_ORIGIN3;
+
+	// only transmit angles if changed
+	if (to->angles[0] != from->angles[0]) bits |= U_ANGLES1;
+	if (to->angles[1] != from->angles[1]) bits |= U_ANGLES2;
+	if (to->angles[2] != from->angles[2]) bits |= U_ANGLES3;
+
+	// check everything else
+	if (ent->v.movetype == MOVETYPE_STEP) bits |= U_NOLERP;
+	if (from->colormap != to->colormap) bits |= U_COLORMAP;
+	if (from->skin != to->skin) bits |= U_SKIN;
+	if (from->frame != to->frame) bits |= U_FRAME;
+	if (from->effects != to->effects) bits |= U_EFFECTS;
+	if (from->modelindex != to->modelindex) bits |= U_MODEL;
+
+	if (sv.Protocol == PROTOCOL_VERSION_FITZ || sv.Protocol == PROTOCOL_VERSION_RMQ)
+	{
+		// certain FQ protocol messages are not yet implemented
+		if (from->alpha != to->alpha) bits |= U_ALPHA;
+		if ((bits & U_FRAME) && to->frame & 0xFF00) bits |= U_FRAME2;
+		if ((bits & U_MODEL) && to->modelindex & 0xFF00) bits |= U_MODEL2;
+		if (ent->sendinterval) bits |= U_LERPFINISH;
+		if (bits >= 65536) bits |= U_EXTEND1;
+		if (bits >= 16777216) bits |= U_EXTEND2;
+	}
+
+	if (e >= 256) bits |= U_LONGENTITY;
+	if (bits >= 256) bits |= U_MOREBITS;
+
+	// write the message
+	MSG_WriteByte (msg, bits | U_SIGNAL);
+
+	if (bits & U_MOREBITS) MSG_WriteByte (msg, bits >> 8);
+	if (bits & U_EXTEND1) MSG_WriteByte (msg, bits >> 16);
+	if (bits & U_EXTEND2) MSG_WriteByte (msg, bits >> 24);
+
+	if (bits & U_LONGENTITY)
+		MSG_WriteShort (msg, e);
+	else MSG_WriteByte (msg, e);
+
+	if (bits & U_MODEL) SV_WriteByteShort (msg, to->modelindex);
+	if (bits & U_FRAME) MSG_WriteByte (msg, to->frame);
+	if (bits & U_COLORMAP) MSG_WriteByte (msg, to->colormap);
+	if (bits & U_SKIN) MSG_WriteByte (msg, to->skin);
+	if (bits & U_EFFECTS) MSG_WriteByte (msg, to->effects);
+	if (bits & U_ORIGIN1) MSG_WriteCoord (msg, to->origin[0], sv.Protocol, sv.PrototcolFlags);
+	if (bits & U_ANGLES1) MSG_WriteAngle (msg, to->angles[0], sv.Protocol, sv.PrototcolFlags, 0);
+	if (bits & U_ORIGIN2) MSG_WriteCoord (msg, to->origin[1], sv.Protocol, sv.PrototcolFlags);
+	if (bits & U_ANGLES2) MSG_WriteAngle (msg, to->angles[1], sv.Protocol, sv.PrototcolFlags, 1);
+	if (bits & U_ORIGIN3) MSG_WriteCoord (msg, to->origin[2], sv.Protocol, sv.PrototcolFlags);
+	if (bits & U_ANGLES3) MSG_WriteAngle (msg, to->angles[2], sv.Protocol, sv.PrototcolFlags, 2);
+	if (bits & U_ALPHA) MSG_WriteByte (msg, to->alpha);
+	if (bits & U_FRAME2) MSG_WriteByte (msg, to->frame >> 8);
+	if (bits & U_MODEL2) MSG_WriteByte (msg, to->modelindex >> 8);
+	if (bits & U_LERPFINISH) MSG_WriteByte (msg, (byte) (Q_rint ((ent->v.nextthink - sv.time) * 255)));
+
+//		if (((bits & U_ORIGIN1) || (bits & U_ORIGIN2) || (bits & U_ORIGIN3)) && ent != clent)
+//		Con_Printf ("sending %s\n", sv.model_precache[(int) ent->v.modelindex]);
+
+	/*
+	if (bits & U_TRANS)
+	{
+		// Nehahra/.alpha
+		MSG_WriteFloat (msg, 2);
+		MSG_WriteFloat (msg, (float) alpha / 255.0f);
+		MSG_WriteFloat (msg, fullbright);
+	}
+	*/
+}
+
+
+/*
+=============
+SV_EncodeEntity
+
+writes the update for one entity against it's baseline.  nothing in here depends on the client so with the
+entity cache it's done once a frame and the bytes are copied to every client that can see it.
+=============
+*/
+static void SV_EncodeEntity (edict_t *ent, int e, sizebuf_t *msg)
+{
+	SV_WriteEntityDelta (ent, e, &ent->baseline, SV_EntityState (ent), msg);
+}
+
+
+// bytes for the biggest update SV_EncodeEntity can write, with room to spare
+#define SV_MAXENTITYBYTES	64
+
+cvar_t sv_entitycache ("sv_entitycache", "1");
+
+static sizebuf_t sv_encoded;
+static int sv_encodedsize = 0;
+
+
+static void SV_BeginEntityFrame (void)
+{
+	// every entity can be encoded once a frame at most so this never needs to grow in the middle of one
+	int size = SVProgs->NumEdicts * SV_MAXENTITYBYTES;
+
+	if (size > sv_encodedsize)
+	{
+		if (sv_encoded.data) Zone_Free (sv_encoded.data);
+
+		sv_encoded.data = (byte *) Zone_Alloc (size, false);
+		sv_encodedsize = size;
+	}
+
+	sv_encoded.allowoverflow = false;
+	sv_encoded.overflowed = false;
+	sv_encoded.maxsize = sv_encodedsize;
+	sv_encoded.cursize = 0;
+
+	sv_encodeframe++;
+}
+
+
+static void SV_EntityUnseen (edict_t *ent)
+{
+	// an entity that isn't sent has it's step lerp reset.  with the cache that waits until the end of the frame so
+	// that it only happens if no client saw it, rather than depending on the order the clients are sent in.
+	if (sv_entitycache.value)
+		ent->unseenframe = sv_encodeframe;
+	else ent->steplerptime = 0;
+}
+
+
+static void SV_EndEntityFrame (void)
+{
+	for (int e = 1; e < SVProgs->NumEdicts; e++)
+	{
+		edict_t *ent = SVProgs->EdictPointers[e];
+
+		if (ent->unseenframe == sv_encodeframe && ent->stateframe != sv_encodeframe)
+			ent->steplerptime = 0;
+	}
+}
+
+
+/*
+=============
+entity priority
+
+if everything a client can see doesn't fit in the datagram then sending in edict order would leave the same
+high-numbered entities out every frame.  instead the visible set is ranked by how long it's been since each one
+was last sent to this client, how close it is and whether it's moving, and the datagram is filled from the top.
+
+the client stops drawing anything that isn't in the latest packet, so this is only done for clients on delta
+frames, where whatever doesn't get a full update is sent as a few bytes of "no change since the frame you
+acked" instead.  it holds still for a frame and something that was left out keeps climbing until it gets in.
+other clients keep the old edict order cutoff.
+=============
+*/
+cvar_t sv_entitypriority ("sv_entitypriority", "1");
+
+typedef struct svsendent_s
+{
+	edict_t *ent;
+	int ednum;
+	byte *data;
+	int len;
+	float priority;
+} svsendent_t;
+
+
+static void SV_ClientEntSentSize (client_t *client)
+{
+	if (client->maxentsent >= SVProgs->NumEdicts) return;
+
+	int newmax = (SVProgs->NumEdicts + 1023) & ~1023;
+	int *entsent = (int *) Zone_Alloc (newmax * sizeof (int));
+
+	if (client->entsent)
+	{
+		memcpy (entsent, client->entsent, client->maxentsent * sizeof (int));
+		Zone_Free (client->entsent);
+	}
+
+	client->entsent = entsent;
+	client->maxentsent = newmax;
+}
+
+
+static float SV_EntityPriority (client_t *client, svsendent_t *se, edict_t *clent, vec3_t org)
+{
+	// the client's own entity always goes
+	if (se->ent == clent) return 1e30f;
+
+	edict_t *ent = se->ent;
+	vec3_t dist;
+
+	// frames since it was last sent, which is what lets starved entities rotate in
+	int stale = client->entframe - client->entsent[se->ednum];
+
+	if (stale < 1) stale = 1;
+
+	for (int i = 0; i < 3; i++)
+		dist[i] = (ent->v.absmin[i] + ent->v.absmax[i]) * 0.5f - org[i];
+
+	float priority = (float) stale / (1.0f + Length (dist) / 512.0f);
+
+	// something moving goes stale quicker than something standing still
+	if (!VectorCompare (ent->v.velocity, vec3_origin) || !VectorCompare (ent->v.avelocity, vec3_origin))
+		priority *= 2;
+	else if (ent->v.movetype == MOVETYPE_STEP && ent->steplerptime == sv.time)
+		priority *= 2;
+
+	return priority;
+}
+
+
+// worst case for an update that doesn't change anything: 4 bytes of bits, a long entity number and lerpfinish
+#define SV_KEEPENTITYBYTES	7
+
+
+/*
+=============
+SV_BeginDeltaFrame
+
+starts the next delta frame for a client and finds the one the client last acknowledged to send it against.
+if the client doesn't have one, or it's too old to still be kept, the updates are against the baselines.
+=============
+*/
+static deltaframe_t *SV_BeginDeltaFrame (client_t *client, deltaframe_t **base)
+{
+	if (!client->deltaframes)
+		client->deltaframes = (deltaframe_t *) Zone_Alloc (DELTA_BACKUP * sizeof (deltaframe_t));
+
+	int sequence = ++client->deltasequence;
+	int ack = client->deltaack;
+
+	if (ack > 0 && sequence - ack < DELTA_BACKUP && client->deltaframes[ack & DELTA_MASK].sequence == ack)
+		*base = &client->deltaframes[ack & DELTA_MASK];
+	else *base = NULL;
+
+	deltaframe_t *frame = &client->deltaframes[sequence & DELTA_MASK];
+
+	frame->sequence = sequence;
+	frame->numents = 0;
+
+	return frame;
+}
+
+
+static int SV_SendEntSortFunc (const void *a, const void *b)
+{
+	float pa = ((svsendent_t *) a)->priority;
+	float pb = ((svsendent_t *) b)->priority;
+
+	// highest first and edict order for ties so that the result is stable
+	if (pa > pb) return -1;
+	if (pa < pb) return 1;
+
+	return ((svsendent_t *) a)->ednum - ((svsendent_t *) b)->ednum;
+}
+
+
 /*
 =============
 SV_WriteEntitiesToClient
@@ -607,11 +1203,9 @@ SV_WriteEntitiesToClient
 void SV_WriteEntitiesToClient (client_t *client, sizebuf_t *msg)
 {
 	int		e, i;
-	int		bits;
 	vec3_t	org;
 	edict_t	*ent;
 	edict_t *clent;
-	int alpha;
 
 	PR_WriteGibletsToClient (msg);
 
@@ -622,7 +1216,58 @@ void SV_WriteEntitiesToClient (client_t *client, sizebuf_t *msg)
 	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
 
 	sv_frame--;
-	byte *pvs = SV_FatPVS (org);
+	svclientpvs_t *cpvs = SV_FatPVS (client - svs.clients, org);
+	unsigned int *pvs = cpvs->bits;
+
+	// original + missing for worst case
+	int packetsize = 16 + 2;
+
+	// if (bits & U_TRANS) packetsize += 12;
+	if (sv.Protocol != PROTOCOL_VERSION_NQ) ++packetsize;
+	if (sv_max_datagram == MAX_DATAGRAM) packetsize += 256;
+
+	// everything visible is gathered and encoded first so that we know if it all fits
+	CScratchMark mark;
+	svsendent_t *sendents = (svsendent_t *) mark.Alloc (SVProgs->NumEdicts * sizeof (svsendent_t));
+	int numsendents = 0;
+	int sendsize = 0;
+	sizebuf_t localencoded;
+
+	// with delta frames every client has it's own updates so the cache doesn't apply
+	deltaframe_t *deltabase = NULL;
+	deltaframe_t *deltaframe = NULL;
+	int *deltaslots = NULL;
+	bool deltaframes = client->deltaenabled;
+
+	if (deltaframes)
+	{
+		deltaframe = SV_BeginDeltaFrame (client, &deltabase);
+		deltaslots = (int *) mark.Alloc (SVProgs->NumEdicts * sizeof (int));
+
+		// find where each entity is in the frame we're against
+		memset (deltaslots, 0xff, SVProgs->NumEdicts * sizeof (int));
+
+		if (deltabase)
+		{
+			for (i = 0; i < deltabase->numents; i++)
+				if (deltabase->ednums[i] < SVProgs->NumEdicts)
+					deltaslots[deltabase->ednums[i]] = i;
+		}
+
+		MSG_WriteByte (msg, svc_deltaframe);
+		MSG_WriteLong (msg, deltaframe->sequence);
+		MSG_WriteLong (msg, deltabase ? deltabase->sequence : 0);
+	}
+
+	if (!sv_entitycache.value || deltaframes)
+	{
+		// without the cache this client's updates are encoded into scratch instead
+		localencoded.data = (byte *) mark.Alloc (SVProgs->NumEdicts * SV_MAXENTITYBYTES);
+		localencoded.maxsize = SVProgs->NumEdicts * SV_MAXENTITYBYTES;
+		localencoded.cursize = 0;
+		localencoded.allowoverflow = false;
+		localencoded.overflowed = false;
+	}
 
 	// send over all entities (excpet the client) that touch the pvs
 	ent = NEXT_EDICT (SVProgs->EdictPointers[0]);
@@ -638,7 +1283,7 @@ void SV_WriteEntitiesToClient (client_t *client, sizebuf_t *msg)
 			// ignore ents without visible models
 			if (!ent->v.modelindex || !SVProgs->GetString (ent->v.model)[0])
 			{
-				ent->steplerptime = 0;
+				SV_EntityUnseen (ent);
 				continue;
 			}
 
@@ -646,228 +1291,139 @@ void SV_WriteEntitiesToClient (client_t *client, sizebuf_t *msg)
 			// fixme - implement the new RMQ way
 			if (!sv_novis.value)
 			{
+				// most of what can't be seen is out on the summaries without looking at the leafs
+				if (!((ent->leafclusters[0] & cpvs->clusters[0]) | (ent->leafclusters[1] & cpvs->clusters[1]) |
+					(ent->leafclusters[2] & cpvs->clusters[2]) | (ent->leafclusters[3] & cpvs->clusters[3])))
+				{
+					SV_EntityUnseen (ent);
+					continue;
+				}
+
+				unsigned int *leafnums = ED_LEAFNUMS (ent);
+
 				// ignore if not touching a PV leaf
 				for (i = 0; i < ent->num_leafs; i++)
-					if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i] & 7)))
+					if (pvs[leafnums[i] >> 5] & (1 << (leafnums[i] & 31)))
 						break;
 
 				// not visible
 				if (i == ent->num_leafs)
 				{
-					ent->steplerptime = 0;
+					SV_EntityUnseen (ent);
 					continue;
 				}
 			}
 		}
 
-		// send an update
-		bits = 0;
+		svsendent_t *se = &sendents[numsendents++];
 
-		float origin[3];
-		float angles[3];
-		extern cvar_t r_lerporient;
+		se->ent = ent;
+		se->ednum = e;
 
-		// darkplaces 1.05 server-side interpolation code
-		// this replaces client-side transform interpolation if connected to a server locally; if connected remotely
-		// we still use the old client-side system
-		if (ent->v.movetype == MOVETYPE_STEP && ((int) ent->v.flags & (FL_ONGROUND | FL_FLY | FL_SWIM)) && r_lerporient.integer)
+		if (deltaframes)
 		{
-			// monsters have smoothed walking/flying/swimming movement
-			if (!ent->steplerptime || ent->steplerptime > sv.time) // when the level just started...
-			{
-				ent->steplerptime = sv.time;
-				VectorCopy (ent->v.origin, ent->stepoldorigin);
-				VectorCopy (ent->v.angles, ent->stepoldangles);
-				VectorCopy (ent->v.origin, ent->steporigin);
-				VectorCopy (ent->v.angles, ent->stepangles);
-			}
-
-			VectorSubtract (ent->v.origin, ent->steporigin, origin);
-			VectorSubtract (ent->v.angles, ent->stepangles, angles);
+			entity_state_t *from = (deltaslots[e] >= 0) ? &deltabase->states[deltaslots[e]] : &ent->baseline;
 
-			if (DotProduct (origin, origin) >= 0.125 || DotProduct (angles, angles) >= 1.4)
+			se->data = localencoded.data + localencoded.cursize;
+			SV_WriteEntityDelta (ent, e, from, SV_EntityState (ent), &localencoded);
+			se->len = (localencoded.data + localencoded.cursize) - se->data;
+		}
+		else if (!sv_entitycache.value)
+		{
+			se->data = localencoded.data + localencoded.cursize;
+			SV_EncodeEntity (ent, e, &localencoded);
+			se->len = (localencoded.data + localencoded.cursize) - se->data;
+		}
+		else
+		{
+			// the update is the same for every client that sees it so only the first one encodes it
+			if (ent->encodeframe != sv_encodeframe)
 			{
-				// update lerp positions
-				ent->steplerptime = sv.time;
-				VectorCopy (ent->steporigin, ent->stepoldorigin);
-				VectorCopy (ent->stepangles, ent->stepoldangles);
-				VectorCopy (ent->v.origin, ent->steporigin);
-				VectorCopy (ent->v.angles, ent->stepangles);
+				ent->encodeofs = sv_encoded.cursize;
+				SV_EncodeEntity (ent, e, &sv_encoded);
+				ent->encodelen = sv_encoded.cursize - ent->encodeofs;
+				ent->encodeframe = sv_encodeframe;
 			}
 
-			float movelerp = (sv.time - ent->steplerptime) * 10.0;
-
-			if (movelerp > 1) movelerp = 1;
-
-			float moveilerp = 1 - movelerp;
+			se->data = sv_encoded.data + ent->encodeofs;
+			se->len = ent->encodelen;
+		}
 
-			origin[0] = ent->stepoldorigin[0] * moveilerp + ent->steporigin[0] * movelerp;
-			origin[1] = ent->stepoldorigin[1] * moveilerp + ent->steporigin[1] * movelerp;
-			origin[2] = ent->stepoldorigin[2] * moveilerp + ent->steporigin[2] * movelerp;
+		sendsize += se->len;
+	}
 
-			// choose shortest rotate (to avoid 'spin around' situations)
-			VectorSubtract (ent->stepangles, ent->stepoldangles, angles);
+	SV_ClientEntSentSize (client);
+	client->entframe++;
 
-			if (angles[0] < -180) angles[0] += 360; if (angles[0] >= 180) angles[0] -= 360;
-			if (angles[1] < -180) angles[1] += 360; if (angles[1] >= 180) angles[1] -= 360;
-			if (angles[2] < -180) angles[2] += 360; if (angles[2] >= 180) angles[2] -= 360;
+	// if it doesn't all fit the most important go first; otherwise keep edict order so the packet is as it always was
+	bool overflow = (msg->maxsize - msg->cursize - sendsize < packetsize);
+	bool priority = (overflow && deltaframes && sv_entitypriority.value);
+	int numkeep = 0;
 
-			angles[0] = angles[0] * movelerp + ent->stepoldangles[0];
-			angles[1] = angles[1] * movelerp + ent->stepoldangles[1];
-			angles[2] = angles[2] * movelerp + ent->stepoldangles[2];
-		}
-		else
+	if (priority)
+	{
+		for (i = 0; i < numsendents; i++)
 		{
-			// copy as they are
-			VectorCopy (ent->v.origin, origin);
-			VectorCopy (ent->v.angles, angles);
+			sendents[i].priority = SV_EntityPriority (client, &sendents[i], clent, org);
 
-			if (ent->v.movetype == MOVETYPE_STEP)
-			{
-				// monster, but airborn, update lerp info
-				ent->steplerptime = sv.time;
-				VectorCopy (ent->v.origin, ent->stepoldorigin);
-				VectorCopy (ent->v.angles, ent->stepoldangles);
-				VectorCopy (ent->v.origin, ent->steporigin);
-				VectorCopy (ent->v.angles, ent->stepangles);
-			}
+			// the client has these in the frame we're against so they can be kept instead of dropped
+			if (deltaslots[sendents[i].ednum] >= 0) numkeep++;
 		}
 
-		// only transmit origin if changed from the baseline
-		if (origin[0] != ent->baseline.origin[0]) bits |= U_ORIGIN1;
-		if (origin[1] != ent->baseline.origin[1]) bits |= U_ORIGIN2;
-		if (origin[2] != ent->baseline.origin[2]) bits |= U_ORIGIN3;
-
-		// only transmit angles if changed from the baseline
-		if (angles[0] != ent->baseline.angles[0]) bits |= U_ANGLES1;
-		if (angles[1] != ent->baseline.angles[1]) bits |= U_ANGLES2;
-		if (angles[2] != ent->baseline.angles[2]) bits |= U_ANGLES3;
-
-		// check everything else
-		if (ent->v.movetype == MOVETYPE_STEP) bits |= U_NOLERP;
-		if (ent->baseline.colormap != ent->v.colormap) bits |= U_COLORMAP;
-		if (ent->baseline.skin != ent->v.skin) bits |= U_SKIN;
-		if (ent->baseline.frame != ent->v.frame) bits |= U_FRAME;
-		if (ent->baseline.effects != ent->v.effects) bits |= U_EFFECTS;
-		if (ent->baseline.modelindex != ent->v.modelindex) bits |= U_MODEL;
-
-		alpha = ent->baseline.alpha;
-		/*
-		// assume that alpha is not going to change
-		alpha = ent->baseline.alpha;
-
-		// figure out alpha
-		if (nehahra && sv.Protocol == PROTOCOL_VERSION_NQ)
-		{
-		}
-		else if (nehahra)
-		{
-		}
-		else if (sv.Protocol != PROTOCOL_VERSION_NQ)
-		{
-			alpha = ent->alpha;
-		}
-		*/
+		qsort (sendents, numsendents, sizeof (svsendent_t), SV_SendEntSortFunc);
+	}
 
-		// Nehahra: Model Alpha
-		eval_t *val = NULL;
+	int numsent = 0;
+	int numkept = 0;
 
-		alpha = ent->alphaval;
+	for (i = 0; i < numsendents; i++)
+	{
+		svsendent_t *se = &sendents[i];
 
-		if (ed_alpha)
+		if (!priority)
 		{
-			if ((val = GETEDICTFIELDVALUEFAST (ent, ed_alpha)) != NULL)
+			if (msg->maxsize - msg->cursize < packetsize)
 			{
-				if (val->_float <= 0)
-					alpha = 0;
-				else if (val->_float >= 1)
-					alpha = 0;
-				else alpha = val->_float * 255;
+				Con_Printf ("packet overflow\n");
+				return;
 			}
-		}
 
-		// to do
-		float fullbright;
+			SZ_Write (msg, se->data, se->len);
+			client->entsent[se->ednum] = client->entframe;
 
-		if (ed_fullbright)
-		{
-			if (val = GETEDICTFIELDVALUEFAST (ent, ed_fullbright))
-				fullbright = val->_float;
-			else fullbright = 0;
-		}
-		else fullbright = 0;
-
-		// only send U_TRANS if protocol 15 - note - FUCKING nehahra uses protocol 15 but sends non-standard messages - FUCK FUCK FUCK
-		// if (((alpha < 255 && alpha > 0) || fullbright) && (sv.Protocol == PROTOCOL_VERSION_NQ || nehahra)) bits |= U_TRANS;
+			// this is what the client will have if it gets this frame
+			if (deltaframe) Delta_AddState (deltaframe, se->ednum, &se->ent->sendstate);
 
-		if (sv.Protocol == PROTOCOL_VERSION_FITZ || sv.Protocol == PROTOCOL_VERSION_RMQ)
-		{
-			// certain FQ protocol messages are not yet implemented
-			if (ent->baseline.alpha != alpha) bits |= U_ALPHA;
-			if ((bits & U_FRAME) && (int) ent->v.frame & 0xFF00) bits |= U_FRAME2;
-			if ((bits & U_MODEL) && (int) ent->v.modelindex & 0xFF00) bits |= U_MODEL2;
-			if (ent->sendinterval) bits |= U_LERPFINISH;
-			if (bits >= 65536) bits |= U_EXTEND1;
-			if (bits >= 16777216) bits |= U_EXTEND2;
+			continue;
 		}
 
-		if (e >= 256) bits |= U_LONGENTITY;
-		if (bits >= 256) bits |= U_MOREBITS;
-
-		// original + missing for worst case
-		int packetsize = 16 + 2;
+		int slot = deltaslots[se->ednum];
 
-		// if (bits & U_TRANS) packetsize += 12;
-		if (sv.Protocol != PROTOCOL_VERSION_NQ) ++packetsize;
-		if (sv_max_datagram == MAX_DATAGRAM) packetsize += 256;
+		// room is left for everything after this one to at least be kept
+		if (slot >= 0) numkeep--;
 
-		if (msg->maxsize - msg->cursize < packetsize)
+		if (msg->maxsize - msg->cursize - numkeep * SV_KEEPENTITYBYTES >= packetsize)
 		{
-			Con_Printf ("packet overflow\n");
-			return;
-		}
-
-		// write the message
-		MSG_WriteByte (msg, bits | U_SIGNAL);
-
-		if (bits & U_MOREBITS) MSG_WriteByte (msg, bits >> 8);
-		if (bits & U_EXTEND1) MSG_WriteByte (msg, bits >> 16);
-		if (bits & U_EXTEND2) MSG_WriteByte (msg, bits >> 24);
-
-		if (bits & U_LONGENTITY)
-			MSG_WriteShort (msg, e);
-		else MSG_WriteByte (msg, e);
-
-		if (bits & U_MODEL) SV_WriteByteShort (msg, ent->v.modelindex);
-		if (bits & U_FRAME) MSG_WriteByte (msg, ent->v.frame);
-		if (bits & U_COLORMAP) MSG_WriteByte (msg, ent->v.colormap);
-		if (bits & U_SKIN) MSG_WriteByte (msg, ent->v.skin);
-		if (bits & U_EFFECTS) MSG_WriteByte (msg, ent->v.effects);
-		if (bits & U_ORIGIN1) MSG_WriteCoord (msg, origin[0], sv.Protocol, sv.PrototcolFlags);
-		if (bits & U_ANGLES1) MSG_WriteAngle (msg, angles[0], sv.Protocol, sv.PrototcolFlags, 0);
-		if (bits & U_ORIGIN2) MSG_WriteCoord (msg, origin[1], sv.Protocol, sv.PrototcolFlags);
-		if (bits & U_ANGLES2) MSG_WriteAngle (msg, angles[1], sv.Protocol, sv.PrototcolFlags, 1);
-		if (bits & U_ORIGIN3) MSG_WriteCoord (msg, origin[2], sv.Protocol, sv.PrototcolFlags);
-		if (bits & U_ANGLES3) MSG_WriteAngle (msg, angles[2], sv.Protocol, sv.PrototcolFlags, 2);
-		if (bits & U_ALPHA) MSG_WriteByte (msg, alpha);
-		if (bits & U_FRAME2) MSG_WriteByte (msg, (int) ent->v.frame >> 8);
-		if (bits & U_MODEL2) MSG_WriteByte (msg, (int) ent->v.modelindex >> 8);
-		if (bits & U_LERPFINISH) MSG_WriteByte (msg, (byte) (Q_rint ((ent->v.nextthink - sv.time) * 255)));
-
-//		if (((bits & U_ORIGIN1) || (bits & U_ORIGIN2) || (bits & U_ORIGIN3)) && ent != clent)
-//		Con_Printf ("sending %s\n", sv.model_precache[(int) ent->v.modelindex]);
+			SZ_Write (msg, se->data, se->len);
+			client->entsent[se->ednum] = client->entframe;
+			numsent++;
 
-		/*
-		if (bits & U_TRANS)
+			Delta_AddState (deltaframe, se->ednum, &se->ent->sendstate);
+		}
+		else if (slot >= 0 && msg->maxsize - msg->cursize >= SV_KEEPENTITYBYTES)
 		{
-			// Nehahra/.alpha
-			MSG_WriteFloat (msg, 2);
-			MSG_WriteFloat (msg, (float) alpha / 255.0f);
-			MSG_WriteFloat (msg, fullbright);
+			// no change against what the client has, so it stays where it was instead of vanishing for a frame
+			entity_state_t *from = &deltabase->states[slot];
+
+			SV_WriteEntityDelta (se->ent, se->ednum, from, from, msg);
+			Delta_AddState (deltaframe, se->ednum, from);
+			numkept++;
 		}
-		*/
 	}
 
+	if (numsent < numsendents)
+		Con_DPrintf ("packet overflow : sent %i of %i entities by priority, %i held\n", numsent, numsendents, numkept);
+
 	// if (NumCulledEnts) Con_Printf ("Culled %i entities\n", NumCulledEnts);
 
 	return;
@@ -1072,7 +1628,9 @@ bool SV_SendClientDatagram (client_t *client)
 	SV_WriteClientdataToMessage (client->edict, &msg);
 
 	// DP_SV_CLIENTCAMERA : client, not client->edict
+	double encodestart = SV_ProfileTime ();
 	SV_WriteEntitiesToClient (client, &msg);
+	SV_ProfileEncode (client - svs.clients, encodestart);
 
 	// copy the server datagram if there is space
 	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
@@ -1189,6 +1747,9 @@ void SV_SendClientMessages (void)
 	// update frags, names, etc
 	SV_UpdateToReliableMessages ();
 
+	// entity updates are encoded once for every client this frame
+	SV_BeginEntityFrame ();
+
 	// build individual updates
 	for (i = 0, host_client = svs.clients; i < svs.maxclients; i++, host_client++)
 	{
@@ -1252,6 +1813,8 @@ void SV_SendClientMessages (void)
 		}
 	}
 
+	if (sv_entitycache.value) SV_EndEntityFrame ();
+
 	// clear muzzle flashes
 	SV_ClearMuzzleFlashes ();
 }
@@ -1259,9 +1822,15 @@ void SV_SendClientMessages (void)
 
 void SV_UpdateServer (double frametime)
 {
+	double framestart = SV_ProfileTime ();
+	double phasestart;
+
 	// in case anything here needs to reference it
 	SVProgs->GlobalStruct->frametime = frametime;
 
+	// temp strings from the last frame can be reused
+	SVProgs->ClearTempStrings ();
+
 	// wipe the server datagram
 	SV_ClearDatagram ();
 
@@ -1269,15 +1838,25 @@ void SV_UpdateServer (double frametime)
 	SV_CheckForNewClients ();
 
 	// read client messages
+	phasestart = SV_ProfileTime ();
 	SV_RunClients (frametime);
+	SV_ProfileAdd (SVPROF_RUNCLIENTS, phasestart);
 
 	// move things around and think
 	// always pause in single player if in console or menus
 	if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game))
+	{
+		phasestart = SV_ProfileTime ();
 		SV_Physics (frametime);
+		SV_ProfileAdd (SVPROF_PHYSICS, phasestart);
+	}
 
 	// send all messages to the clients
+	phasestart = SV_ProfileTime ();
 	SV_SendClientMessages ();
+	SV_ProfileAdd (SVPROF_SEND, phasestart);
+
+	SV_ProfileEndFrame (framestart);
 }
 
 
@@ -1498,7 +2077,7 @@ void SV_SpawnServer (char *server)
 	SAFE_DELETE (ServerZone);
 	SAFE_DELETE (Pool_Edicts);
 
-	ServerZone = new CQuakeZone ();
+	ServerZone = new CQuakeZone (mem_server);
 
 	// let's not have any servers with no name
 	if (hostname.string[0] == 0) Cvar_Set ("hostname", "UNNAMED");
@@ -1529,6 +2108,7 @@ void SV_SpawnServer (char *server)
 	memset (&sv, 0, sizeof (sv));
 
 	strcpy (sv.name, server);
+	Heap_SetMapName (server);
 
 	// load progs to get entity field count
 	if (SVProgs) delete SVProgs;
@@ -1557,7 +2137,7 @@ void SV_SpawnServer (char *server)
 	SVProgs->MaxEdicts = 0;
 
 	// alloc enough space
-	Pool_Edicts = new CQuakeHunk ((SVProgs->EdictSize * MAX_EDICTS + 0xfffff) >> 20);
+	Pool_Edicts = new CQuakeHunk ((SVProgs->EdictSize * MAX_EDICTS + 0xfffff) >> 20, mem_server);
 	SVProgs->EdictPointers = (edict_t **) Pool_Edicts->Alloc (MAX_EDICTS * sizeof (edict_t *));
 
 	// alloc an initial batch of 128 edicts
@@ -1571,7 +2151,13 @@ void SV_SpawnServer (char *server)
 
 	// set the correct protocol flags; these will always be 0 unless we're on PROTOCOL_VERSION_RMQ
 	// 24-bit gives the herky-jerkies on plats so just don't do it...
-	if (sv.Protocol == PROTOCOL_VERSION_RMQ)
+	// delta frames are for constrained links so they keep the smaller fitz coords unless RMQ needs the big ones.
+	// they aren't a protocol flag; each client asks for them and anything that doesn't gets full updates.
+	sv.deltaframes = (sv.Protocol == PROTOCOL_VERSION_RMQ && sv_deltaframes);
+
+	if (sv.deltaframes)
+		sv.PrototcolFlags = com_rmq ? (PRFL_FLOATCOORD | PRFL_SHORTANGLE) : 0;
+	else if (sv.Protocol == PROTOCOL_VERSION_RMQ)
 		sv.PrototcolFlags = PRFL_FLOATCOORD | PRFL_SHORTANGLE;
 	else sv.PrototcolFlags = 0;
 
@@ -1605,6 +2191,8 @@ void SV_SpawnServer (char *server)
 
 	// clear world interaction links
 	SV_ClearWorld ();
+	SV_BuildContentsGrid ();
+	SV_InitPVSCache ();
 
 	static char	dummy[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 
@@ -1669,3 +2257,277 @@ void SV_SpawnServer (char *server)
 	Con_DPrintf ("Server spawned.\n");
 }
 
+
+
+/*
+==============================================================================
+
+SERVER FRAME PROFILER
+
+sv_profile start times the phases of every server frame: net polling, reading client messages, physics broken
+down by QC StartFrame and movetype, and sending messages with each client's entity encode timed separately.
+the last SVPROF_WINDOW samples of each phase are kept for p50 and p99; max is since the profile started so that
+a single spike isn't lost.  sv_profile log <file> also writes one line per frame that a script can read.
+
+==============================================================================
+*/
+
+#define SVPROF_WINDOW	1024
+
+typedef struct svprofphase_s
+{
+	char *name;
+	int depth;
+	double accum;					// this frame
+	float window[SVPROF_WINDOW];	// ms
+	int numsamples;
+	float max;
+} svprofphase_t;
+
+static svprofphase_t sv_profphases[SVPROF_MAXPHASES] =
+{
+	{"frame", 0},
+	{"net poll", 1},
+	{"run clients", 1},
+	{"physics", 1},
+	{"startframe", 2},
+	{"move client", 2},
+	{"move push", 2},
+	{"move none", 2},
+	{"move follow", 2},
+	{"move noclip", 2},
+	{"move step", 2},
+	{"move toss", 2},
+	{"send messages", 1},
+	{"encode/client", 2}
+};
+
+typedef struct svprofclient_s
+{
+	double total;
+	int count;
+	float max;
+} svprofclient_t;
+
+bool sv_profiling = false;
+static svprofclient_t sv_profclients[MAX_SCOREBOARD];
+static int sv_profframes = 0;
+static FILE *sv_proflog = NULL;
+
+
+static void SV_ProfileSample (svprofphase_t *phase, double seconds)
+{
+	float ms = seconds * 1000.0;
+
+	phase->window[phase->numsamples % SVPROF_WINDOW] = ms;
+	phase->numsamples++;
+
+	if (ms > phase->max) phase->max = ms;
+}
+
+
+double SV_ProfileTime (void)
+{
+	return sv_profiling ? Sys_DoubleTime () : 0;
+}
+
+
+void SV_ProfileAdd (int phase, double start)
+{
+	if (sv_profiling) sv_profphases[phase].accum += Sys_DoubleTime () - start;
+}
+
+
+void SV_ProfileMove (int movetype, double start)
+{
+	if (!sv_profiling) return;
+
+	// SV_Physics passes -1 for clients
+	switch (movetype)
+	{
+	case -1: SV_ProfileAdd (SVPROF_MOVECLIENT, start); break;
+	case MOVETYPE_PUSH: SV_ProfileAdd (SVPROF_MOVEPUSH, start); break;
+	case MOVETYPE_NONE: SV_ProfileAdd (SVPROF_MOVENONE, start); break;
+	case MOVETYPE_FOLLOW: SV_ProfileAdd (SVPROF_MOVEFOLLOW, start); break;
+	case MOVETYPE_NOCLIP: SV_ProfileAdd (SVPROF_MOVENOCLIP, start); break;
+	case MOVETYPE_STEP: SV_ProfileAdd (SVPROF_MOVESTEP, start); break;
+	default: SV_ProfileAdd (SVPROF_MOVETOSS, start); break;
+	}
+}
+
+
+void SV_ProfileEncode (int clientnum, double start)
+{
+	if (!sv_profiling) return;
+
+	double seconds = Sys_DoubleTime () - start;
+	svprofclient_t *pc = &sv_profclients[clientnum];
+
+	// each client's encode is a sample of it's own and also counts towards the frame for the log
+	SV_ProfileSample (&sv_profphases[SVPROF_ENCODE], seconds);
+	sv_profphases[SVPROF_ENCODE].accum += seconds;
+
+	pc->total += seconds;
+	pc->count++;
+
+	if (seconds * 1000.0 > pc->max) pc->max = seconds * 1000.0;
+}
+
+
+void SV_ProfileEndFrame (double start)
+{
+	if (!sv_profiling) return;
+
+	SV_ProfileAdd (SVPROF_FRAME, start);
+
+	for (int i = 0; i < SVPROF_MAXPHASES; i++)
+	{
+		if (i != SVPROF_ENCODE) SV_ProfileSample (&sv_profphases[i], sv_profphases[i].accum);
+	}
+
+	if (sv_proflog)
+	{
+		fprintf (sv_proflog, "%i %0.3f", sv_profframes, sv.time);
+
+		for (int i = 0; i < SVPROF_MAXPHASES; i++)
+			fprintf (sv_proflog, " %0.4f", sv_profphases[i].accum * 1000.0);
+
+		fprintf (sv_proflog, "\n");
+	}
+
+	for (int i = 0; i < SVPROF_MAXPHASES; i++)
+		sv_profphases[i].accum = 0;
+
+	sv_profframes++;
+}
+
+
+static void SV_ProfileReset (void)
+{
+	for (int i = 0; i < SVPROF_MAXPHASES; i++)
+	{
+		sv_profphases[i].accum = 0;
+		sv_profphases[i].numsamples = 0;
+		sv_profphases[i].max = 0;
+	}
+
+	memset (sv_profclients, 0, sizeof (sv_profclients));
+	sv_profframes = 0;
+}
+
+
+static int SV_ProfileSortFunc (const void *a, const void *b)
+{
+	float diff = *((float *) a) - *((float *) b);
+
+	return (diff > 0) ? 1 : ((diff < 0) ? -1 : 0);
+}
+
+
+static void SV_ProfileReport (void)
+{
+	float sorted[SVPROF_WINDOW];
+
+	Con_Printf ("%i frames profiled\n", sv_profframes);
+	Con_Printf ("phase                  p50 ms     p99 ms     max ms\n");
+
+	for (int i = 0; i < SVPROF_MAXPHASES; i++)
+	{
+		svprofphase_t *phase = &sv_profphases[i];
+		int n = (phase->numsamples < SVPROF_WINDOW) ? phase->numsamples : SVPROF_WINDOW;
+
+		if (!n) continue;
+
+		memcpy (sorted, phase->window, n * sizeof (float));
+		qsort (sorted, n, sizeof (float), SV_ProfileSortFunc);
+
+		Con_Printf
+		(
+			"%*s%-*s %10.3f %10.3f %10.3f\n",
+			phase->depth * 2, "",
+			20 - phase->depth * 2, phase->name,
+			sorted[(n - 1) / 2],
+			sorted[(int) ((n - 1) * 0.99)],
+			phase->max
+		);
+	}
+
+	for (int i = 0; i < svs.maxclients; i++)
+	{
+		svprofclient_t *pc = &sv_profclients[i];
+
+		if (!pc->count) continue;
+
+		Con_Printf ("client %2i %-16s mean %0.3f ms max %0.3f ms\n", i, svs.clients[i].name, (pc->total * 1000.0) / pc->count, pc->max);
+	}
+}
+
+
+static void SV_ProfileLog (char *filename)
+{
+	if (sv_proflog)
+	{
+		fclose (sv_proflog);
+		sv_proflog = NULL;
+		Con_Printf ("server profile log closed\n");
+	}
+
+	if (!filename) return;
+
+	if (!(sv_proflog = fopen (va ("%s/%s", com_gamedir, filename), "w")))
+	{
+		Con_Printf ("SV_ProfileLog : couldn't open %s\n", filename);
+		return;
+	}
+
+	// the first line names the columns; every line after is one frame in ms
+	fprintf (sv_proflog, "frameno sv_time");
+
+	for (int i = 0; i < SVPROF_MAXPHASES; i++)
+	{
+		fprintf (sv_proflog, " ");
+
+		for (char *c = sv_profphases[i].name; *c; c++)
+			fputc ((*c == ' ' || *c == '/') ? '_' : *c, sv_proflog);
+	}
+
+	fprintf (sv_proflog, "\n");
+
+	Con_Printf ("logging server frames to %s\n", filename);
+}
+
+
+void SV_Profile_f (void)
+{
+	char *opt = (Cmd_Argc () > 1) ? Cmd_Argv (1) : "";
+
+	if (!_stricmp (opt, "start"))
+	{
+		SV_ProfileReset ();
+		sv_profiling = true;
+		Con_Printf ("server profile started\n");
+	}
+	else if (!_stricmp (opt, "stop"))
+	{
+		sv_profiling = false;
+
+		if (sv_proflog) fflush (sv_proflog);
+
+		Con_Printf ("server profile stopped\n");
+	}
+	else if (!_stricmp (opt, "reset"))
+		SV_ProfileReset ();
+	else if (!_stricmp (opt, "report"))
+		SV_ProfileReport ();
+	else if (!_stricmp (opt, "log"))
+		SV_ProfileLog ((Cmd_Argc () > 2) ? Cmd_Argv (2) : NULL);
+	else
+	{
+		Con_Printf ("sv_profile start | stop | reset | report | log [file]\n");
+		Con_Printf ("  log with a file writes a line per frame while profiling; without one it closes the log\n");
+	}
+}
+
+
+cmd_t SV_Profile_Cmd ("sv_profile", SV_Profile_f);
+
@@ -86,6 +86,29 @@ void SV_CheckAllEnts (void)
 SV_CheckVelocity
 ================
 */
+static void SV_BoundVelocity (vec3_t velocity)
+{
+	if (sv_oldvelocity.value)
+	{
+		// original velocity bounding (retains original gameplay)
+		for (int i = 0; i < 3; i++)
+		{
+			if (velocity[i] > sv_maxvelocity.value) velocity[i] = sv_maxvelocity.value;
+			if (velocity[i] < -sv_maxvelocity.value) velocity[i] = -sv_maxvelocity.value;
+		}
+
+		return;
+	}
+
+	// correct velocity bounding
+	// note - this may be "correct" but it's a gameplay change!!!
+	float vel = Length (velocity);
+
+	if (vel > sv_maxvelocity.value)
+		VectorScale (velocity, sv_maxvelocity.value / vel, velocity);
+}
+
+
 void SV_CheckVelocity (edict_t *ent)
 {
 	int		i;
@@ -104,24 +127,9 @@ void SV_CheckVelocity (edict_t *ent)
 			Con_DPrintf ("Got a NaN origin on %s\n", SVProgs->GetString (ent->v.classname));
 			ent->v.origin[i] = 0;
 		}
-
-		if (sv_oldvelocity.value)
-		{
-			// original velocity bounding (retains original gameplay)
-			if (ent->v.velocity[i] > sv_maxvelocity.value) ent->v.velocity[i] = sv_maxvelocity.value;
-			if (ent->v.velocity[i] < -sv_maxvelocity.value) ent->v.velocity[i] = -sv_maxvelocity.value;
-		}
 	}
 
-	// already done
-	if (sv_oldvelocity.value) return;
-
-	// correct velocity bounding
-	// note - this may be "correct" but it's a gameplay change!!!
-	float vel = Length (ent->v.velocity);
-
-	if (vel > sv_maxvelocity.value)
-		VectorScale (ent->v.velocity, sv_maxvelocity.value / vel, ent->v.velocity);
+	SV_BoundVelocity (ent->v.velocity);
 }
 
 /*
@@ -404,7 +412,7 @@ SV_AddGravity
 
 ============
 */
-void SV_AddGravity (edict_t *ent, double frametime)
+static void SV_ApplyGravity (edict_t *ent, vec3_t velocity, double frametime)
 {
 	float	ent_gravity;
 
@@ -414,7 +422,13 @@ void SV_AddGravity (edict_t *ent, double frametime)
 		ent_gravity = val->_float;
 	else ent_gravity = 1.0;
 
-	ent->v.velocity[2] -= (ent_gravity * sv_gravity.value * frametime);
+	velocity[2] -= (ent_gravity * sv_gravity.value * frametime);
+}
+
+
+void SV_AddGravity (edict_t *ent, double frametime)
+{
+	SV_ApplyGravity (ent, ent->v.velocity, frametime);
 }
 
 
@@ -433,27 +447,38 @@ SV_PushEntity
 Does not change the entities velocity at all
 ============
 */
-trace_t SV_PushEntity (edict_t *ent, vec3_t push)
+static trace_t SV_PushTrace (edict_t *ent, vec3_t push)
 {
-	trace_t	trace;
 	vec3_t	end;
 
 	VectorAdd (ent->v.origin, push, end);
 
 	if (ent->v.movetype == MOVETYPE_FLYMISSILE)
-		trace = SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_MISSILE, ent);
+		return SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_MISSILE, ent);
 	else if (ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT)
 	{
 		// only clip against bmodels
-		trace = SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NOMONSTERS, ent);
+		return SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NOMONSTERS, ent);
 	}
-	else trace = SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NORMAL, ent);
+	else return SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NORMAL, ent);
+}
+
 
-	VectorCopy (trace.endpos, ent->v.origin);
+static void SV_FinishPush (edict_t *ent, trace_t *trace)
+{
+	VectorCopy (trace->endpos, ent->v.origin);
 	SV_LinkEdict (ent, true);
 
-	if (trace.ent)
-		SV_Impact (ent, trace.ent);
+	if (trace->ent)
+		SV_Impact (ent, trace->ent);
+}
+
+
+trace_t SV_PushEntity (edict_t *ent, vec3_t push)
+{
+	trace_t trace = SV_PushTrace (ent, push);
+
+	SV_FinishPush (ent, &trace);
 
 	return trace;
 }
@@ -1323,45 +1348,26 @@ SV_Physics_Toss
 Toss, bounce, and fly movement.  When onground, do nothing.
 =============
 */
-void SV_Physics_Toss (edict_t *ent, double frametime)
+static void SV_FinishToss (edict_t *ent, trace_t *trace)
 {
-	trace_t	trace;
-	vec3_t	move;
 	float	backoff;
 
-	// regular thinking
-	if (!SV_RunThink (ent, frametime)) return;
-	if (((int) ent->v.flags & FL_ONGROUND)) return;
-
-	SV_CheckVelocity (ent);
-
-	// add gravity
-	if (ent->v.movetype != MOVETYPE_FLY && ent->v.movetype != MOVETYPE_FLYMISSILE)
-		SV_AddGravity (ent, frametime);
-
-	// move angles
-	VectorMad (ent->v.angles, frametime, ent->v.avelocity, ent->v.angles);
-
-	// move origin
-	VectorScale (ent->v.velocity, frametime, move);
-	trace = SV_PushEntity (ent, move);
-
-	if (trace.fraction == 1) return;
+	if (trace->fraction == 1) return;
 	if (ent->free) return;
 
 	if (ent->v.movetype == MOVETYPE_BOUNCE)
 		backoff = 1.5;
 	else backoff = 1;
 
-	ClipVelocity (ent->v.velocity, trace.plane.normal, ent->v.velocity, backoff);
+	ClipVelocity (ent->v.velocity, trace->plane.normal, ent->v.velocity, backoff);
 
 	// stop if on ground
-	if (trace.plane.normal[2] > 0.7)
+	if (trace->plane.normal[2] > 0.7)
 	{
 		if (ent->v.velocity[2] < 60 || ent->v.movetype != MOVETYPE_BOUNCE)
 		{
 			ent->v.flags = (int) ent->v.flags | FL_ONGROUND;
-			ent->v.groundentity = EDICT_TO_PROG (trace.ent);
+			ent->v.groundentity = EDICT_TO_PROG (trace->ent);
 			VectorCopy (vec3_origin, ent->v.velocity);
 			VectorCopy (vec3_origin, ent->v.avelocity);
 		}
@@ -1371,6 +1377,32 @@ void SV_Physics_Toss (edict_t *ent, double frametime)
 	SV_CheckWaterTransition (ent);
 }
 
+
+void SV_Physics_Toss (edict_t *ent, double frametime)
+{
+	trace_t	trace;
+	vec3_t	move;
+
+	// regular thinking
+	if (!SV_RunThink (ent, frametime)) return;
+	if (((int) ent->v.flags & FL_ONGROUND)) return;
+
+	SV_CheckVelocity (ent);
+
+	// add gravity
+	if (ent->v.movetype != MOVETYPE_FLY && ent->v.movetype != MOVETYPE_FLYMISSILE)
+		SV_AddGravity (ent, frametime);
+
+	// move angles
+	VectorMad (ent->v.angles, frametime, ent->v.avelocity, ent->v.angles);
+
+	// move origin
+	VectorScale (ent->v.velocity, frametime, move);
+	trace = SV_PushEntity (ent, move);
+
+	SV_FinishToss (ent, &trace);
+}
+
 /*
 ===============================================================================
 
@@ -1422,6 +1454,259 @@ void SV_Physics_Step (edict_t *ent, double frametime)
 //============================================================================
 
 
+/*
+===============================================================================
+
+PARALLEL TOSS PHYSICS
+
+projectiles don't depend on anything else until they hit something, so with sv_parallelphysics on the moves
+of TOSS, BOUNCE and FLYMISSILE entities (velocity, gravity, angles and the trace) are all worked out up front
+on the worker threads.  then as the usual loop gets to each one it's move is applied in edict order, with the
+links, touches and QC callbacks all run on the main thread the same as always.
+
+a move that was worked out up front is only used if nothing about the entity has changed since and nothing
+has been linked or unlinked anywhere the move could have gone; otherwise it's just run again the normal way.
+this keeps the results the same as running everything in turn, except where QC changes the origin or solid
+of something without relinking it.
+
+===============================================================================
+*/
+
+cvar_t sv_parallelphysics ("sv_parallelphysics", "0", CVAR_SERVER);
+
+#define SV_TOSSCHUNK	8
+
+// what the trace used from an entity it could have hit; QC can change any of these without relinking
+typedef struct svtosssnap_s
+{
+	edict_t		*ent;
+	float		solid;
+	int			owner;
+	float		flags;
+	float		modelindex;
+	vec3_t		origin;
+	vec3_t		angles;
+	vec3_t		mins;
+	vec3_t		maxs;
+	vec3_t		size;
+} svtosssnap_t;
+
+#define SV_TOSSMAXSNAPS		16
+
+typedef struct svtossjob_s
+{
+	edict_t		*ent;
+	int			*fields;		// the entity's fields when the move was worked out
+	svtosssnap_t	*snaps;		// and those of everything in the way
+	int			numsnaps;		// -1 if there were too many
+	vec3_t		velocity;
+	vec3_t		angles;
+	vec3_t		boxmins;
+	vec3_t		boxmaxs;
+	trace_t		trace;
+} svtossjob_t;
+
+typedef struct svtossphase_s
+{
+	svtossjob_t	*jobs;
+	svtossjob_t	**entjobs;		// indexed by edict number
+	int			numjobs;
+	int			numents;
+	int			fieldsize;
+	double		frametime;
+} svtossphase_t;
+
+
+static bool SV_CanRunTossJob (edict_t *ent, int num, double frametime)
+{
+	if (ent->free) return false;
+	if (num <= svs.maxclients) return false;
+	if (ent->v.movetype != MOVETYPE_TOSS && ent->v.movetype != MOVETYPE_BOUNCE && ent->v.movetype != MOVETYPE_FLYMISSILE) return false;
+	if ((int) ent->v.flags & FL_ONGROUND) return false;
+
+	// anything that thinks this frame needs to run it's think first
+	float thinktime = ent->v.nextthink;
+
+	if (!(thinktime <= 0 || thinktime > (sv.time + frametime))) return false;
+
+	// these need to print a warning so they're left to the main thread
+	for (int i = 0; i < 3; i++)
+	{
+		if (IS_NAN (ent->v.velocity[i])) return false;
+		if (IS_NAN (ent->v.origin[i])) return false;
+	}
+
+	return true;
+}
+
+
+static void SV_TossSnap (svtosssnap_t *snap, edict_t *ent)
+{
+	// these get memcmp'ed so the padding has to match too
+	memset (snap, 0, sizeof (svtosssnap_t));
+
+	snap->ent = ent;
+	snap->solid = ent->v.solid;
+	snap->owner = ent->v.owner;
+	snap->flags = ent->v.flags;
+	snap->modelindex = ent->v.modelindex;
+
+	VectorCopy (ent->v.origin, snap->origin);
+	VectorCopy (ent->v.angles, snap->angles);
+	VectorCopy (ent->v.mins, snap->mins);
+	VectorCopy (ent->v.maxs, snap->maxs);
+	VectorCopy (ent->v.size, snap->size);
+}
+
+
+static void SV_TossSnapBox (svtossjob_t *job)
+{
+	// one more than we can keep so that we know if there were too many
+	edict_t *list[SV_TOSSMAXSNAPS + 1];
+	int count = SV_AreaEdictsInBox (job->boxmins, job->boxmaxs, list, SV_TOSSMAXSNAPS + 1, job->ent);
+
+	if (count > SV_TOSSMAXSNAPS)
+	{
+		job->numsnaps = -1;
+		return;
+	}
+
+	for (int i = 0; i < count; i++)
+		SV_TossSnap (&job->snaps[i], list[i]);
+
+	job->numsnaps = count;
+}
+
+
+static bool SV_TossSnapsChanged (svtossjob_t *job)
+{
+	if (job->numsnaps < 0) return true;
+
+	for (int i = 0; i < job->numsnaps; i++)
+	{
+		svtosssnap_t now;
+
+		SV_TossSnap (&now, job->snaps[i].ent);
+
+		if (job->snaps[i].ent->free) return true;
+		if (memcmp (&now, &job->snaps[i], sizeof (svtosssnap_t))) return true;
+	}
+
+	return false;
+}
+
+
+static void SV_TossJob (void *data, int first, int count)
+{
+	svtossphase_t *phase = (svtossphase_t *) data;
+
+	for (int i = first; i < first + count; i++)
+	{
+		svtossjob_t *job = &phase->jobs[i];
+		edict_t *ent = job->ent;
+		vec3_t move, end;
+
+		memcpy (job->fields, &ent->v, phase->fieldsize);
+
+		// this is SV_Physics_Toss up to the trace, with the results kept in the job instead of the entity
+		VectorCopy (ent->v.velocity, job->velocity);
+		SV_BoundVelocity (job->velocity);
+
+		if (ent->v.movetype != MOVETYPE_FLY && ent->v.movetype != MOVETYPE_FLYMISSILE)
+			SV_ApplyGravity (ent, job->velocity, phase->frametime);
+
+		VectorMad (ent->v.angles, phase->frametime, ent->v.avelocity, job->angles);
+
+		VectorScale (job->velocity, phase->frametime, move);
+		job->trace = SV_PushTrace (ent, move);
+
+		// everything the trace could have hit (missiles check monsters with a bigger box)
+		VectorAdd (ent->v.origin, move, end);
+
+		for (int j = 0; j < 3; j++)
+		{
+			float mins = ent->v.mins[j] < -15 ? ent->v.mins[j] : -15;
+			float maxs = ent->v.maxs[j] > 15 ? ent->v.maxs[j] : 15;
+
+			if (end[j] > ent->v.origin[j])
+			{
+				job->boxmins[j] = ent->v.origin[j] + mins - 2;
+				job->boxmaxs[j] = end[j] + maxs + 2;
+			}
+			else
+			{
+				job->boxmins[j] = end[j] + mins - 2;
+				job->boxmaxs[j] = ent->v.origin[j] + maxs + 2;
+			}
+		}
+
+		// entities that don't move can still change in ways that matter to the trace, like a corpse going SOLID_NOT
+		SV_TossSnapBox (job);
+	}
+}
+
+
+static void SV_BeginTossPhase (svtossphase_t *phase, CScratchMark &mark, double frametime)
+{
+	memset (phase, 0, sizeof (svtossphase_t));
+
+	if (!sv_parallelphysics.value) return;
+
+	// everything gets relinked this frame so there's nothing to gain
+	if (SVProgs->GlobalStruct->force_retouch) return;
+
+	phase->numents = SVProgs->NumEdicts;
+	phase->fieldsize = SVProgs->QC->entityfields * 4;
+	phase->frametime = frametime;
+	phase->entjobs = (svtossjob_t **) mark.Alloc (phase->numents * sizeof (svtossjob_t *));
+	phase->jobs = (svtossjob_t *) mark.Alloc (phase->numents * sizeof (svtossjob_t));
+
+	for (int i = 0; i < phase->numents; i++)
+	{
+		edict_t *ent = SVProgs->EdictPointers[i];
+
+		if (!SV_CanRunTossJob (ent, i, frametime)) continue;
+
+		svtossjob_t *job = &phase->jobs[phase->numjobs++];
+
+		job->ent = ent;
+		job->fields = (int *) mark.Alloc (phase->fieldsize);
+		job->snaps = (svtosssnap_t *) mark.Alloc (SV_TOSSMAXSNAPS * sizeof (svtosssnap_t));
+		phase->entjobs[i] = job;
+	}
+
+	if (!phase->numjobs) return;
+
+	SV_RunJob (SV_TossJob, phase, phase->numjobs, SV_TOSSCHUNK);
+
+	// from here on anything that moves could get in the way
+	SV_BeginMoveTracking ();
+}
+
+
+static bool SV_FinishTossJob (svtossphase_t *phase, int num)
+{
+	if (num >= phase->numents || !phase->entjobs[num]) return false;
+
+	svtossjob_t *job = phase->entjobs[num];
+	edict_t *ent = job->ent;
+
+	// something earlier in the frame has changed the entity or moved into it's way so it has to be run again
+	if (ent->free) return false;
+	if (memcmp (job->fields, &ent->v, phase->fieldsize)) return false;
+	if (SV_MovedInBox (job->boxmins, job->boxmaxs)) return false;
+	if (SV_TossSnapsChanged (job)) return false;
+
+	VectorCopy (job->velocity, ent->v.velocity);
+	VectorCopy (job->angles, ent->v.angles);
+
+	SV_FinishPush (ent, &job->trace);
+	SV_FinishToss (ent, &job->trace);
+
+	return true;
+}
+
+
 /*
 ================
 SV_Physics
@@ -1433,14 +1718,27 @@ void SV_Physics (double frametime)
 	int		i;
 	edict_t	*ent;
 
+	// nothing is walking the areanodes yet so this is a safe place to resize them
+	SV_AdaptAreaNodes (false);
+	SV_BeginTriggerFrame ();
+
 	// let the progs know that a new frame has started
 	SVProgs->GlobalStruct->self = EDICT_TO_PROG (SVProgs->EdictPointers[0]);
 	SVProgs->GlobalStruct->other = EDICT_TO_PROG (SVProgs->EdictPointers[0]);
 	SVProgs->GlobalStruct->time = sv.time;
+
+	double startframe = SV_ProfileTime ();
 	SVProgs->ExecuteProgram (SVProgs->GlobalStruct->StartFrame);
+	SV_ProfileAdd (SVPROF_STARTFRAME, startframe);
 
 	//SV_CheckAllEnts ();
 
+	// work out projectile moves on the worker threads if we're doing that
+	CScratchMark mark;
+	svtossphase_t phase;
+
+	SV_BeginTossPhase (&phase, mark, frametime);
+
 	// treat each object in turn
 	ent = SVProgs->EdictPointers[0];
 
@@ -1452,6 +1750,10 @@ void SV_Physics (double frametime)
 		if (SVProgs->GlobalStruct->force_retouch)
 			SV_LinkEdict (ent, true);	// force retouch even for stationary
 
+		// the movetype can change in a think so the profile takes it from before
+		double movestart = SV_ProfileTime ();
+		int movetype = (i > 0 && i <= svs.maxclients) ? -1 : (int) ent->v.movetype;
+
 		if (i > 0 && i <= svs.maxclients)
 			SV_Physics_Client (ent, i, frametime);
 		else if (ent->v.movetype == MOVETYPE_PUSH)
@@ -1466,10 +1768,17 @@ void SV_Physics (double frametime)
 			SV_Physics_Step (ent, frametime);
 		else if (ent->v.movetype == MOVETYPE_TOSS || ent->v.movetype == MOVETYPE_BOUNCE ||
 				 ent->v.movetype == MOVETYPE_FLY || ent->v.movetype == MOVETYPE_FLYMISSILE)
-			SV_Physics_Toss (ent, frametime);
+		{
+			if (!SV_FinishTossJob (&phase, i))
+				SV_Physics_Toss (ent, frametime);
+		}
 		else Sys_Error ("SV_Physics: bad movetype %i", (int) ent->v.movetype);
+
+		SV_ProfileMove (movetype, movestart);
 	}
 
+	SV_EndMoveTracking ();
+
 	if (SVProgs->GlobalStruct->force_retouch)
 		SVProgs->GlobalStruct->force_retouch--;
 
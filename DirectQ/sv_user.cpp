@@ -586,6 +586,8 @@ nextmsg:
 					ret = 1;
 				else if (_strnicmp (s, "ban", 3) == 0)
 					ret = 1;
+				else if (_strnicmp (s, "deltaframes", 11) == 0)
+					ret = 1;
 
 				if (ret == 2)
 					Cbuf_InsertText (s);
@@ -601,6 +603,17 @@ nextmsg:
 			case clc_move:
 				SV_ReadClientMove (&host_client->cmd);
 				break;
+
+			case clc_deltaack:
+				{
+					// the last delta frame the client got; anything we haven't sent yet is garbage
+					int ack = MSG_ReadLong ();
+
+					if (host_client->deltaenabled && ack > 0 && ack <= host_client->deltasequence)
+						host_client->deltaack = ack;
+					else host_client->deltaack = 0;
+				}
+				break;
 			}
 		}
 	} while (ret == 1);
@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "d3d_model.h"
 #include "pr_class.h"
+#include <float.h>
+#include <xmmintrin.h>
 
 /*
 
@@ -35,6 +37,9 @@ line of sight checks trace->crosscontent, but bullets don't
 // each will need to recache during their own slice of the frame anyway so this is safe to do
 float sv_frame = -1;
 
+// set on the worker threads
+static __declspec (thread) bool sv_workerthread = false;
+
 float SV_PlaneDist (struct mplane_s *plane, float *org)
 {
 	// for axial planes it's quicker to just eval the dist and there's no need to cache;
@@ -108,9 +113,10 @@ HULL BOXES
 */
 
 
-static	hull_t		box_hull;
-static	mclipnode_t	box_clipnodes[6];
-static	mplane_t	box_planes[6];
+// each thread has it's own so that the worker threads can trace against boxes too
+static	__declspec (thread) hull_t		box_hull;
+static	__declspec (thread) mclipnode_t	box_clipnodes[6];
+static	__declspec (thread) mplane_t	box_planes[6];
 
 /*
 ===================
@@ -155,6 +161,9 @@ BSP trees instead of being compared directly.
 */
 hull_t *SV_HullForBox (vec3_t mins, vec3_t maxs)
 {
+	// worker threads set theirs up the first time
+	if (!box_hull.clipnodes) SV_InitBoxHull ();
+
 	box_planes[0].dist = maxs[0];
 	box_planes[1].dist = mins[0];
 	box_planes[2].dist = maxs[1];
@@ -229,6 +238,19 @@ ENTITY AREA CHECKING
 ===============================================================================
 */
 
+// the boxes of the edicts in one areanode list as a structure of arrays, in the same order as the list, so that
+// the clip and touch loops can reject 4 at a time without going near the edicts themselves.  unlinked edicts
+// leave a hole with an inside out box that nothing can overlap until there are enough to be worth squeezing out.
+typedef struct areamirror_s
+{
+	float	*absmin[3];
+	float	*absmax[3];
+	edict_t	**edicts;		// NULL for a hole
+	int		count;			// including holes; the arrays are padded with holes to a multiple of 4 past this
+	int		holes;
+	int		max;
+} areamirror_t;
+
 typedef struct areanode_s
 {
 	int		axis;		// -1 = leaf node
@@ -236,13 +258,159 @@ typedef struct areanode_s
 	struct areanode_s	*children[2];
 	link_t	trigger_edicts;
 	link_t	solid_edicts;
+	areamirror_t	trigger_mirror;
+	areamirror_t	solid_mirror;
 } areanode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+// the tree is sized to the map and the number of linked entities.  it never gets shallower than the original
+// fixed tree, and it stops splitting once nodes get small enough that entities would mostly cross the split.
+#define	AREA_MINDEPTH		4
+#define	AREA_MAXDEPTH		8
+#define	AREA_NODES			((2 << AREA_MAXDEPTH) - 1)
+#define	AREA_MINNODESIZE	256		// don't split a node that's already this small
+#define	AREA_LEAFEDICTS		16		// aim for about this many edicts per leaf
 
 static	areanode_t	sv_areanodes[AREA_NODES];
 static	int			sv_numareanodes;
+static	int			sv_areadepth = AREA_MINDEPTH;
+static	bool		sv_areazsplit = false;
+static	int			sv_numarealinks = 0;	// edicts currently linked into the tree
+
+// 0 = the original fixed 32 node tree that only splits on x and y, 1 = sized per map and entity count
+cvar_t sv_areanodes_adaptive ("sv_areanodes_adaptive", "1");
+
+
+static void SV_MirrorSetHole (areamirror_t *m, int slot)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		m->absmin[i][slot] = FLT_MAX;
+		m->absmax[i][slot] = -FLT_MAX;
+	}
+
+	m->edicts[slot] = NULL;
+}
+
+
+static void SV_MirrorResize (areamirror_t *m, int newmax)
+{
+	// squeezes out the holes as it goes; one block holds all of the arrays
+	byte *block = (byte *) Zone_Alloc (newmax * (6 * sizeof (float) + sizeof (edict_t *)), false);
+	areamirror_t old = *m;
+	int count = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		m->absmin[i] = (float *) block; block += newmax * sizeof (float);
+		m->absmax[i] = (float *) block; block += newmax * sizeof (float);
+	}
+
+	m->edicts = (edict_t **) block;
+
+	for (int slot = 0; slot < old.count; slot++)
+	{
+		if (!old.edicts[slot]) continue;
+
+		for (int i = 0; i < 3; i++)
+		{
+			m->absmin[i][count] = old.absmin[i][slot];
+			m->absmax[i][count] = old.absmax[i][slot];
+		}
+
+		m->edicts[count] = old.edicts[slot];
+		m->edicts[count]->areaslot = count;
+		count++;
+	}
+
+	m->count = count;
+	m->holes = 0;
+	m->max = newmax;
+
+	for (int slot = count; slot < newmax; slot++)
+		SV_MirrorSetHole (m, slot);
+
+	if (old.max) Zone_Free (old.absmin[0]);
+}
+
+
+static void SV_MirrorFree (areamirror_t *m)
+{
+	if (m->max) Zone_Free (m->absmin[0]);
+
+	memset (m, 0, sizeof (areamirror_t));
+}
+
+
+static void SV_MirrorAdd (areamirror_t *m, edict_t *ent)
+{
+	if (m->count >= m->max)
+	{
+		// squeeze in place if a quarter of it is holes, otherwise grow; max is always a multiple of 4
+		if (m->holes >= m->max / 4 && m->max)
+			SV_MirrorResize (m, m->max);
+		else SV_MirrorResize (m, m->max ? m->max * 2 : 16);
+	}
+
+	int slot = m->count++;
+
+	for (int i = 0; i < 3; i++)
+	{
+		m->absmin[i][slot] = ent->v.absmin[i];
+		m->absmax[i][slot] = ent->v.absmax[i];
+	}
+
+	m->edicts[slot] = ent;
+
+	ent->areamirror = m;
+	ent->areaslot = slot;
+}
+
+
+static void SV_MirrorRemove (edict_t *ent)
+{
+	areamirror_t *m = ent->areamirror;
+
+	SV_MirrorSetHole (m, ent->areaslot);
+	m->holes++;
+
+	ent->areamirror = NULL;
+	ent->areaslot = -1;
+
+	if (m->holes == m->count)
+	{
+		// empty so it can start from the front again
+		m->count = m->holes = 0;
+	}
+	else if (m->holes > 32 && m->holes * 2 > m->count)
+		SV_MirrorResize (m, m->max);
+}
+
+
+static inline int SV_MirrorOverlaps (areamirror_t *m, int first, __m128 *mins, __m128 *maxs)
+{
+	// bit n is set if the box at first + n touches mins/maxs.  holes are an inside-out FLT_MAX box so they never do
+	// unless mins/maxs has a NaN in it, which the old list walk let through to every entity, so the callers must
+	// still skip holes by their NULL edict
+	__m128 out = _mm_setzero_ps ();
+
+	for (int i = 0; i < 3; i++)
+	{
+		out = _mm_or_ps (out, _mm_cmpgt_ps (mins[i], _mm_loadu_ps (m->absmax[i] + first)));
+		out = _mm_or_ps (out, _mm_cmplt_ps (maxs[i], _mm_loadu_ps (m->absmin[i] + first)));
+	}
+
+	return ~_mm_movemask_ps (out) & 15;
+}
+
+
+static inline void SV_MirrorBox (float *absmin, float *absmax, __m128 *mins, __m128 *maxs)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		mins[i] = _mm_set1_ps (absmin[i]);
+		maxs[i] = _mm_set1_ps (absmax[i]);
+	}
+}
 
 /*
 ===============
@@ -261,20 +429,26 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 
 	ClearLink (&anode->trigger_edicts);
 	ClearLink (&anode->solid_edicts);
+	memset (&anode->trigger_mirror, 0, sizeof (areamirror_t));
+	memset (&anode->solid_mirror, 0, sizeof (areamirror_t));
+
+	VectorSubtract (maxs, mins, size);
 
-	if (depth == AREA_DEPTH)
+	if (depth == sv_areadepth || (sv_areazsplit && size[0] < AREA_MINNODESIZE && size[1] < AREA_MINNODESIZE && size[2] < AREA_MINNODESIZE))
 	{
 		anode->axis = -1;
 		anode->children[0] = anode->children[1] = NULL;
 		return anode;
 	}
 
-	VectorSubtract (maxs, mins, size);
-
 	if (size[0] > size[1])
 		anode->axis = 0;
 	else anode->axis = 1;
 
+	// tall maps get split on z too
+	if (sv_areazsplit && size[2] > size[anode->axis])
+		anode->axis = 2;
+
 	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
 	VectorCopy (mins, mins1);
 	VectorCopy (mins, mins2);
@@ -289,15 +463,31 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 	return anode;
 }
 
-/*
-===============
-SV_ClearWorld
 
-===============
-*/
-void SV_ClearWorld (void)
+static int SV_AreaDepthForCount (int numlinks)
 {
-	SV_InitBoxHull ();
+	if (!sv_areanodes_adaptive.integer) return AREA_MINDEPTH;
+
+	int depth = AREA_MINDEPTH;
+
+	// each level halves the edicts per leaf
+	while (depth < AREA_MAXDEPTH && (numlinks >> depth) > AREA_LEAFEDICTS)
+		depth++;
+
+	return depth;
+}
+
+
+static void SV_BuildAreaNodes (int depth, bool zsplit)
+{
+	sv_areadepth = depth;
+	sv_areazsplit = zsplit;
+
+	for (int i = 0; i < sv_numareanodes; i++)
+	{
+		SV_MirrorFree (&sv_areanodes[i].trigger_mirror);
+		SV_MirrorFree (&sv_areanodes[i].solid_mirror);
+	}
 
 	memset (sv_areanodes, 0, sizeof (sv_areanodes));
 	sv_numareanodes = 0;
@@ -306,351 +496,1532 @@ void SV_ClearWorld (void)
 
 
 /*
-===============
-SV_UnlinkEdict
+===============================================================================
 
-===============
+MOVE TRACKING
+
+work that's done up front for a frame (see SV_Physics) is only still good if nothing has been linked or
+unlinked in it's way since, so while tracking is on the box of everything that's linked or unlinked is kept.
+
+===============================================================================
 */
-void SV_UnlinkEdict (edict_t *ent)
+
+#define MAX_TRACKED_MOVES	4096
+
+static bool sv_trackmoves = false;
+static bool sv_trackoverflow = false;
+static int sv_numtrackedmoves = 0;
+static float sv_trackedmoves[MAX_TRACKED_MOVES][6];
+
+
+static void SV_TrackMove (edict_t *ent)
 {
-	if (!ent->area.prev)
-		return;		// not linked in anywhere
+	if (!sv_trackmoves) return;
 
-	RemoveLink (&ent->area);
-	ent->area.prev = ent->area.next = NULL;
+	if (sv_numtrackedmoves >= MAX_TRACKED_MOVES)
+	{
+		// everything is in the way from here on
+		sv_trackoverflow = true;
+		return;
+	}
+
+	float *box = sv_trackedmoves[sv_numtrackedmoves++];
+
+	VectorCopy (ent->v.absmin, &box[0]);
+	VectorCopy (ent->v.absmax, &box[3]);
 }
 
 
-/*
-====================
-SV_TouchLinks
+void SV_BeginMoveTracking (void)
+{
+	sv_trackmoves = true;
+	sv_trackoverflow = false;
+	sv_numtrackedmoves = 0;
+}
 
-====================
-*/
-void SV_TouchLinks (edict_t *ent, areanode_t *node)
+
+void SV_EndMoveTracking (void)
 {
-	link_t *l;
-	edict_t	*touch;
-	int	old_self, old_other, touched = 0, i;
+	sv_trackmoves = false;
+}
 
-	// Static due to recursive function
-	edict_t **list = (edict_t **) scratchbuf;
 
-loc0:;
-	// ensure
-	touched = 0;
+bool SV_MovedInBox (vec3_t mins, vec3_t maxs)
+{
+	if (sv_trackoverflow) return true;
 
-	// Build a list of touched edicts since linked list may change during touch
-	for (l = node->trigger_edicts.next; l != &node->trigger_edicts; l = l->next)
+	for (int i = 0; i < sv_numtrackedmoves; i++)
 	{
-		touch = EDICT_FROM_AREA (l);
+		float *box = sv_trackedmoves[i];
 
-		if (touch == ent) continue;
-		if (touch->free) continue;
-		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER) continue;
+		if (mins[0] > box[3] || mins[1] > box[4] || mins[2] > box[5]) continue;
+		if (maxs[0] < box[0] || maxs[1] < box[1] || maxs[2] < box[2]) continue;
 
-		if (ent->v.absmin[0] > touch->v.absmax[0] || ent->v.absmin[1] > touch->v.absmax[1] || ent->v.absmin[2] > touch->v.absmax[2] ||
-			ent->v.absmax[0] < touch->v.absmin[0] || ent->v.absmax[1] < touch->v.absmin[1] || ent->v.absmax[2] < touch->v.absmin[2])
-			continue;
+		return true;
+	}
 
-		list[touched++] = touch;
+	return false;
+}
 
-		if (touched == MAX_EDICTS)
-		{
-			Con_DPrintf ("SV_TouchLinks: ");
-			Con_DPrintf ("too many touched trigger_edicts (max = %d)\n", MAX_EDICTS);
-			break;
-		}
-	}
 
-	// touch linked edicts
-	for (i = 0; i < touched; ++i)
-	{
-		if (!(touch = list[i])) continue;
+/*
+===============================================================================
 
-		old_self = SVProgs->GlobalStruct->self;
-		old_other = SVProgs->GlobalStruct->other;
+TRIGGER BROADPHASE
 
-		SVProgs->GlobalStruct->self = EDICT_TO_PROG (touch);
-		SVProgs->GlobalStruct->other = EDICT_TO_PROG (ent);
-		SVProgs->GlobalStruct->time = sv.time;
-		SVProgs->ExecuteProgram (touch->v.touch);
+SV_TouchLinks walks every trigger list that the mover's box reaches and box tests each trigger in them, for every
+mover that links with touch_triggers.  most movers aren't touching any trigger at all, so once a frame the
+triggers are put in a 2D grid and SV_TouchLinks asks that first; if nothing in the grid can touch the box there's
+no need to walk at all.  when something can the lists are walked exactly as before, so the snapshot for each node
+and the order of the touch calls don't change.
 
-		SVProgs->GlobalStruct->self = old_self;
-		SVProgs->GlobalStruct->other = old_other;
-	}
+triggers linked after the grid is built go on a list that's checked as well, and grid entries for triggers that
+have since moved or gone are tested against their current state and box the same as SV_TouchLinks does, so the
+grid may say yes when the walk would find nothing but never the other way around.  the one thing it can't see is
+QC writing absmin or absmax directly without relinking.
 
-	// recurse down both sides
-	if (node->axis == -1)
-		return;
+===============================================================================
+*/
 
-	if (ent->v.absmax[node->axis] > node->dist)
-	{
-		// order reversed to reduce code
-		if (ent->v.absmin[node->axis] < node->dist) SV_TouchLinks (ent, node->children[1]);
+#define TGRID_MINCELL		128
+#define TGRID_MAXCELLS		64		// on each axis
+#define MAX_NEW_TRIGGERS	1024
 
-		node = node->children[0];
-		goto loc0;
-	}
-	else
-	{
-		if (ent->v.absmin[node->axis] < node->dist)
-		{
-			node = node->children[1];
-			goto loc0;
-		}
-	}
+cvar_t sv_triggergrid ("sv_triggergrid", "1");
+
+typedef struct tgrid_s
+{
+	bool built;			// for this frame
+	bool broken;		// too many triggers were linked since it was built so everything is walked for the rest of the frame
+
+	float origin[2];
+	float cellsize;
+	int size[2];
+
+	int *cellstart;		// first entry for each cell, and one past the last at the end
+	int maxcells;
+
+	edict_t **entries;
+	int numentries;
+	int maxentries;
+
+	edict_t *newtriggers[MAX_NEW_TRIGGERS];
+	int numnew;
+} tgrid_t;
+
+static tgrid_t sv_tgrid;
+
+
+void SV_BeginTriggerFrame (void)
+{
+	sv_tgrid.built = false;
 }
 
 
-void SV_RotateBBoxToBBox (edict_t *ent, float *bbmin, float *bbmax, float *rmins, float *rmaxs)
-{
-	vec3_t bbox[8];
-	avectors_t av;
-
-	// compute a full bounding box
-	for (int i = 0; i < 8; i++)
+static void SV_NoteNewTrigger (edict_t *ent)
+{
+	// if it's not built yet the build will find it
+	if (!sv_tgrid.built || sv_tgrid.broken) return;
+
+	if (sv_tgrid.numnew >= MAX_NEW_TRIGGERS)
+		sv_tgrid.broken = true;
+	else sv_tgrid.newtriggers[sv_tgrid.numnew++] = ent;
+}
+
+
+static void SV_TriggerCells (float *absmin, float *absmax, int *cells)
+{
+	// x and y cell ranges; anything off the edges goes in the edge cells
+	for (int i = 0; i < 2; i++)
 	{
-		bbox[i][0] = (i & 1) ? bbmin[0] : bbmax[0];
-		bbox[i][1] = (i & 2) ? bbmin[1] : bbmax[1];
-		bbox[i][2] = (i & 4) ? bbmin[2] : bbmax[2];
+		float lo = floor ((absmin[i] - sv_tgrid.origin[i]) / sv_tgrid.cellsize);
+		float hi = floor ((absmax[i] - sv_tgrid.origin[i]) / sv_tgrid.cellsize);
+
+		cells[i] = (lo < 0) ? 0 : ((lo >= sv_tgrid.size[i]) ? sv_tgrid.size[i] - 1 : (int) lo);
+		cells[i + 2] = (hi < 0) ? 0 : ((hi >= sv_tgrid.size[i]) ? sv_tgrid.size[i] - 1 : (int) hi);
 	}
-
-	// derive forward/right/up vectors from the angles
-	AngleVectors (ent->v.angles, &av);
+}
 
-	// compute the rotated bbox corners
-	Mod_ClearBoundingBox (rmins, rmaxs);
 
-	// and rotate the bounding box
-	for (int i = 0; i < 8; i++)
-	{
-		vec3_t tmp;
+static void SV_BuildTriggerGrid (void)
+{
+	// size the cells so that the world fits in TGRID_MAXCELLS either way
+	float extent = sv.worldmodel->maxs[0] - sv.worldmodel->mins[0];
 
-		VectorCopy (bbox[i], tmp);
+	if (sv.worldmodel->maxs[1] - sv.worldmodel->mins[1] > extent) extent = sv.worldmodel->maxs[1] - sv.worldmodel->mins[1];
 
-		bbox[i][0] = DotProduct (av.forward, tmp);
-		bbox[i][1] = -DotProduct (av.right, tmp);
-		bbox[i][2] = DotProduct (av.up, tmp);
+	sv_tgrid.cellsize = extent / TGRID_MAXCELLS;
 
-		// and convert them to mins and maxs
-		Mod_AccumulateBox (rmins, rmaxs, bbox[i]);
+	if (sv_tgrid.cellsize < TGRID_MINCELL) sv_tgrid.cellsize = TGRID_MINCELL;
+
+	for (int i = 0; i < 2; i++)
+	{
+		sv_tgrid.origin[i] = sv.worldmodel->mins[i];
+		sv_tgrid.size[i] = (int) ceil ((sv.worldmodel->maxs[i] - sv.worldmodel->mins[i]) / sv_tgrid.cellsize);
+
+		if (sv_tgrid.size[i] < 1) sv_tgrid.size[i] = 1;
+		if (sv_tgrid.size[i] > TGRID_MAXCELLS) sv_tgrid.size[i] = TGRID_MAXCELLS;
 	}
-}
-
 
-void SV_RotateBBoxToAbsMinMax (edict_t *ent)
-{
-	float mins[3];
-	float maxs[3];
-	vec3_t bbox[8];
-	avectors_t av;
-
-	// compute a full bounding box
-	for (int i = 0; i < 8; i++)
+	int numcells = sv_tgrid.size[0] * sv_tgrid.size[1];
+
+	if (numcells + 1 > sv_tgrid.maxcells)
 	{
-		bbox[i][0] = (i & 1) ? ent->v.mins[0] : ent->v.maxs[0];
-		bbox[i][1] = (i & 2) ? ent->v.mins[1] : ent->v.maxs[1];
-		bbox[i][2] = (i & 4) ? ent->v.mins[2] : ent->v.maxs[2];
+		if (sv_tgrid.cellstart) Zone_Free (sv_tgrid.cellstart);
+
+		sv_tgrid.maxcells = TGRID_MAXCELLS * TGRID_MAXCELLS + 1;
+		sv_tgrid.cellstart = (int *) Zone_Alloc (sv_tgrid.maxcells * sizeof (int));
 	}
-
-	// derive forward/right/up vectors from the angles
-	AngleVectors (ent->v.angles, &av);
 
-	// compute the rotated bbox corners
-	Mod_ClearBoundingBox (mins, maxs);
+	memset (sv_tgrid.cellstart, 0, (numcells + 1) * sizeof (int));
 
-	// and rotate the bounding box
-	for (int i = 0; i < 8; i++)
+	// count what goes in each cell; everything in a trigger list is a trigger as far as SV_TouchLinks is concerned
+	int cells[4];
+	int total = 0;
+
+	for (int n = 0; n < sv_numareanodes; n++)
 	{
-		vec3_t tmp;
+		link_t *list = &sv_areanodes[n].trigger_edicts;
 
-		VectorCopy (bbox[i], tmp);
+		for (link_t *l = list->next; l != list; l = l->next)
+		{
+			edict_t *touch = EDICT_FROM_AREA (l);
 
-		bbox[i][0] = DotProduct (av.forward, tmp);
-		bbox[i][1] = -DotProduct (av.right, tmp);
-		bbox[i][2] = DotProduct (av.up, tmp);
+			SV_TriggerCells (touch->v.absmin, touch->v.absmax, cells);
 
-		// and convert them to mins and maxs
-		Mod_AccumulateBox (mins, maxs, bbox[i]);
+			for (int y = cells[1]; y <= cells[3]; y++)
+			{
+				for (int x = cells[0]; x <= cells[2]; x++)
+				{
+					sv_tgrid.cellstart[y * sv_tgrid.size[0] + x]++;
+					total++;
+				}
+			}
+		}
 	}
 
-	// translate the bbox to it's final position at the entity origin
-	VectorAdd (ent->v.origin, mins, ent->v.absmin);
-	VectorAdd (ent->v.origin, maxs, ent->v.absmax);
+	if (total > sv_tgrid.maxentries)
+	{
+		if (sv_tgrid.entries) Zone_Free (sv_tgrid.entries);
 
-	// Con_Printf ("%f %f %f\n", ent->v.angles[0], ent->v.angles[1], ent->v.angles[2]);
-}
-
+		for (sv_tgrid.maxentries = 1024; sv_tgrid.maxentries < total; sv_tgrid.maxentries <<= 1);
 
-void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
-{
-	if (node->contents == CONTENTS_SOLID) return;
+		sv_tgrid.entries = (edict_t **) Zone_Alloc (sv_tgrid.maxentries * sizeof (edict_t *), false);
+	}
 
-	// add an efrag if the node is a leaf
-	if (node->contents < 0)
+	// turn the counts into the end of each cell, then fill backwards so that they end up at the start
+	for (int c = 0, end = 0; c <= numcells; c++)
 	{
-		mleaf_t *leaf = (mleaf_t *) node;
+		end += sv_tgrid.cellstart[c];
+		sv_tgrid.cellstart[c] = end;
+	}
 
-		if (ent->num_leafs < MAX_ENT_LEAFS)
+	for (int n = 0; n < sv_numareanodes; n++)
+	{
+		link_t *list = &sv_areanodes[n].trigger_edicts;
+
+		for (link_t *l = list->next; l != list; l = l->next)
 		{
-			ent->leafnums[ent->num_leafs] = ((mleaf_t *) node) - sv.worldmodel->brushhdr->leafs - 1;
-			ent->num_leafs++;
+			edict_t *touch = EDICT_FROM_AREA (l);
+
+			SV_TriggerCells (touch->v.absmin, touch->v.absmax, cells);
+
+			for (int y = cells[1]; y <= cells[3]; y++)
+				for (int x = cells[0]; x <= cells[2]; x++)
+					sv_tgrid.entries[--sv_tgrid.cellstart[y * sv_tgrid.size[0] + x]] = touch;
 		}
+	}
 
-		return;
+	sv_tgrid.numentries = total;
+	sv_tgrid.numnew = 0;
+	sv_tgrid.broken = false;
+	sv_tgrid.built = true;
+}
+
+
+static bool SV_TriggerMayTouch (edict_t *ent, edict_t *touch)
+{
+	// the same tests SV_TouchLinks makes, less which list the trigger is in
+	if (touch == ent) return false;
+	if (touch->free) return false;
+	if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER) return false;
+
+	if (ent->v.absmin[0] > touch->v.absmax[0] || ent->v.absmin[1] > touch->v.absmax[1] || ent->v.absmin[2] > touch->v.absmax[2] ||
+		ent->v.absmax[0] < touch->v.absmin[0] || ent->v.absmax[1] < touch->v.absmin[1] || ent->v.absmax[2] < touch->v.absmin[2])
+		return false;
+
+	return true;
+}
+
+
+static bool SV_TriggersNear (edict_t *ent)
+{
+	if (!sv_tgrid.built) SV_BuildTriggerGrid ();
+	if (sv_tgrid.broken) return true;
+
+	for (int i = 0; i < sv_tgrid.numnew; i++)
+		if (SV_TriggerMayTouch (ent, sv_tgrid.newtriggers[i]))
+			return true;
+
+	int cells[4];
+
+	SV_TriggerCells (ent->v.absmin, ent->v.absmax, cells);
+
+	for (int y = cells[1]; y <= cells[3]; y++)
+	{
+		for (int x = cells[0]; x <= cells[2]; x++)
+		{
+			int c = y * sv_tgrid.size[0] + x;
+
+			for (int i = sv_tgrid.cellstart[c]; i < sv_tgrid.cellstart[c + 1]; i++)
+				if (SV_TriggerMayTouch (ent, sv_tgrid.entries[i]))
+					return true;
+		}
 	}
 
-	// split on this plane
-	int sides = SphereOnPlaneSide (ent->bsphere, ent->bsphere[3], node->plane);
+	return false;
+}
 
-	// recurse down the contacted sides
-	if (sides & 1) SV_FindTouchedLeafs (ent, node->children[0]);
-	if (sides & 2) SV_FindTouchedLeafs (ent, node->children[1]);
+
+static void SV_LinkToAreaNode (edict_t *ent)
+{
+	SV_TrackMove (ent);
+	// find the first node that the ent's box crosses
+	areanode_t *node = sv_areanodes;
+
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+
+		if (ent->v.absmin[node->axis] > node->dist)
+			node = node->children[0];
+		else if (ent->v.absmax[node->axis] < node->dist)
+			node = node->children[1];
+		else break;		// crosses the node
+	}
+
+	// link it in
+	if (ent->v.solid == SOLID_TRIGGER)
+	{
+		InsertLinkBefore (&ent->area, &node->trigger_edicts);
+		SV_MirrorAdd (&node->trigger_mirror, ent);
+		SV_NoteNewTrigger (ent);
+	}
+	else
+	{
+		InsertLinkBefore (&ent->area, &node->solid_edicts);
+		SV_MirrorAdd (&node->solid_mirror, ent);
+	}
+
+	sv_numarealinks++;
+}
+
+
+static void SV_RelinkAreaNodes (int depth, bool zsplit)
+{
+	int numlinks = sv_numarealinks;
+
+	SV_BuildAreaNodes (depth, zsplit);
+
+	// relink everything that was linked; the boxes haven't changed so there's no need to go through SV_LinkEdict
+	sv_numarealinks = 0;
+
+	for (int i = 1; i < SVProgs->NumEdicts; i++)
+	{
+		edict_t *ed = SVProgs->EdictPointers[i];
+
+		if (!ed->area.prev) continue;
+
+		ed->area.prev = ed->area.next = NULL;
+		SV_LinkToAreaNode (ed);
+	}
+
+	// everything is in a different list now
+	sv_tgrid.built = false;
+
+	Con_DPrintf ("SV_RelinkAreaNodes : %i nodes at depth %i for %i edicts (%i before)\n", sv_numareanodes, sv_areadepth, sv_numarealinks, numlinks);
 }
 
 
 /*
 ===============
-SV_LinkEdict
+SV_AdaptAreaNodes
 
+rebuilds the tree if the number of linked edicts has moved far enough from what it was sized for.  this moves
+entities between lists so it must only be called when nothing is walking them (between frames).
 ===============
 */
-void SV_LinkEdict (edict_t *ent, bool touch_triggers)
+void SV_AdaptAreaNodes (bool force)
 {
-	// clear all touched leafs so that if the edict doesn't get linked it won't get added to the client PVS
-	ent->num_leafs = 0;
+	int depth = SV_AreaDepthForCount (sv_numarealinks);
 
-	if (ent->area.prev) SV_UnlinkEdict (ent);	// unlink from old position
-	if (ent == SVProgs->EdictPointers[0]) return;		// don't add the world
-	if (ent->free) return;
+	if (!force && sv_areazsplit == !!sv_areanodes_adaptive.integer)
+	{
+		// grow as soon as it's needed but only shrink when it's a full level out so that it doesn't thrash
+		if (depth <= sv_areadepth && depth >= sv_areadepth - 1) return;
+	}
 
-	if (ent->v.solid == SOLID_BSP && (ent->v.angles[0] || ent->v.angles[1] || ent->v.angles[2]) && ent != SVProgs->EdictPointers[0])
-		SV_RotateBBoxToAbsMinMax (ent);
-	else
+	SV_RelinkAreaNodes (depth, !!sv_areanodes_adaptive.integer);
+}
+
+
+/*
+===============
+SV_ClearWorld
+
+===============
+*/
+void SV_ClearWorld (void)
+{
+	SV_InitBoxHull ();
+
+	// nothing is linked yet so this starts at the minimum and grows as the map fills up
+	SV_BuildAreaNodes (AREA_MINDEPTH, !!sv_areanodes_adaptive.integer);
+	sv_numarealinks = 0;
+	sv_tgrid.built = false;
+}
+
+
+/*
+===============
+SV_UnlinkEdict
+
+===============
+*/
+void SV_UnlinkEdict (edict_t *ent)
+{
+	if (!ent->area.prev)
+		return;		// not linked in anywhere
+
+	SV_TrackMove (ent);
+	RemoveLink (&ent->area);
+	SV_MirrorRemove (ent);
+	ent->area.prev = ent->area.next = NULL;
+	sv_numarealinks--;
+}
+
+
+/*
+====================
+SV_TouchLinks
+
+====================
+*/
+void SV_TouchLinks (edict_t *ent, areanode_t *node)
+{
+	edict_t	*touch;
+	int	old_self, old_other, touched = 0, i;
+	CQuakeScratch *scratch = Scratch_Get ();
+	__m128 mins[3], maxs[3];
+
+	// most movers aren't touching any trigger so ask the broadphase before walking anything
+	if (node == sv_areanodes && sv_triggergrid.value && !SV_TriggersNear (ent)) return;
+
+loc0:;
+	// ensure
+	touched = 0;
+
+	// each node gets it's own list as the touch functions may relink and come back in here
+	int mark = scratch->GetMark ();
+	edict_t **list = (edict_t **) scratch->Alloc (SVProgs->NumEdicts * sizeof (edict_t *));
+
+	// the touch functions may have moved ent since the last node
+	SV_MirrorBox (ent->v.absmin, ent->v.absmax, mins, maxs);
+
+	// Build a list of touched edicts since linked list may change during touch
+	// the box test comes first from the mirror, then the rest in list order for whatever's left
+	for (int first = 0; first < node->trigger_mirror.count && touched < SVProgs->NumEdicts; first += 4)
 	{
-		// set the abs box
-		VectorAdd (ent->v.origin, ent->v.mins, ent->v.absmin);
-		VectorAdd (ent->v.origin, ent->v.maxs, ent->v.absmax);
+		for (int hits = SV_MirrorOverlaps (&node->trigger_mirror, first, mins, maxs), n = 0; hits; hits >>= 1, n++)
+		{
+			if (!(hits & 1)) continue;
+
+			touch = node->trigger_mirror.edicts[first + n];
+
+			if (!touch) continue;	// hole
+			if (touch == ent) continue;
+			if (touch->free) continue;
+			if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER) continue;
+
+			list[touched++] = touch;
+
+			if (touched == SVProgs->NumEdicts)
+			{
+				Con_DPrintf ("SV_TouchLinks: ");
+				Con_DPrintf ("too many touched trigger_edicts (max = %d)\n", SVProgs->NumEdicts);
+				break;
+			}
+		}
 	}
 
-	// to make items easier to pick up and allow them to be grabbed off
-	// of shelves, the abs sizes are expanded
-	if ((int) ent->v.flags & FL_ITEM)
+	// touch linked edicts
+	for (i = 0; i < touched; ++i)
 	{
-		ent->v.absmin[0] -= 15;
-		ent->v.absmin[1] -= 15;
-		ent->v.absmax[0] += 15;
-		ent->v.absmax[1] += 15;
+		if (!(touch = list[i])) continue;
+
+		old_self = SVProgs->GlobalStruct->self;
+		old_other = SVProgs->GlobalStruct->other;
+
+		SVProgs->GlobalStruct->self = EDICT_TO_PROG (touch);
+		SVProgs->GlobalStruct->other = EDICT_TO_PROG (ent);
+		SVProgs->GlobalStruct->time = sv.time;
+		SVProgs->ExecuteProgram (touch->v.touch);
+
+		SVProgs->GlobalStruct->self = old_self;
+		SVProgs->GlobalStruct->other = old_other;
+	}
+
+	scratch->FreeToMark (mark);
+
+	// recurse down both sides
+	if (node->axis == -1)
+		return;
+
+	if (ent->v.absmax[node->axis] > node->dist)
+	{
+		// order reversed to reduce code
+		if (ent->v.absmin[node->axis] < node->dist) SV_TouchLinks (ent, node->children[1]);
+
+		node = node->children[0];
+		goto loc0;
 	}
 	else
 	{
-		// because movement is clipped an epsilon away from an actual edge,
-		// we must fully check even when bounding boxes don't quite touch
-		ent->v.absmin[0] -= 1;
-		ent->v.absmin[1] -= 1;
-		ent->v.absmin[2] -= 1;
-		ent->v.absmax[0] += 1;
-		ent->v.absmax[1] += 1;
-		ent->v.absmax[2] += 1;
+		if (ent->v.absmin[node->axis] < node->dist)
+		{
+			node = node->children[1];
+			goto loc0;
+		}
+	}
+}
+
+
+/*
+===============
+SV_AreaEdicts
+
+===============
+*/
+int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount)
+{
+	areanode_t *stack[AREA_NODES];
+	int stackdepth = 0;
+	int count = 0;
+
+	stack[stackdepth++] = sv_areanodes;
+
+	while (stackdepth)
+	{
+		areanode_t *node = stack[--stackdepth];
+
+		// an edict is linked to the first node that it's box crosses, so anything whose box reaches into the
+		// query box is either here or further down on a side that the query box also reaches
+		for (link_t *l = node->solid_edicts.next; l != &node->solid_edicts; l = l->next)
+		{
+			if (count == maxcount) return count;
+			list[count++] = EDICT_FROM_AREA (l);
+		}
+
+		for (link_t *l = node->trigger_edicts.next; l != &node->trigger_edicts; l = l->next)
+		{
+			if (count == maxcount) return count;
+			list[count++] = EDICT_FROM_AREA (l);
+		}
+
+		if (node->axis == -1) continue;
+
+		if (maxs[node->axis] > node->dist) stack[stackdepth++] = node->children[0];
+		if (mins[node->axis] < node->dist) stack[stackdepth++] = node->children[1];
+	}
+
+	return count;
+}
+
+
+int SV_AreaEdictsInBox (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, edict_t *skip)
+{
+	areanode_t *stack[AREA_NODES];
+	int stackdepth = 0;
+	int count = 0;
+
+	stack[stackdepth++] = sv_areanodes;
+
+	while (stackdepth)
+	{
+		areanode_t *node = stack[--stackdepth];
+
+		// the same walk as SV_AreaEdicts but only what actually touches the box counts against maxcount
+		for (int i = 0; i < 2; i++)
+		{
+			link_t *head = i ? &node->trigger_edicts : &node->solid_edicts;
+
+			for (link_t *l = head->next; l != head; l = l->next)
+			{
+				edict_t *check = EDICT_FROM_AREA (l);
+
+				if (check == skip) continue;
+				if (mins[0] > check->v.absmax[0] || mins[1] > check->v.absmax[1] || mins[2] > check->v.absmax[2]) continue;
+				if (maxs[0] < check->v.absmin[0] || maxs[1] < check->v.absmin[1] || maxs[2] < check->v.absmin[2]) continue;
+
+				if (count == maxcount) return count;
+				list[count++] = check;
+			}
+		}
+
+		if (node->axis == -1) continue;
+
+		if (maxs[node->axis] > node->dist) stack[stackdepth++] = node->children[0];
+		if (mins[node->axis] < node->dist) stack[stackdepth++] = node->children[1];
 	}
 
-	// link to PVS leafs (this may be inherited across multiple frames...)
-	if (ent->v.modelindex)
+	return count;
+}
+
+
+void SV_RotateBBoxToBBox (edict_t *ent, float *bbmin, float *bbmax, float *rmins, float *rmaxs)
+{
+	vec3_t bbox[8];
+	avectors_t av;
+
+	// compute a full bounding box
+	for (int i = 0; i < 8; i++)
+	{
+		bbox[i][0] = (i & 1) ? bbmin[0] : bbmax[0];
+		bbox[i][1] = (i & 2) ? bbmin[1] : bbmax[1];
+		bbox[i][2] = (i & 4) ? bbmin[2] : bbmax[2];
+	}
+
+	// derive forward/right/up vectors from the angles
+	AngleVectors (ent->v.angles, &av);
+
+	// compute the rotated bbox corners
+	Mod_ClearBoundingBox (rmins, rmaxs);
+
+	// and rotate the bounding box
+	for (int i = 0; i < 8; i++)
+	{
+		vec3_t tmp;
+
+		VectorCopy (bbox[i], tmp);
+
+		bbox[i][0] = DotProduct (av.forward, tmp);
+		bbox[i][1] = -DotProduct (av.right, tmp);
+		bbox[i][2] = DotProduct (av.up, tmp);
+
+		// and convert them to mins and maxs
+		Mod_AccumulateBox (rmins, rmaxs, bbox[i]);
+	}
+}
+
+
+void SV_RotateBBoxToAbsMinMax (edict_t *ent)
+{
+	float mins[3];
+	float maxs[3];
+	vec3_t bbox[8];
+	avectors_t av;
+
+	// compute a full bounding box
+	for (int i = 0; i < 8; i++)
+	{
+		bbox[i][0] = (i & 1) ? ent->v.mins[0] : ent->v.maxs[0];
+		bbox[i][1] = (i & 2) ? ent->v.mins[1] : ent->v.maxs[1];
+		bbox[i][2] = (i & 4) ? ent->v.mins[2] : ent->v.maxs[2];
+	}
+
+	// derive forward/right/up vectors from the angles
+	AngleVectors (ent->v.angles, &av);
+
+	// compute the rotated bbox corners
+	Mod_ClearBoundingBox (mins, maxs);
+
+	// and rotate the bounding box
+	for (int i = 0; i < 8; i++)
+	{
+		vec3_t tmp;
+
+		VectorCopy (bbox[i], tmp);
+
+		bbox[i][0] = DotProduct (av.forward, tmp);
+		bbox[i][1] = -DotProduct (av.right, tmp);
+		bbox[i][2] = DotProduct (av.up, tmp);
+
+		// and convert them to mins and maxs
+		Mod_AccumulateBox (mins, maxs, bbox[i]);
+	}
+
+	// translate the bbox to it's final position at the entity origin
+	VectorAdd (ent->v.origin, mins, ent->v.absmin);
+	VectorAdd (ent->v.origin, maxs, ent->v.absmax);
+
+	// Con_Printf ("%f %f %f\n", ent->v.angles[0], ent->v.angles[1], ent->v.angles[2]);
+}
+
+
+static void SV_AddBigLeaf (edict_t *ent, unsigned int leafnum)
+{
+	// big brush models can touch more leafs than fit in the edict, and used to silently drop out of the PVS test
+	// when they did, so the whole set moves to a buffer from the server zone.  old buffers aren't freed because a
+	// benchmark snapshot may still point at one; it all goes at the map change anyway.
+	if (ent->num_leafs >= ent->maxbigleafs)
+	{
+		int newmax = ent->maxbigleafs ? ent->maxbigleafs * 2 : MAX_ENT_LEAFS * 4;
+		unsigned int *newleafs = (unsigned int *) ServerZone->Alloc (newmax * sizeof (unsigned int), false);
+
+		if (ent->num_leafs > MAX_ENT_LEAFS) memcpy (newleafs, ent->bigleafs, ent->num_leafs * sizeof (unsigned int));
+
+		ent->bigleafs = newleafs;
+		ent->maxbigleafs = newmax;
+	}
+
+	if (ent->num_leafs == MAX_ENT_LEAFS) memcpy (ent->bigleafs, ent->leafnums, sizeof (ent->leafnums));
+
+	ent->bigleafs[ent->num_leafs] = leafnum;
+}
+
+
+void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
+{
+	if (node->contents == CONTENTS_SOLID) return;
+
+	// add an efrag if the node is a leaf
+	if (node->contents < 0)
+	{
+		unsigned int leafnum = ((mleaf_t *) node) - sv.worldmodel->brushhdr->leafs - 1;
+
+		if (ent->num_leafs < MAX_ENT_LEAFS)
+			ent->leafnums[ent->num_leafs] = leafnum;
+		else SV_AddBigLeaf (ent, leafnum);
+
+		ent->num_leafs++;
+		return;
+	}
+
+	// split on this plane
+	int sides = SphereOnPlaneSide (ent->bsphere, ent->bsphere[3], node->plane);
+
+	// recurse down the contacted sides
+	if (sides & 1) SV_FindTouchedLeafs (ent, node->children[0]);
+	if (sides & 2) SV_FindTouchedLeafs (ent, node->children[1]);
+}
+
+
+cvar_t sv_leafcache ("sv_leafcache", "1");
+
+static void SV_FindEdictLeafs (edict_t *ent)
+{
+	// the leafs are found for the abs box rounded out to whole units, which is also the key for reusing the last
+	// set; most of what gets relinked every frame (setorigin, force_retouch) hasn't moved at all
+	int box[6];
+	vec3_t mins, maxs;
+
+	for (int i = 0; i < 3; i++)
+	{
+		mins[i] = box[i] = (int) floor (ent->v.absmin[i]);
+		maxs[i] = box[i + 3] = (int) ceil (ent->v.absmax[i]);
+	}
+
+	if (sv_leafcache.value && ent->leafboxvalid && !memcmp (box, ent->leafbox, sizeof (box)))
+	{
+		ent->num_leafs = ent->leafboxleafs;
+		return;
+	}
+
+	Mod_SphereFromBounds (mins, maxs, ent->bsphere);
+
+	ent->num_leafs = 0;
+	SV_FindTouchedLeafs (ent, sv.worldmodel->brushhdr->nodes);
+	SV_EdictLeafClusters (ent);
+
+	memcpy (ent->leafbox, box, sizeof (box));
+	ent->leafboxleafs = ent->num_leafs;
+	ent->leafboxvalid = true;
+}
+
+
+/*
+===============
+SV_LinkEdict
+
+===============
+*/
+void SV_LinkEdict (edict_t *ent, bool touch_triggers)
+{
+	// clear all touched leafs so that if the edict doesn't get linked it won't get added to the client PVS
+	ent->num_leafs = 0;
+
+	if (ent->area.prev) SV_UnlinkEdict (ent);	// unlink from old position
+	if (ent == SVProgs->EdictPointers[0]) return;		// don't add the world
+	if (ent->free) return;
+
+	if (ent->v.solid == SOLID_BSP && (ent->v.angles[0] || ent->v.angles[1] || ent->v.angles[2]) && ent != SVProgs->EdictPointers[0])
+		SV_RotateBBoxToAbsMinMax (ent);
+	else
+	{
+		// set the abs box
+		VectorAdd (ent->v.origin, ent->v.mins, ent->v.absmin);
+		VectorAdd (ent->v.origin, ent->v.maxs, ent->v.absmax);
+	}
+
+	// to make items easier to pick up and allow them to be grabbed off
+	// of shelves, the abs sizes are expanded
+	if ((int) ent->v.flags & FL_ITEM)
+	{
+		ent->v.absmin[0] -= 15;
+		ent->v.absmin[1] -= 15;
+		ent->v.absmax[0] += 15;
+		ent->v.absmax[1] += 15;
+	}
+	else
+	{
+		// because movement is clipped an epsilon away from an actual edge,
+		// we must fully check even when bounding boxes don't quite touch
+		ent->v.absmin[0] -= 1;
+		ent->v.absmin[1] -= 1;
+		ent->v.absmin[2] -= 1;
+		ent->v.absmax[0] += 1;
+		ent->v.absmax[1] += 1;
+		ent->v.absmax[2] += 1;
+	}
+
+	// link to PVS leafs (this may be inherited across multiple frames...)
+	if (ent->v.modelindex) SV_FindEdictLeafs (ent);
+
+	if (ent->v.solid == SOLID_NOT)
+		return;
+
+	SV_LinkToAreaNode (ent);
+
+	// if touch_triggers, touch all entities at this node and decend for more
+	if (touch_triggers) SV_TouchLinks (ent, sv_areanodes);
+}
+
+
+
+/*
+===============================================================================
+
+POINT TESTING IN HULLS
+
+===============================================================================
+*/
+
+/*
+==================
+SV_HullPointContents
+
+==================
+*/
+int SV_HullPointContents (hull_t *hull, int num, vec3_t p)
+{
+	sv_frame--;
+
+	// bengt jardrup hack for more clipnodes
+	if (num < CONTENTS_CLIP)
+		num += 65536;
+
+	while (num >= 0)
+	{
+		if (num < hull->firstclipnode || num > hull->lastclipnode)
+			Sys_Error ("SV_HullPointContents: bad node number");
+
+		mclipnode_t *node = hull->clipnodes + num;
+		float d = SV_PlaneDist (hull->planes + node->planenum, p);
+
+		if (d < 0)
+			num = node->children[1];
+		else num = node->children[0];
+	}
+
+	return num;
+}
+
+/*
+==================
+SV_HullContents
+
+the same as SV_HullPointContents but it doesn't use the plane dist cache, which is global, so it's safe to
+call from the worker threads
+==================
+*/
+static int SV_HullContents (hull_t *hull, int num, vec3_t p)
+{
+	// bengt jardrup hack for more clipnodes
+	if (num < CONTENTS_CLIP)
+		num += 65536;
+
+	while (num >= 0)
+	{
+		if (num < hull->firstclipnode || num > hull->lastclipnode)
+			Sys_Error ("SV_HullContents: bad node number");
+
+		mclipnode_t *node = hull->clipnodes + num;
+		mplane_t *plane = hull->planes + node->planenum;
+		float d;
+
+		// same as SV_PlaneDist without the cache
+		if (plane->type < 3)
+			d = p[plane->type] - plane->dist;
+		else d = DotProduct (p, plane->normal) - plane->dist;
+
+		if (d < 0)
+			num = node->children[1];
+		else num = node->children[0];
+	}
+
+	return num;
+}
+
+
+/*
+===============================================================================
+
+POINT CONTENTS GRID
+
+hull 0 of the world is cut into cells, and any cell that's entirely inside one contents stores it so that
+SV_PointContents can just look it up instead of walking the tree.  cells are checked with a unit of slack
+around them so that rounding can never put a point on the other side of a plane from where the tree would;
+cells that have a plane through them go back to the tree.  cells are grouped into blocks of 8x8x8 and a
+block that's all one contents (most of the solid outside the map and the middle of big rooms) is stored as
+just that.
+
+points that do go back to the tree are remembered in a small hash.  the world never changes while a map is
+running so it only needs to be cleared on a new map, and entities standing still on the floor (which is
+where most of the tree lookups come from) hit it every frame.
+
+===============================================================================
+*/
+
+cvar_t sv_contentsgrid ("sv_contentsgrid", "1");
+
+#define CGRID_CELLSIZE		32
+#define CGRID_BLOCKSHIFT	3
+#define CGRID_BLOCKSIZE		(1 << CGRID_BLOCKSHIFT)
+#define CGRID_BLOCKMASK		(CGRID_BLOCKSIZE - 1)
+#define CGRID_BLOCKCELLS	(CGRID_BLOCKSIZE * CGRID_BLOCKSIZE * CGRID_BLOCKSIZE)
+#define CGRID_MAXVISITS		1024	// give up on a box that needs more node visits than this
+#define CGRID_MAXBLOCKS		32768	// 8192 units on each axis
+#define CGRID_MIXED			0		// contents are all negative so 0 means use the tree
+
+#define CMEMO_SIZE			1024
+
+typedef struct cgrid_s
+{
+	model_t		*model;
+	vec3_t		origin;
+	int			blocks[3];
+
+	// < 0 is the contents of the whole block, > 0 is 1 + the offset of the block's cells
+	int			*blockdata;
+	signed char	*cells;
+
+	int			numblocks;
+	int			numuniform;
+	int			numcells;
+	int			nummixed;
+	double		buildtime;
+} cgrid_t;
+
+typedef struct cmemo_s
+{
+	vec3_t		p;
+	int			contents;
+	int			generation;
+} cmemo_t;
+
+static cgrid_t sv_cgrid;
+static cmemo_t sv_cmemo[CMEMO_SIZE];
+static int sv_cmemogeneration = 0;
+
+
+static int SV_BoxContents (hull_t *hull, int num, vec3_t mins, vec3_t maxs, int *visits)
+{
+	while (num >= 0)
+	{
+		if (num < hull->firstclipnode || num > hull->lastclipnode) return CGRID_MIXED;
+		if (--(*visits) < 0) return CGRID_MIXED;
+
+		mclipnode_t *node = hull->clipnodes + num;
+		mplane_t *plane = hull->planes + node->planenum;
+		float dmin, dmax;
+
+		if (plane->type < 3)
+		{
+			dmin = mins[plane->type] - plane->dist;
+			dmax = maxs[plane->type] - plane->dist;
+		}
+		else
+		{
+			dmin = dmax = -plane->dist;
+
+			for (int i = 0; i < 3; i++)
+			{
+				if (plane->normal[i] < 0)
+				{
+					dmin += plane->normal[i] * maxs[i];
+					dmax += plane->normal[i] * mins[i];
+				}
+				else
+				{
+					dmin += plane->normal[i] * mins[i];
+					dmax += plane->normal[i] * maxs[i];
+				}
+			}
+		}
+
+		if (dmin >= 0)
+			num = node->children[0];
+		else if (dmax < 0)
+			num = node->children[1];
+		else
+		{
+			// the plane goes through the box so both sides must come out the same
+			int front = SV_BoxContents (hull, node->children[0], mins, maxs, visits);
+
+			if (front == CGRID_MIXED) return CGRID_MIXED;
+
+			if (SV_BoxContents (hull, node->children[1], mins, maxs, visits) != front)
+				return CGRID_MIXED;
+
+			return front;
+		}
+	}
+
+	// anything that doesn't fit in a cell goes to the tree
+	return (num < -128) ? CGRID_MIXED : num;
+}
+
+
+static int SV_CellContents (hull_t *hull, int x, int y, int z, int size)
+{
+	vec3_t mins, maxs;
+	int visits = CGRID_MAXVISITS;
+
+	mins[0] = sv_cgrid.origin[0] + x * CGRID_CELLSIZE - 1;
+	mins[1] = sv_cgrid.origin[1] + y * CGRID_CELLSIZE - 1;
+	mins[2] = sv_cgrid.origin[2] + z * CGRID_CELLSIZE - 1;
+
+	maxs[0] = sv_cgrid.origin[0] + (x + size) * CGRID_CELLSIZE + 1;
+	maxs[1] = sv_cgrid.origin[1] + (y + size) * CGRID_CELLSIZE + 1;
+	maxs[2] = sv_cgrid.origin[2] + (z + size) * CGRID_CELLSIZE + 1;
+
+	return SV_BoxContents (hull, hull->firstclipnode, mins, maxs, &visits);
+}
+
+
+void SV_BuildContentsGrid (void)
+{
+	// anything from the last map is gone with the server zone
+	memset (&sv_cgrid, 0, sizeof (cgrid_t));
+	sv_cmemogeneration++;
+
+	if (!sv.worldmodel || !sv_contentsgrid.value) return;
+
+	double start = Sys_DoubleTime ();
+	hull_t *hull = &sv.worldmodel->brushhdr->hulls[0];
+	int blockunits = CGRID_CELLSIZE * CGRID_BLOCKSIZE;
+
+	for (int i = 0; i < 3; i++)
+	{
+		sv_cgrid.origin[i] = sv.worldmodel->mins[i];
+		sv_cgrid.blocks[i] = (int) ((sv.worldmodel->maxs[i] - sv.worldmodel->mins[i]) / blockunits) + 1;
+	}
+
+	sv_cgrid.numblocks = sv_cgrid.blocks[0] * sv_cgrid.blocks[1] * sv_cgrid.blocks[2];
+
+	// huge maps just use the tree
+	if (sv_cgrid.numblocks > CGRID_MAXBLOCKS)
+	{
+		Con_DPrintf ("Contents grid: %i blocks is too many\n", sv_cgrid.numblocks);
+		return;
+	}
+
+	sv_cgrid.blockdata = (int *) ServerZone->Alloc (sv_cgrid.numblocks * sizeof (int));
+
+	// first find the blocks that are all one contents
+	int nummixedblocks = 0;
+
+	for (int z = 0, b = 0; z < sv_cgrid.blocks[2]; z++)
+	{
+		for (int y = 0; y < sv_cgrid.blocks[1]; y++)
+		{
+			for (int x = 0; x < sv_cgrid.blocks[0]; x++, b++)
+			{
+				int contents = SV_CellContents (hull, x << CGRID_BLOCKSHIFT, y << CGRID_BLOCKSHIFT, z << CGRID_BLOCKSHIFT, CGRID_BLOCKSIZE);
+
+				if (contents == CGRID_MIXED)
+					sv_cgrid.blockdata[b] = 1 + (nummixedblocks++) * CGRID_BLOCKCELLS;
+				else
+				{
+					sv_cgrid.blockdata[b] = contents;
+					sv_cgrid.numuniform++;
+				}
+			}
+		}
+	}
+
+	// now fill in the cells of the rest
+	sv_cgrid.numcells = nummixedblocks * CGRID_BLOCKCELLS;
+
+	if (sv_cgrid.numcells)
+		sv_cgrid.cells = (signed char *) ServerZone->Alloc (sv_cgrid.numcells, false);
+
+	for (int z = 0, b = 0; z < sv_cgrid.blocks[2]; z++)
+	{
+		for (int y = 0; y < sv_cgrid.blocks[1]; y++)
+		{
+			for (int x = 0; x < sv_cgrid.blocks[0]; x++, b++)
+			{
+				if (sv_cgrid.blockdata[b] < 0) continue;
+
+				signed char *cells = sv_cgrid.cells + sv_cgrid.blockdata[b] - 1;
+
+				for (int cz = 0; cz < CGRID_BLOCKSIZE; cz++)
+				{
+					for (int cy = 0; cy < CGRID_BLOCKSIZE; cy++)
+					{
+						for (int cx = 0; cx < CGRID_BLOCKSIZE; cx++, cells++)
+						{
+							cells[0] = SV_CellContents
+							(
+								hull,
+								(x << CGRID_BLOCKSHIFT) + cx,
+								(y << CGRID_BLOCKSHIFT) + cy,
+								(z << CGRID_BLOCKSHIFT) + cz,
+								1
+							);
+
+							if (cells[0] == CGRID_MIXED) sv_cgrid.nummixed++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	sv_cgrid.model = sv.worldmodel;
+	sv_cgrid.buildtime = Sys_DoubleTime () - start;
+
+	Con_DPrintf
+	(
+		"Contents grid: %i blocks (%i uniform), %i cells (%i mixed) in %0.1f ms\n",
+		sv_cgrid.numblocks,
+		sv_cgrid.numuniform,
+		sv_cgrid.numcells,
+		sv_cgrid.nummixed,
+		sv_cgrid.buildtime * 1000.0
+	);
+}
+
+
+static int SV_GridContents (vec3_t p)
+{
+	int c[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		float f = (p[i] - sv_cgrid.origin[i]) * (1.0f / CGRID_CELLSIZE);
+
+		// also catches NaNs
+		if (!(f >= 0)) return CGRID_MIXED;
+		if ((c[i] = (int) f) >= (sv_cgrid.blocks[i] << CGRID_BLOCKSHIFT)) return CGRID_MIXED;
+	}
+
+	int b = (((c[2] >> CGRID_BLOCKSHIFT) * sv_cgrid.blocks[1]) + (c[1] >> CGRID_BLOCKSHIFT)) * sv_cgrid.blocks[0] + (c[0] >> CGRID_BLOCKSHIFT);
+
+	if (sv_cgrid.blockdata[b] < 0) return sv_cgrid.blockdata[b];
+
+	int cell = (((c[2] & CGRID_BLOCKMASK) << CGRID_BLOCKSHIFT) + (c[1] & CGRID_BLOCKMASK)) * CGRID_BLOCKSIZE + (c[0] & CGRID_BLOCKMASK);
+
+	return sv_cgrid.cells[sv_cgrid.blockdata[b] - 1 + cell];
+}
+
+
+static int SV_WorldPointContents (vec3_t p, bool usememo)
+{
+	hull_t *hull = &sv.worldmodel->brushhdr->hulls[0];
+
+	if (!sv_contentsgrid.value || sv_cgrid.model != sv.worldmodel)
+		return SV_HullPointContents (hull, 0, p);
+
+	int contents = SV_GridContents (p);
+
+	if (contents != CGRID_MIXED) return contents;
+
+	// the memo is shared so the worker threads don't get to use it
+	if (sv_workerthread) return SV_HullContents (hull, 0, p);
+	if (!usememo) return SV_HullPointContents (hull, 0, p);
+
+	unsigned int *bits = (unsigned int *) p;
+	unsigned int hash = (bits[0] * 73856093) ^ (bits[1] * 19349663) ^ (bits[2] * 83492791);
+	cmemo_t *memo = &sv_cmemo[(hash ^ (hash >> 16)) & (CMEMO_SIZE - 1)];
+
+	if (memo->generation == sv_cmemogeneration && !memcmp (memo->p, p, sizeof (vec3_t)))
+		return memo->contents;
+
+	memo->contents = SV_HullPointContents (hull, 0, p);
+	memo->generation = sv_cmemogeneration;
+	VectorCopy (p, memo->p);
+
+	return memo->contents;
+}
+
+
+/*
+==================
+SV_PointContents
+
+==================
+*/
+int SV_PointContents (vec3_t p)
+{
+	int cont = SV_WorldPointContents (p, true);
+
+	if (cont <= CONTENTS_CURRENT_0 && cont >= CONTENTS_CURRENT_DOWN)
+		cont = CONTENTS_WATER;
+
+	return cont;
+}
+
+int SV_TruePointContents (vec3_t p)
+{
+	return SV_WorldPointContents (p, true);
+}
+
+/*
+==================
+SV_PointContentsBench_f
+
+times SV_PointContents on the tree, the grid and the grid with the memo, using the same points that
+SV_CheckWater uses for each entity (feet, middle and eyes) over a number of frames
+==================
+*/
+void SV_PointContentsBench_f (void)
+{
+	if (!sv.active || !SVProgs)
+	{
+		Con_Printf ("sv_pointcontents_bench : no server running\n");
+		return;
+	}
+
+	int frames = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100;
+
+	if (frames < 1) frames = 1;
+
+	CScratchMark mark;
+	vec3_t *points = (vec3_t *) mark.Alloc (SVProgs->NumEdicts * 3 * sizeof (vec3_t));
+	int *reference = (int *) mark.Alloc (SVProgs->NumEdicts * 3 * sizeof (int));
+	int numpoints = 0;
+
+	for (int i = 1; i < SVProgs->NumEdicts; i++)
+	{
+		edict_t *ed = SVProgs->EdictPointers[i];
+
+		if (ed->free) continue;
+
+		for (int j = 0; j < 3; j++, numpoints++)
+		{
+			VectorCopy (ed->v.origin, points[numpoints]);
+
+			if (j == 0)
+				points[numpoints][2] += ed->v.mins[2] + 1;
+			else if (j == 1)
+				points[numpoints][2] += (ed->v.mins[2] + ed->v.maxs[2]) * 0.5;
+			else points[numpoints][2] += ed->v.view_ofs[2];
+		}
+	}
+
+	if (!numpoints)
+	{
+		Con_Printf ("sv_pointcontents_bench : no entities\n");
+		return;
+	}
+
+	if (sv_cgrid.model != sv.worldmodel)
+	{
+		float oldgrid = sv_contentsgrid.value;
+
+		sv_contentsgrid.value = 1;
+		SV_BuildContentsGrid ();
+		sv_contentsgrid.value = oldgrid;
+	}
+
+	if (sv_cgrid.model != sv.worldmodel)
+	{
+		Con_Printf ("sv_pointcontents_bench : the map is too big for the grid\n");
+		return;
+	}
+
+	float oldgrid = sv_contentsgrid.value;
+	double times[3];
+	int mismatches[3] = {0, 0, 0};
+	int gridhits = 0;
+
+	for (int i = 0; i < numpoints; i++)
+		if (SV_GridContents (points[i]) != CGRID_MIXED)
+			gridhits++;
+
+	for (int pass = 0; pass < 3; pass++)
+	{
+		// start the memo from empty the way it would be on a new map
+		sv_cmemogeneration++;
+		sv_contentsgrid.value = pass ? 1 : 0;
+
+		double start = Sys_DoubleTime ();
+
+		for (int f = 0; f < frames; f++)
+		{
+			for (int i = 0; i < numpoints; i++)
+			{
+				int contents = SV_WorldPointContents (points[i], pass == 2);
+
+				if (!pass)
+					reference[i] = contents;
+				else if (contents != reference[i])
+					mismatches[pass]++;
+			}
+		}
+
+		times[pass] = Sys_DoubleTime () - start;
+	}
+
+	sv_contentsgrid.value = oldgrid;
+	sv_cmemogeneration++;
+
+	Con_Printf
+	(
+		"grid : %i blocks (%i uniform), %i cells (%i mixed), %i KB, built in %0.1f ms\n",
+		sv_cgrid.numblocks,
+		sv_cgrid.numuniform,
+		sv_cgrid.numcells,
+		sv_cgrid.nummixed,
+		(sv_cgrid.numblocks * (int) sizeof (int) + sv_cgrid.numcells + 1023) / 1024,
+		sv_cgrid.buildtime * 1000.0
+	);
+
+	Con_Printf ("%i points over %i frames, %i found in the grid\n", numpoints, frames, gridhits);
+
+	for (int pass = 0; pass < 3; pass++)
+	{
+		Con_Printf
+		(
+			"%-11s : %8.3f ms, %i different\n",
+			pass == 0 ? "tree" : (pass == 1 ? "grid" : "grid + memo"),
+			times[pass] * 1000.0,
+			mismatches[pass]
+		);
+	}
+}
+
+
+cmd_t SV_PointContentsBench_Cmd ("sv_pointcontents_bench", SV_PointContentsBench_f);
+
+
+static bool SV_TouchLinksWouldTouch (edict_t *ent, areanode_t *node)
+{
+	// what SV_TouchLinks would find without calling anything
+	for (link_t *l = node->trigger_edicts.next; l != &node->trigger_edicts; l = l->next)
+		if (SV_TriggerMayTouch (ent, EDICT_FROM_AREA (l)))
+			return true;
+
+	if (node->axis == -1) return false;
+
+	if (ent->v.absmax[node->axis] > node->dist && SV_TouchLinksWouldTouch (ent, node->children[0])) return true;
+	if (ent->v.absmin[node->axis] < node->dist && SV_TouchLinksWouldTouch (ent, node->children[1])) return true;
+
+	return false;
+}
+
+
+void SV_TriggerGridTest_f (void)
+{
+	if (!sv.active || !SVProgs)
+	{
+		Con_Printf ("sv_triggergrid_test : no server running\n");
+		return;
+	}
+
+	int frames = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100;
+
+	if (frames < 1) frames = 1;
+
+	// every linked edict is asked about as if it had just moved, against a fresh grid
+	double buildtime = Sys_DoubleTime ();
+	SV_BuildTriggerGrid ();
+	buildtime = Sys_DoubleTime () - buildtime;
+
+	CScratchMark mark;
+	edict_t **tested = (edict_t **) mark.Alloc (SVProgs->NumEdicts * sizeof (edict_t *));
+	bool *walk = (bool *) mark.Alloc (SVProgs->NumEdicts * sizeof (bool));
+	bool *grid = (bool *) mark.Alloc (SVProgs->NumEdicts * sizeof (bool));
+	int numtested = 0, walkhits = 0, gridhits = 0, missed = 0;
+
+	for (int i = 1; i < SVProgs->NumEdicts; i++)
+	{
+		edict_t *ed = SVProgs->EdictPointers[i];
+
+		if (ed->free || !ed->area.prev) continue;
+
+		tested[numtested++] = ed;
+	}
+
+	double walktime = Sys_DoubleTime ();
+
+	for (int f = 0; f < frames; f++)
+		for (int i = 0; i < numtested; i++)
+			walk[i] = SV_TouchLinksWouldTouch (tested[i], sv_areanodes);
+
+	walktime = Sys_DoubleTime () - walktime;
+
+	double gridtime = Sys_DoubleTime ();
+
+	for (int f = 0; f < frames; f++)
+		for (int i = 0; i < numtested; i++)
+			grid[i] = SV_TriggersNear (tested[i]);
+
+	gridtime = Sys_DoubleTime () - gridtime;
+
+	for (int i = 0; i < numtested; i++)
+	{
+		if (walk[i]) walkhits++;
+		if (grid[i]) gridhits++;
+		if (walk[i] && !grid[i]) missed++;
+	}
+
+	Con_Printf
+	(
+		"grid : %i x %i cells of %0.0f units, %i entries, built in %0.3f ms\n",
+		sv_tgrid.size[0],
+		sv_tgrid.size[1],
+		sv_tgrid.cellsize,
+		sv_tgrid.numentries,
+		buildtime * 1000.0
+	);
+
+	Con_Printf ("%i edicts over %i frames; %i touch a trigger, the grid says %i might\n", numtested, frames, walkhits, gridhits);
+	Con_Printf ("walk : %8.3f ms\n", walktime * 1000.0);
+	Con_Printf ("grid : %8.3f ms\n", gridtime * 1000.0);
+
+	if (missed)
+		Con_Printf ("%i edicts MISSED by the grid\n", missed);
+}
+
+
+cmd_t SV_TriggerGridTest_Cmd ("sv_triggergrid_test", SV_TriggerGridTest_f);
+
+
+static int SV_CheckMirror (link_t *list, areamirror_t *m)
+{
+	// the mirror must have the same edicts as the list in the same order with the boxes they were linked with
+	int bad = 0, slot = 0;
+
+	for (link_t *l = list->next; l != list; l = l->next, slot++)
 	{
-		Mod_SphereFromBounds (ent->v.absmin, ent->v.absmax, ent->bsphere);
-		SV_FindTouchedLeafs (ent, sv.worldmodel->brushhdr->nodes);
+		edict_t *ed = EDICT_FROM_AREA (l);
+
+		while (slot < m->count && !m->edicts[slot]) slot++;
+
+		if (slot >= m->count || m->edicts[slot] != ed || ed->areamirror != m || ed->areaslot != slot)
+		{
+			bad++;
+			continue;
+		}
+
+		for (int i = 0; i < 3; i++)
+			if (m->absmin[i][slot] != ed->v.absmin[i] || m->absmax[i][slot] != ed->v.absmax[i])
+				bad++;
 	}
 
-	if (ent->v.solid == SOLID_NOT)
-		return;
+	return bad;
+}
 
-	// find the first node that the ent's box crosses
-	areanode_t *node = sv_areanodes;
 
-	while (1)
+void SV_AreaMirrorTest_f (void)
+{
+	if (!sv.active || !SVProgs)
 	{
-		if (node->axis == -1)
-			break;
-
-		if (ent->v.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->v.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else break;		// crosses the node
+		Con_Printf ("sv_areamirror_test : no server running\n");
+		return;
 	}
 
-	// link it in
-	if (ent->v.solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else InsertLinkBefore (&ent->area, &node->solid_edicts);
+	int frames = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100;
 
-	// if touch_triggers, touch all entities at this node and decend for more
-	if (touch_triggers) SV_TouchLinks (ent, sv_areanodes);
-}
+	if (frames < 1) frames = 1;
 
+	int bad = 0, entries = 0, holes = 0;
 
+	for (int n = 0; n < sv_numareanodes; n++)
+	{
+		bad += SV_CheckMirror (&sv_areanodes[n].solid_edicts, &sv_areanodes[n].solid_mirror);
+		bad += SV_CheckMirror (&sv_areanodes[n].trigger_edicts, &sv_areanodes[n].trigger_mirror);
 
-/*
-===============================================================================
+		entries += sv_areanodes[n].solid_mirror.count + sv_areanodes[n].trigger_mirror.count;
+		holes += sv_areanodes[n].solid_mirror.holes + sv_areanodes[n].trigger_mirror.holes;
+	}
 
-POINT TESTING IN HULLS
+	// box reject against every solid list using the box of every linked edict, the old way and from the mirror
+	int listhits = 0, mirrorhits = 0;
+	double listtime = 0, mirrortime = 0;
 
-===============================================================================
-*/
+	for (int i = 1; i < SVProgs->NumEdicts; i++)
+	{
+		edict_t *ed = SVProgs->EdictPointers[i];
 
-/*
-==================
-SV_HullPointContents
+		if (ed->free || !ed->area.prev) continue;
 
-==================
-*/
-int SV_HullPointContents (hull_t *hull, int num, vec3_t p)
-{
-	sv_frame--;
+		double start = Sys_DoubleTime ();
 
-	// bengt jardrup hack for more clipnodes
-	if (num < CONTENTS_CLIP)
-		num += 65536;
-
-	while (num >= 0)
-	{
-		if (num < hull->firstclipnode || num > hull->lastclipnode)
-			Sys_Error ("SV_HullPointContents: bad node number");
+		for (int f = 0; f < frames; f++)
+		{
+			for (int n = 0; n < sv_numareanodes; n++)
+			{
+				link_t *list = &sv_areanodes[n].solid_edicts;
 
-		mclipnode_t *node = hull->clipnodes + num;
-		float d = SV_PlaneDist (hull->planes + node->planenum, p);
+				for (link_t *l = list->next; l != list; l = l->next)
+				{
+					edict_t *touch = EDICT_FROM_AREA (l);
 
-		if (d < 0)
-			num = node->children[1];
-		else num = node->children[0];
-	}
+					if (ed->v.absmin[0] > touch->v.absmax[0] || ed->v.absmin[1] > touch->v.absmax[1] || ed->v.absmin[2] > touch->v.absmax[2] ||
+						ed->v.absmax[0] < touch->v.absmin[0] || ed->v.absmax[1] < touch->v.absmin[1] || ed->v.absmax[2] < touch->v.absmin[2])
+						continue;
 
-	return num;
-}
+					if (!f) listhits++;
+				}
+			}
+		}
 
+		double mid = Sys_DoubleTime ();
+		__m128 mins[3], maxs[3];
 
-/*
-==================
-SV_PointContents
+		SV_MirrorBox (ed->v.absmin, ed->v.absmax, mins, maxs);
 
-==================
-*/
-int SV_PointContents (vec3_t p)
-{
-	int cont = SV_HullPointContents (&sv.worldmodel->brushhdr->hulls[0], 0, p);
+		for (int f = 0; f < frames; f++)
+		{
+			for (int n = 0; n < sv_numareanodes; n++)
+			{
+				areamirror_t *m = &sv_areanodes[n].solid_mirror;
 
-	if (cont <= CONTENTS_CURRENT_0 && cont >= CONTENTS_CURRENT_DOWN)
-		cont = CONTENTS_WATER;
+				for (int first = 0; first < m->count; first += 4)
+				{
+					for (int hits = SV_MirrorOverlaps (m, first, mins, maxs); hits; hits >>= 1)
+						if ((hits & 1) && !f) mirrorhits++;
+				}
+			}
+		}
 
-	return cont;
-}
+		listtime += mid - start;
+		mirrortime += Sys_DoubleTime () - mid;
+	}
 
-int SV_TruePointContents (vec3_t p)
-{
-	return SV_HullPointContents (&sv.worldmodel->brushhdr->hulls[0], 0, p);
+	Con_Printf ("%i areanodes, %i mirror entries (%i holes), %i wrong\n", sv_numareanodes, entries, holes, bad);
+	Con_Printf ("list   : %8.3f ms, %i boxes touched\n", listtime * 1000.0, listhits);
+	Con_Printf ("mirror : %8.3f ms, %i boxes touched\n", mirrortime * 1000.0, mirrorhits);
 }
 
+
+cmd_t SV_AreaMirrorTest_Cmd ("sv_areamirror_test", SV_AreaMirrorTest_f);
+
 //===========================================================================
 
 /*
@@ -683,8 +2054,12 @@ LINE TESTING IN HULLS
 ==================
 SV_RecursiveHullCheck
 
+SV_HullCheck falls back to this so it can be called from the worker threads too; the point contents checks
+there don't use the plane dist cache and the developer message is only printed on the main thread.
 ==================
 */
+#define SV_TRACECONTENTS(hull, num, p) (sv_workerthread ? SV_HullContents (hull, num, p) : SV_HullPointContents (hull, num, p))
+
 bool SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
 {
 	mclipnode_t	*node;
@@ -758,52 +2133,551 @@ bool SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t
 	if (!SV_RecursiveHullCheck (hull, node->children[side], p1f, midf, p1, mid, trace))
 		return false;
 
-	// go past the node
-	if (SV_HullPointContents (hull, node->children[side ^ 1], mid) != CONTENTS_SOLID)
-		return SV_RecursiveHullCheck (hull, node->children[side ^ 1], midf, p2f, mid, p2, trace);
+	// go past the node
+	if (SV_TRACECONTENTS (hull, node->children[side ^ 1], mid) != CONTENTS_SOLID)
+		return SV_RecursiveHullCheck (hull, node->children[side ^ 1], midf, p2f, mid, p2, trace);
+
+	if (trace->allsolid)
+		return false;		// never got out of the solid area
+
+	// the other side of the node is solid, this is the impact point
+	if (!side)
+	{
+		VectorCopy (plane->normal, trace->plane.normal);
+		trace->plane.dist = plane->dist;
+	}
+	else
+	{
+		VectorSubtract (vec3_origin, plane->normal, trace->plane.normal);
+		trace->plane.dist = -plane->dist;
+	}
+
+	while (SV_TRACECONTENTS (hull, hull->firstclipnode, mid) == CONTENTS_SOLID)
+	{
+		// shouldn't really happen, but does occasionally
+		frac -= 0.1;
+
+		if (frac < 0)
+		{
+			trace->fraction = midf;
+			VectorCopy (mid, trace->endpos);
+			if (!sv_workerthread) Con_DPrintf ("backup past 0\n");
+			return false;
+		}
+
+		midf = p1f + (p2f - p1f) * frac;
+
+		mid[0] = p1[0] + frac * (p2[0] - p1[0]);
+		mid[1] = p1[1] + frac * (p2[1] - p1[1]);
+		mid[2] = p1[2] + frac * (p2[2] - p1[2]);
+	}
+
+	trace->fraction = midf;
+	VectorCopy (mid, trace->endpos);
+
+	return false;
+}
+
+/*
+==================
+SV_HullCheck
+
+iterative version of SV_RecursiveHullCheck.  the only frames that need to be kept are the nodes where the
+line is split, and they're kept on an explicit stack instead of the C stack.  the arithmetic is exactly the
+same as the recursive version so that it gives exactly the same results, which sv_hulltrace_test checks.
+if the stack ever fills up (it shouldn't on any sane map) we just go back to the recursive version, which is
+also safe on the worker threads.
+
+this also runs on the worker threads so it mustn't touch anything shared; the point contents checks don't use
+the plane dist cache (which is global) and the developer message is only printed on the main thread.
+==================
+*/
+#define HULL_STACK_SIZE		128
+
+typedef struct hullframe_s
+{
+	mplane_t	*plane;
+	int			num;		// the node on the far side of the split
+	int			side;
+	float		frac;
+	float		p1f, p2f, midf;
+	vec3_t		p1, p2, mid;
+} hullframe_t;
+
+bool SV_HullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
+{
+	hullframe_t	stack[HULL_STACK_SIZE];
+	int			depth = 0;
+	trace_t		original = *trace;
+	int			startnum = num;
+	float		startp1f = p1f;
+	float		startp2f = p2f;
+	vec3_t		l1, l2;
+
+	VectorCopy (p1, l1);
+	VectorCopy (p2, l2);
+
+	for (;;)
+	{
+		// bengt jardrup hack for more clipnodes
+		if (num < CONTENTS_CLIP)
+			num += 65536;
+
+		// check for empty
+		if (num < 0)
+		{
+			if (num != CONTENTS_SOLID)
+			{
+				trace->allsolid = false;
+
+				if (num == CONTENTS_EMPTY)
+					trace->inopen = true;
+				else trace->inwater = true;
+			}
+			else trace->startsolid = true;
+
+			// unwind to the last split and go past it
+			for (;;)
+			{
+				if (!depth) return true;
+
+				hullframe_t *f = &stack[--depth];
+
+				if (SV_HullContents (hull, f->num, f->mid) != CONTENTS_SOLID)
+				{
+					num = f->num;
+					p1f = f->midf;
+					p2f = f->p2f;
+					VectorCopy (f->mid, l1);
+					VectorCopy (f->p2, l2);
+					break;
+				}
+
+				if (trace->allsolid)
+					return false;		// never got out of the solid area
+
+				// the other side of the node is solid, this is the impact point
+				if (!f->side)
+				{
+					VectorCopy (f->plane->normal, trace->plane.normal);
+					trace->plane.dist = f->plane->dist;
+				}
+				else
+				{
+					VectorSubtract (vec3_origin, f->plane->normal, trace->plane.normal);
+					trace->plane.dist = -f->plane->dist;
+				}
+
+				float frac = f->frac;
+				float midf = f->midf;
+				vec3_t mid;
+
+				VectorCopy (f->mid, mid);
+
+				while (SV_HullContents (hull, hull->firstclipnode, mid) == CONTENTS_SOLID)
+				{
+					// shouldn't really happen, but does occasionally
+					frac -= 0.1;
+
+					if (frac < 0)
+					{
+						trace->fraction = midf;
+						VectorCopy (mid, trace->endpos);
+
+						if (!sv_workerthread) Con_DPrintf ("backup past 0\n");
+						return false;
+					}
+
+					midf = f->p1f + (f->p2f - f->p1f) * frac;
+
+					mid[0] = f->p1[0] + frac * (f->p2[0] - f->p1[0]);
+					mid[1] = f->p1[1] + frac * (f->p2[1] - f->p1[1]);
+					mid[2] = f->p1[2] + frac * (f->p2[2] - f->p1[2]);
+				}
+
+				trace->fraction = midf;
+				VectorCopy (mid, trace->endpos);
+
+				return false;
+			}
+
+			continue;
+		}
+
+		if (num < hull->firstclipnode) num += 65536;
+
+		if (num < hull->firstclipnode || num > hull->lastclipnode)
+			Sys_Error ("SV_HullCheck: bad node number");
+
+		// find the point distances
+		mclipnode_t *node = hull->clipnodes + num;
+		mplane_t *plane = hull->planes + node->planenum;
+		float t1, t2;
+
+		if (plane->type < 3)
+		{
+			t1 = l1[plane->type] - plane->dist;
+			t2 = l2[plane->type] - plane->dist;
+		}
+		else
+		{
+			t1 = DotProduct (plane->normal, l1) - plane->dist;
+			t2 = DotProduct (plane->normal, l2) - plane->dist;
+		}
+
+		// both on the same side just moves down without needing a frame
+		if (t1 >= 0 && t2 >= 0) {num = node->children[0]; continue;}
+		if (t1 < 0 && t2 < 0) {num = node->children[1]; continue;}
+
+		if (depth == HULL_STACK_SIZE)
+		{
+			// start over the old way
+			*trace = original;
+			return SV_RecursiveHullCheck (hull, startnum, startp1f, startp2f, p1, p2, trace);
+		}
+
+		hullframe_t *f = &stack[depth++];
+		float frac;
+
+		// put the crosspoint DIST_EPSILON pixels on the near side
+		if (t1 < 0)
+			frac = (t1 + DIST_EPSILON) / (t1 - t2);
+		else frac = (t1 - DIST_EPSILON) / (t1 - t2);
+
+		if (frac < 0) frac = 0;
+		if (frac > 1) frac = 1;
+
+		f->midf = p1f + (p2f - p1f) * frac;
+
+		f->mid[0] = l1[0] + frac * (l2[0] - l1[0]);
+		f->mid[1] = l1[1] + frac * (l2[1] - l1[1]);
+		f->mid[2] = l1[2] + frac * (l2[2] - l1[2]);
+
+		f->side = (t1 < 0);
+		f->plane = plane;
+		f->num = node->children[f->side ^ 1];
+		f->frac = frac;
+		f->p1f = p1f;
+		f->p2f = p2f;
+
+		VectorCopy (l1, f->p1);
+		VectorCopy (l2, f->p2);
+
+		// move up to the node
+		num = node->children[f->side];
+		p2f = f->midf;
+		VectorCopy (f->mid, l2);
+	}
+}
+
+
+/*
+==================
+SV_HullCheckBatch
+
+traces a batch of lines through a hull.  each trace should be set up by the caller the same way as it would
+be for SV_HullCheck.  lines are carried down the tree together for as long as they stay on the same side of
+each node (which is what happens to lines that start close together) and only split off to be traced on
+their own from the first node they cross.  because a line that stays on one side just goes down with the
+same fractions and points it's result is exactly the same as tracing it from the top.
+==================
+*/
+#define HULL_BATCH_STACK	64
+
+typedef struct hullbatch_s
+{
+	int num;
+	int first;
+	int count;
+} hullbatch_t;
+
+void SV_HullCheckBatch (hull_t *hull, int num, int numtraces, vec3_t *starts, vec3_t *ends, trace_t *traces)
+{
+	if (numtraces < 1) return;
+
+	CScratchMark mark;
+	int *lines = (int *) mark.Alloc (numtraces * sizeof (int));
+	hullbatch_t stack[HULL_BATCH_STACK];
+	int depth = 0;
+
+	for (int i = 0; i < numtraces; i++)
+		lines[i] = i;
+
+	stack[depth].num = num;
+	stack[depth].first = 0;
+	stack[depth].count = numtraces;
+	depth++;
+
+	while (depth)
+	{
+		hullbatch_t *b = &stack[--depth];
+		int *batch = &lines[b->first];
+		int first = b->first;
+		int count = b->count;
+
+		num = b->num;
+
+		// the hacks are the same as SV_HullCheck but we don't change the number we pass on
+		int nodenum = num;
+
+		if (nodenum < CONTENTS_CLIP) nodenum += 65536;
+
+		// leafs and lines that can't be carried any further are just traced from here
+		if (nodenum < 0 || depth > HULL_BATCH_STACK - 2)
+		{
+			for (int i = 0; i < count; i++)
+				SV_HullCheck (hull, num, 0, 1, starts[batch[i]], ends[batch[i]], &traces[batch[i]]);
+
+			continue;
+		}
+
+		if (nodenum < hull->firstclipnode) nodenum += 65536;
+
+		if (nodenum < hull->firstclipnode || nodenum > hull->lastclipnode)
+			Sys_Error ("SV_HullCheckBatch: bad node number");
+
+		mclipnode_t *node = hull->clipnodes + nodenum;
+		mplane_t *plane = hull->planes + node->planenum;
+		int front = 0;
+		int back = count;
+
+		// sort the batch into front and back, tracing crossing lines as we go
+		while (front < back)
+		{
+			float *p1 = starts[batch[front]];
+			float *p2 = ends[batch[front]];
+			float t1, t2;
+
+			if (plane->type < 3)
+			{
+				t1 = p1[plane->type] - plane->dist;
+				t2 = p2[plane->type] - plane->dist;
+			}
+			else
+			{
+				t1 = DotProduct (plane->normal, p1) - plane->dist;
+				t2 = DotProduct (plane->normal, p2) - plane->dist;
+			}
+
+			if (t1 >= 0 && t2 >= 0)
+				front++;
+			else if (t1 < 0 && t2 < 0)
+			{
+				int tmp = batch[--back];
+				batch[back] = batch[front];
+				batch[front] = tmp;
+			}
+			else
+			{
+				SV_HullCheck (hull, num, 0, 1, p1, p2, &traces[batch[front]]);
+
+				// drop it from the batch
+				batch[front] = batch[--back];
+				batch[back] = batch[--count];
+			}
+		}
+
+		if (count > back)
+		{
+			stack[depth].num = node->children[1];
+			stack[depth].first = first + back;
+			stack[depth].count = count - back;
+			depth++;
+		}
+
+		if (front)
+		{
+			stack[depth].num = node->children[0];
+			stack[depth].first = first;
+			stack[depth].count = front;
+			depth++;
+		}
+	}
+}
+
+
+/*
+==================
+SV_HullTraceTest_f
+
+randomized differential test of SV_HullCheck and SV_HullCheckBatch against SV_RecursiveHullCheck on the
+world hulls of the current map.  lines are made in clusters that start close together so that the batch has
+something to share.  the traces must match bit for bit.
+==================
+*/
+#define HULLTEST_CLUSTER	16
+
+static float SV_HullTestRandom (float lo, float hi)
+{
+	return lo + (hi - lo) * ((float) rand () / (float) RAND_MAX);
+}
+
+
+static void SV_HullTestInit (trace_t *trace, vec3_t end)
+{
+	// same as SV_ClipMoveToEntity
+	memset (trace, 0, sizeof (trace_t));
+	trace->fraction = 1;
+	trace->allsolid = true;
+	VectorCopy (end, trace->endpos);
+}
+
+
+static bool SV_HullTestSame (trace_t *a, trace_t *b)
+{
+	// bitwise so that we even catch -0 against 0
+	if (a->allsolid != b->allsolid || a->startsolid != b->startsolid) return false;
+	if (a->inopen != b->inopen || a->inwater != b->inwater) return false;
+	if (memcmp (&a->fraction, &b->fraction, sizeof (float))) return false;
+	if (memcmp (a->endpos, b->endpos, sizeof (vec3_t))) return false;
+	if (memcmp (&a->plane, &b->plane, sizeof (plane_t))) return false;
+
+	return true;
+}
+
+
+void SV_HullTraceTest_f (void)
+{
+	if (!sv.active || !sv.worldmodel)
+	{
+		Con_Printf ("sv_hulltrace_test : no server running\n");
+		return;
+	}
+
+	int count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 10000;
+	int seed = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 1;
+
+	// round up to whole clusters
+	if (count < HULLTEST_CLUSTER) count = HULLTEST_CLUSTER;
+
+	count = (count + HULLTEST_CLUSTER - 1) & ~(HULLTEST_CLUSTER - 1);
 
-	if (trace->allsolid)
-		return false;		// never got out of the solid area
+	CScratchMark mark;
+	vec3_t *starts = (vec3_t *) mark.Alloc (count * sizeof (vec3_t));
+	vec3_t *ends = (vec3_t *) mark.Alloc (count * sizeof (vec3_t));
+	trace_t *reference = (trace_t *) mark.Alloc (count * sizeof (trace_t));
+	trace_t *traces = (trace_t *) mark.Alloc (count * sizeof (trace_t));
+	float *wmins = sv.worldmodel->mins;
+	float *wmaxs = sv.worldmodel->maxs;
+	int failed = 0;
 
-	// the other side of the node is solid, this is the impact point
-	if (!side)
-	{
-		VectorCopy (plane->normal, trace->plane.normal);
-		trace->plane.dist = plane->dist;
-	}
-	else
+	srand (seed);
+
+	for (int i = 0; i < count; i += HULLTEST_CLUSTER)
 	{
-		VectorSubtract (vec3_origin, plane->normal, trace->plane.normal);
-		trace->plane.dist = -plane->dist;
+		vec3_t org;
+
+		for (int j = 0; j < 3; j++)
+			org[j] = SV_HullTestRandom (wmins[j], wmaxs[j]);
+
+		for (int k = i; k < i + HULLTEST_CLUSTER; k++)
+		{
+			for (int j = 0; j < 3; j++)
+				starts[k][j] = org[j] + SV_HullTestRandom (-8, 8);
+
+			switch ((i / HULLTEST_CLUSTER) % 3)
+			{
+			case 0:
+				// anywhere in the map
+				for (int j = 0; j < 3; j++)
+					ends[k][j] = SV_HullTestRandom (wmins[j], wmaxs[j]);
+				break;
+
+			case 1:
+				// short moves
+				for (int j = 0; j < 3; j++)
+					ends[k][j] = starts[k][j] + SV_HullTestRandom (-256, 256);
+				break;
+
+			default:
+				// along one axis, like gravity and the checkbottom traces
+				VectorCopy (starts[k], ends[k]);
+				ends[k][rand () % 3] += SV_HullTestRandom (-1024, 1024);
+				break;
+			}
+		}
 	}
 
-	while (SV_HullPointContents (hull, hull->firstclipnode, mid) == CONTENTS_SOLID)
+	for (int h = 0; h < 3; h++)
 	{
-		// shouldn't really happen, but does occasionally
-		frac -= 0.1;
+		hull_t *hull = &sv.worldmodel->brushhdr->hulls[h];
+		double times[3];
+		int mismatches[2] = {0, 0};
 
-		if (frac < 0)
+		for (int pass = 0; pass < 3; pass++)
 		{
-			trace->fraction = midf;
-			VectorCopy (mid, trace->endpos);
-			Con_DPrintf ("backup past 0\n");
-			return false;
-		}
+			trace_t *results = pass ? traces : reference;
 
-		midf = p1f + (p2f - p1f) * frac;
+			for (int i = 0; i < count; i++)
+				SV_HullTestInit (&results[i], ends[i]);
 
-		mid[0] = p1[0] + frac * (p2[0] - p1[0]);
-		mid[1] = p1[1] + frac * (p2[1] - p1[1]);
-		mid[2] = p1[2] + frac * (p2[2] - p1[2]);
-	}
+			double start = Sys_DoubleTime ();
 
-	trace->fraction = midf;
-	VectorCopy (mid, trace->endpos);
+			if (pass == 0)
+			{
+				for (int i = 0; i < count; i++)
+					SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, starts[i], ends[i], &results[i]);
+			}
+			else if (pass == 1)
+			{
+				for (int i = 0; i < count; i++)
+					SV_HullCheck (hull, hull->firstclipnode, 0, 1, starts[i], ends[i], &results[i]);
+			}
+			else
+			{
+				for (int i = 0; i < count; i += HULLTEST_CLUSTER)
+					SV_HullCheckBatch (hull, hull->firstclipnode, HULLTEST_CLUSTER, &starts[i], &ends[i], &results[i]);
+			}
 
-	return false;
+			times[pass] = Sys_DoubleTime () - start;
+
+			if (!pass) continue;
+
+			for (int i = 0; i < count; i++)
+			{
+				if (SV_HullTestSame (&reference[i], &traces[i])) continue;
+
+				if (!mismatches[pass - 1])
+				{
+					Con_Printf
+					(
+						"hull %i %s mismatch : (%g %g %g) to (%g %g %g) : fraction %g against %g\n",
+						h,
+						pass == 1 ? "iterative" : "batched",
+						starts[i][0], starts[i][1], starts[i][2],
+						ends[i][0], ends[i][1], ends[i][2],
+						traces[i].fraction,
+						reference[i].fraction
+					);
+				}
+
+				mismatches[pass - 1]++;
+			}
+		}
+
+		Con_Printf
+		(
+			"hull %i : recursive %7.3f ms, iterative %7.3f ms, batched %7.3f ms : %i/%i mismatches\n",
+			h,
+			times[0] * 1000.0,
+			times[1] * 1000.0,
+			times[2] * 1000.0,
+			mismatches[0],
+			mismatches[1]
+		);
+
+		failed += mismatches[0] + mismatches[1];
+	}
+
+	if (failed)
+		Con_Printf ("sv_hulltrace_test : FAILED with %i mismatches over %i lines\n", failed, count);
+	else Con_Printf ("sv_hulltrace_test : passed, %i lines per hull\n", count);
 }
 
 
+cmd_t SV_HullTraceTest_Cmd ("sv_hulltrace_test", SV_HullTraceTest_f);
+
+
 /*
 ==================
 SV_ClipMoveToEntity
@@ -851,7 +2725,7 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	}
 
 	// trace a line through the apropriate clipping hull
-	SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+	SV_HullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
 
 	// rotate endpos back to world frame of reference
 	if (ent->v.solid == SOLID_BSP && (ent->v.angles[0] || ent->v.angles[1] || ent->v.angles[2]) && ent != SVProgs->EdictPointers[0])
@@ -905,52 +2779,56 @@ Mins and maxs enclose the entire area swept by the move
 */
 void SV_ClipToLinks (areanode_t *node, moveclip_t *clip)
 {
-	link_t		*l, *next;
 	edict_t		*touch;
 	trace_t		trace;
+	__m128		mins[3], maxs[3];
+
+	SV_MirrorBox (clip->boxmins, clip->boxmaxs, mins, maxs);
 
 loc0:;
 	// touch linked edicts
-	for (l = node->solid_edicts.next; l != &node->solid_edicts; l = next)
+	// the box test comes first from the mirror so most of them never get looked at
+	for (int first = 0; first < node->solid_mirror.count; first += 4)
 	{
-		next = l->next;
-		touch = EDICT_FROM_AREA (l);
-
-		if (touch->v.solid == SOLID_NOT) continue;
-		if (touch == clip->passedict) continue;
-		if (touch->v.solid == SOLID_TRIGGER) Sys_Error ("Trigger in clipping list");
-		if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP) continue;
+		for (int hits = SV_MirrorOverlaps (&node->solid_mirror, first, mins, maxs), n = 0; hits; hits >>= 1, n++)
+		{
+			if (!(hits & 1)) continue;
 
-		if (clip->boxmins[0] > touch->v.absmax[0] || clip->boxmins[1] > touch->v.absmax[1] || clip->boxmins[2] > touch->v.absmax[2] ||
-			clip->boxmaxs[0] < touch->v.absmin[0] || clip->boxmaxs[1] < touch->v.absmin[1] || clip->boxmaxs[2] < touch->v.absmin[2])
-			continue;
+			touch = node->solid_mirror.edicts[first + n];
 
-		if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0]) continue;	// points never interact
-		if (clip->trace.allsolid) return; // might intersect, so do an exact clip
+			if (!touch) continue;	// hole
+			if (touch->v.solid == SOLID_NOT) continue;
+			if (touch == clip->passedict) continue;
+			if (touch->v.solid == SOLID_TRIGGER) Sys_Error ("Trigger in clipping list");
+			if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP) continue;
 
-		if (clip->passedict)
-		{
-			if (PROG_TO_EDICT (touch->v.owner) == clip->passedict) continue;	// don't clip against own missiles
-			if (PROG_TO_EDICT (clip->passedict->v.owner) == touch) continue;	// don't clip against owner
-		}
+			if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0]) continue;	// points never interact
+			if (clip->trace.allsolid) return; // might intersect, so do an exact clip
 
-		if ((int) touch->v.flags & FL_MONSTER)
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
-		else trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
+			if (clip->passedict)
+			{
+				if (PROG_TO_EDICT (touch->v.owner) == clip->passedict) continue;	// don't clip against own missiles
+				if (PROG_TO_EDICT (clip->passedict->v.owner) == touch) continue;	// don't clip against owner
+			}
 
-		if (trace.allsolid || trace.startsolid || trace.fraction < clip->trace.fraction)
-		{
-			trace.ent = touch;
+			if ((int) touch->v.flags & FL_MONSTER)
+				trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
+			else trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
 
-			if (clip->trace.startsolid)
+			if (trace.allsolid || trace.startsolid || trace.fraction < clip->trace.fraction)
 			{
-				clip->trace = trace;
-				clip->trace.startsolid = true;
+				trace.ent = touch;
+
+				if (clip->trace.startsolid)
+				{
+					clip->trace = trace;
+					clip->trace.startsolid = true;
+				}
+				else clip->trace = trace;
 			}
-			else clip->trace = trace;
+			else if (trace.startsolid)
+				clip->trace.startsolid = true;
 		}
-		else if (trace.startsolid)
-			clip->trace.startsolid = true;
 	}
 
 	// recurse down both sides
@@ -1044,3 +2922,434 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	return clip.trace;
 }
 
+
+
+/*
+===============
+SV_MoveBench_f
+
+times SV_Move against the original fixed areanode tree and the adaptive one.  the traces run from entity
+origins in random directions as that's where most real traces start.
+===============
+*/
+void SV_MoveBench_f (void)
+{
+	if (!sv.active || !SVProgs)
+	{
+		Con_Printf ("sv_move_bench : no server running\n");
+		return;
+	}
+
+	int count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 10000;
+
+	if (count < 1) count = 1;
+
+	CScratchMark mark;
+	float *points = (float *) mark.Alloc (count * 6 * sizeof (float));
+	trace_t *results = (trace_t *) mark.Alloc (count * sizeof (trace_t));
+	int numents = 0;
+	vec3_t mins = {-16, -16, -24};
+	vec3_t maxs = {16, 16, 32};
+
+	// gather starting points from linked entities
+	edict_t **ents = (edict_t **) mark.Alloc (SVProgs->NumEdicts * sizeof (edict_t *));
+
+	for (int i = 1; i < SVProgs->NumEdicts; i++)
+		if (SVProgs->EdictPointers[i]->area.prev)
+			ents[numents++] = SVProgs->EdictPointers[i];
+
+	if (!numents)
+	{
+		Con_Printf ("sv_move_bench : no linked entities\n");
+		return;
+	}
+
+	srand (1);
+
+	for (int i = 0; i < count; i++)
+	{
+		float *start = &points[i * 6];
+		float *end = &points[i * 6 + 3];
+		edict_t *ed = ents[rand () % numents];
+
+		for (int j = 0; j < 3; j++)
+		{
+			start[j] = ed->v.origin[j] + (ed->v.mins[j] + ed->v.maxs[j]) * 0.5f;
+			end[j] = start[j] + ((rand () & 1023) - 512);
+		}
+	}
+
+	int olddepth = sv_areadepth;
+	bool oldzsplit = sv_areazsplit;
+	double times[2];
+	int mismatches = 0;
+	int nodes[2], depths[2];
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		// original tree first then adaptive
+		if (pass == 0)
+			SV_RelinkAreaNodes (AREA_MINDEPTH, false);
+		else SV_RelinkAreaNodes (SV_AreaDepthForCount (sv_numarealinks), true);
+
+		nodes[pass] = sv_numareanodes;
+		depths[pass] = sv_areadepth;
+
+		double start = Sys_DoubleTime ();
+
+		for (int i = 0; i < count; i++)
+		{
+			trace_t trace = SV_Move (&points[i * 6], mins, maxs, &points[i * 6 + 3], MOVE_NORMAL, NULL);
+
+			if (pass == 0)
+				results[i] = trace;
+			else if (trace.fraction != results[i].fraction || trace.ent != results[i].ent || trace.startsolid != results[i].startsolid)
+				mismatches++;
+		}
+
+		times[pass] = Sys_DoubleTime () - start;
+	}
+
+	SV_RelinkAreaNodes (olddepth, oldzsplit);
+
+	Con_Printf ("%i moves among %i linked entities\n", count, numents);
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		Con_Printf
+		(
+			"%s : %3i nodes, depth %i : %8.3f ms, %0.0f moves/sec\n",
+			pass ? "adaptive" : "original",
+			nodes[pass],
+			depths[pass],
+			times[pass] * 1000.0,
+			times[pass] > 0 ? count / times[pass] : 0
+		);
+	}
+
+	// the order entities are tested in changes so a tie between two entities can go either way
+	Con_Printf ("%i moves hit something different\n", mismatches);
+}
+
+
+cmd_t SV_MoveBench_Cmd ("sv_move_bench", SV_MoveBench_f);
+
+
+/*
+===============================================================================
+
+WORKER THREADS
+
+jobs are split into chunks which the worker threads and the main thread all take from a shared counter until
+they run out.  a job must only read shared state and only write to it's own items; if it does that then the
+result is the same as running it on the main thread no matter how the chunks get handed out.
+
+===============================================================================
+*/
+
+cvar_t sv_threads ("sv_threads", "1", CVAR_ARCHIVE);
+
+#define SV_MAXWORKERS	8
+
+static HANDLE sv_workerthreads[SV_MAXWORKERS];
+static HANDLE sv_workstart[SV_MAXWORKERS];
+static HANDLE sv_workdone = NULL;
+static int sv_numworkers = -1;
+
+static svjob_t sv_job = NULL;
+static void *sv_jobdata = NULL;
+static int sv_jobcount = 0;
+static int sv_jobchunk = 0;
+static volatile LONG sv_jobnext = 0;
+static volatile LONG sv_jobpending = 0;
+static volatile LONG sv_jobquit = 0;
+
+
+static void SV_WorkOnJob (void)
+{
+	for (;;)
+	{
+		int first = InterlockedExchangeAdd (&sv_jobnext, sv_jobchunk);
+
+		if (first >= sv_jobcount) break;
+
+		if (first + sv_jobchunk > sv_jobcount)
+			sv_job (sv_jobdata, first, sv_jobcount - first);
+		else sv_job (sv_jobdata, first, sv_jobchunk);
+	}
+}
+
+
+static DWORD WINAPI SV_WorkerThread (LPVOID lpParameter)
+{
+	HANDLE start = (HANDLE) lpParameter;
+
+	sv_workerthread = true;
+
+	for (;;)
+	{
+		if (WaitForSingleObject (start, INFINITE) != WAIT_OBJECT_0) break;
+		if (sv_jobquit) break;
+
+		SV_WorkOnJob ();
+
+		// the last one out wakes the main thread
+		if (!InterlockedDecrement (&sv_jobpending))
+			SetEvent (sv_workdone);
+	}
+
+	Scratch_ReleaseThread ();
+
+	return 0;
+}
+
+
+static void SV_StartWorkers (void)
+{
+	// leave one core for the main thread
+	int numworkers = (int) SysInfo.dwNumberOfProcessors - 1;
+
+	if (numworkers > SV_MAXWORKERS) numworkers = SV_MAXWORKERS;
+
+	sv_numworkers = 0;
+
+	if (numworkers < 1) return;
+
+	if (!(sv_workdone = CreateEvent (NULL, FALSE, FALSE, NULL)))
+		return;
+
+	for (int i = 0; i < numworkers; i++)
+	{
+		if (!(sv_workstart[i] = CreateEvent (NULL, FALSE, FALSE, NULL)))
+			break;
+
+		if (!(sv_workerthreads[i] = CreateThread (NULL, 0, SV_WorkerThread, sv_workstart[i], 0, NULL)))
+		{
+			CloseHandle (sv_workstart[i]);
+			break;
+		}
+
+		sv_numworkers++;
+	}
+
+	Con_DPrintf ("Started %i server worker threads\n", sv_numworkers);
+}
+
+
+void SV_StopWorkers (void)
+{
+	// a Sys_Error on a worker comes through here too and it can't wait for itself
+	if (sv_workerthread) return;
+	if (sv_numworkers < 1) return;
+
+	sv_jobquit = 1;
+
+	for (int i = 0; i < sv_numworkers; i++)
+		SetEvent (sv_workstart[i]);
+
+	// don't hang on the way out if one of them is stuck in a job (which means we're in a Sys_Error anyway)
+	WaitForMultipleObjects (sv_numworkers, sv_workerthreads, TRUE, 1000);
+
+	for (int i = 0; i < sv_numworkers; i++)
+	{
+		CloseHandle (sv_workerthreads[i]);
+		CloseHandle (sv_workstart[i]);
+	}
+
+	CloseHandle (sv_workdone);
+	sv_workdone = NULL;
+
+	// anything after this runs on the main thread only
+	sv_numworkers = 0;
+}
+
+
+void SV_RunJob (svjob_t job, void *data, int count, int chunk)
+{
+	if (count < 1) return;
+	if (chunk < 1) chunk = 1;
+
+	// the workers are only started the first time they're needed
+	if (sv_threads.value && sv_numworkers < 0)
+		SV_StartWorkers ();
+
+	// not worth waking anything up for
+	if (!sv_threads.value || sv_numworkers < 1 || count <= chunk)
+	{
+		job (data, 0, count);
+		return;
+	}
+
+	sv_job = job;
+	sv_jobdata = data;
+	sv_jobcount = count;
+	sv_jobchunk = chunk;
+	sv_jobnext = 0;
+	sv_jobpending = sv_numworkers;
+
+	for (int i = 0; i < sv_numworkers; i++)
+		SetEvent (sv_workstart[i]);
+
+	// the main thread works too
+	SV_WorkOnJob ();
+
+	WaitForSingleObject (sv_workdone, INFINITE);
+}
+
+
+/*
+===============================================================================
+
+BATCHED WORLD TRACES
+
+point traces against the world only; each one gives the same result as SV_ClipMoveToEntity on the world
+with no mins and maxs.  nothing here touches the entities so it's safe to run on the worker threads.
+
+===============================================================================
+*/
+
+#define SV_TRACECHUNK	16
+
+typedef struct svtracejob_s
+{
+	hull_t *hull;
+	vec3_t offset;
+	vec3_t *starts;
+	vec3_t *ends;
+	trace_t *traces;
+	edict_t *world;
+} svtracejob_t;
+
+
+static void SV_WorldTraceJob (void *data, int first, int count)
+{
+	svtracejob_t *job = (svtracejob_t *) data;
+	CScratchMark mark;
+	vec3_t *starts = (vec3_t *) mark.Alloc (count * sizeof (vec3_t));
+	vec3_t *ends = (vec3_t *) mark.Alloc (count * sizeof (vec3_t));
+	trace_t *traces = &job->traces[first];
+
+	for (int i = 0; i < count; i++)
+	{
+		// fill in a default trace
+		memset (&traces[i], 0, sizeof (trace_t));
+		traces[i].fraction = 1;
+		traces[i].allsolid = true;
+		VectorCopy (job->ends[first + i], traces[i].endpos);
+
+		VectorSubtract (job->starts[first + i], job->offset, starts[i]);
+		VectorSubtract (job->ends[first + i], job->offset, ends[i]);
+	}
+
+	SV_HullCheckBatch (job->hull, job->hull->firstclipnode, count, starts, ends, traces);
+
+	for (int i = 0; i < count; i++)
+	{
+		// the world is never rotated so this is the same fixup as SV_ClipMoveToEntity
+		if (traces[i].fraction != 1)
+			VectorAdd (traces[i].endpos, job->offset, traces[i].endpos);
+
+		if (traces[i].fraction < 1 || traces[i].startsolid)
+			traces[i].ent = job->world;
+	}
+}
+
+
+void SV_WorldTraceBatch (int count, vec3_t *starts, vec3_t *ends, trace_t *traces)
+{
+	svtracejob_t job;
+
+	job.world = SVProgs->EdictPointers[0];
+	job.hull = SV_HullForEntity (job.world, vec3_origin, vec3_origin, job.offset);
+	job.starts = starts;
+	job.ends = ends;
+	job.traces = traces;
+
+	SV_RunJob (SV_WorldTraceJob, &job, count, SV_TRACECHUNK);
+}
+
+
+/*
+===============
+SV_WorldTraceTest_f
+
+checks that the batched world traces give the same results on the worker threads as SV_ClipMoveToEntity does
+one at a time on the main thread, and times them.  the lines are made the same way as SV_MoveBench_f.
+===============
+*/
+void SV_WorldTraceTest_f (void)
+{
+	if (!sv.active || !SVProgs)
+	{
+		Con_Printf ("sv_worldtrace_test : no server running\n");
+		return;
+	}
+
+	int count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 10000;
+
+	if (count < 1) count = 1;
+
+	CScratchMark mark;
+	vec3_t *starts = (vec3_t *) mark.Alloc (count * sizeof (vec3_t));
+	vec3_t *ends = (vec3_t *) mark.Alloc (count * sizeof (vec3_t));
+	trace_t *serial = (trace_t *) mark.Alloc (count * sizeof (trace_t));
+	trace_t *batched = (trace_t *) mark.Alloc (count * sizeof (trace_t));
+	edict_t *world = SVProgs->EdictPointers[0];
+	int numents = 0;
+
+	edict_t **ents = (edict_t **) mark.Alloc (SVProgs->NumEdicts * sizeof (edict_t *));
+
+	for (int i = 1; i < SVProgs->NumEdicts; i++)
+		if (SVProgs->EdictPointers[i]->area.prev)
+			ents[numents++] = SVProgs->EdictPointers[i];
+
+	if (!numents)
+	{
+		Con_Printf ("sv_worldtrace_test : no linked entities\n");
+		return;
+	}
+
+	srand (1);
+
+	for (int i = 0; i < count; i++)
+	{
+		edict_t *ed = ents[rand () % numents];
+
+		for (int j = 0; j < 3; j++)
+		{
+			starts[i][j] = ed->v.origin[j] + (ed->v.mins[j] + ed->v.maxs[j]) * 0.5f;
+			ends[i][j] = starts[i][j] + ((rand () & 1023) - 512);
+		}
+	}
+
+	double start = Sys_DoubleTime ();
+
+	for (int i = 0; i < count; i++)
+		serial[i] = SV_ClipMoveToEntity (world, starts[i], vec3_origin, vec3_origin, ends[i]);
+
+	double serialtime = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	SV_WorldTraceBatch (count, starts, ends, batched);
+	double batchtime = Sys_DoubleTime () - start;
+
+	int mismatches = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (serial[i].allsolid != batched[i].allsolid || serial[i].startsolid != batched[i].startsolid) mismatches++;
+		else if (serial[i].inopen != batched[i].inopen || serial[i].inwater != batched[i].inwater) mismatches++;
+		else if (serial[i].ent != batched[i].ent) mismatches++;
+		else if (memcmp (&serial[i].fraction, &batched[i].fraction, sizeof (float))) mismatches++;
+		else if (memcmp (serial[i].endpos, batched[i].endpos, sizeof (vec3_t))) mismatches++;
+		else if (memcmp (&serial[i].plane, &batched[i].plane, sizeof (plane_t))) mismatches++;
+	}
+
+	Con_Printf ("%i world traces on %i worker threads\n", count, (sv_threads.value && sv_numworkers > 0) ? sv_numworkers : 0);
+	Con_Printf ("serial  : %8.3f ms\n", serialtime * 1000.0);
+	Con_Printf ("batched : %8.3f ms\n", batchtime * 1000.0);
+	Con_Printf ("%i traces were different\n", mismatches);
+}
+
+
+cmd_t SV_WorldTraceTest_Cmd ("sv_worldtrace_test", SV_WorldTraceTest_f);
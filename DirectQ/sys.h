@@ -32,6 +32,7 @@ void Sys_Error (char *error, ...);
 void Sys_Quit (int ExitCode);
 
 double Sys_FloatTime (void);
+double Sys_DoubleTime (void);
 
 void Sys_SendKeyEvents (void);
 // Perform Key_Event () callbacks until the input que is empty
@@ -255,6 +255,18 @@ double Sys_FloatTime (void)
 }
 
 
+// full resolution timer for profiling and benchmarks; never use this to drive the game as it's not
+// guaranteed to be consistent across cores on all hardware
+double Sys_DoubleTime (void)
+{
+	__int64 qpccount;
+
+	QueryPerformanceCounter ((LARGE_INTEGER *) &qpccount);
+
+	return (double) (qpccount - sys_firstqpc) / (double) sys_qpcfreq;
+}
+
+
 void Sys_SendKeyEvents (void)
 {
 	MSG		msg;
@@ -45,6 +45,9 @@ typedef struct
 void SV_ClearWorld (void);
 // called after the world model has been loaded, before linking any entities
 
+void SV_AdaptAreaNodes (bool force);
+// resizes the areanode tree for the number of linked entities if needed; only call between frames
+
 void SV_UnlinkEdict (edict_t *ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -56,6 +59,38 @@ void SV_LinkEdict (edict_t *ent, bool touch_triggers);
 // sets ent->v.absmin and ent->v.absmax
 // if touchtriggers, calls prog functions for the intersected triggers
 
+void SV_BeginTriggerFrame (void);
+// the trigger broadphase that SV_TouchLinks asks first is rebuilt the first time it's needed after this
+
+void SV_BeginMoveTracking (void);
+void SV_EndMoveTracking (void);
+bool SV_MovedInBox (vec3_t mins, vec3_t maxs);
+// while tracking is on the box of everything that's linked or unlinked is kept, and SV_MovedInBox
+// says if any of them touch the given box (or if there were too many to keep)
+
+int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount);
+// fills list with the linked edicts from every areanode that the box reaches and returns how many
+// the edicts' own boxes aren't checked; the caller is expected to do it's own exact test
+
+int SV_AreaEdictsInBox (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, edict_t *skip);
+// the same but only the edicts (other than skip) whose absmin/absmax touch the box are returned
+
+typedef void (*svjob_t) (void *data, int first, int count);
+
+void SV_RunJob (svjob_t job, void *data, int count, int chunk);
+// runs job over count items in chunks on the worker threads and waits for them all to finish.
+// jobs must only read shared state and only write their own items.  don't call it from a job.
+
+void SV_StopWorkers (void);
+// tells the worker threads to exit and waits for them; called on shutdown
+
+void SV_WorldTraceBatch (int count, vec3_t *starts, vec3_t *ends, trace_t *traces);
+// point traces against the world only, run on the worker threads.  each trace is the same as
+// SV_ClipMoveToEntity on the world with no mins and maxs would give
+
+void SV_BuildContentsGrid (void);
+// builds the point contents grid for the world; called after the world model has been loaded
+
 int SV_PointContents (vec3_t p);
 int SV_TruePointContents (vec3_t p);
 // returns the CONTENTS_* value from the world at the given point.